@@ -0,0 +1,46 @@
+// L9958 H-bridge SPI driver
+#ifndef L9958_H
+#define L9958_H
+
+#include <stdint.h>
+#include "driver/spi_master.h"
+
+#define L9958_SPI_CLOCK_HZ 1000000 // Part allows up to 5 MHz
+
+// Configuration register (MOSI), see L9958 datasheet
+#define L9958_CFG_DR BIT(0)     // Reset the latched diagnostic bits
+#define L9958_CFG_CL_1 BIT(1)   // Current limit select, CL_2:CL_1 = 00 2.5 A, 01 4 A, 10 6.6 A, 11 8.6 A
+#define L9958_CFG_CL_2 BIT(2)
+#define L9958_CFG_VSR BIT(8)    // Voltage slew rate
+#define L9958_CFG_ISR BIT(9)    // Current slew rate
+#define L9958_CFG_ISR_DIS BIT(10)
+#define L9958_CFG_OL_ON BIT(11) // Enable open load test in on state
+#define L9958_CFG_DEFAULT (L9958_CFG_CL_1 | L9958_CFG_CL_2 | L9958_CFG_OL_ON)
+
+// Diagnostic register (MISO), returned with every frame
+#define L9958_DIAG_OL_OFF BIT(0)  // Open load in off state
+#define L9958_DIAG_OL_ON BIT(1)   // Open load in on state
+#define L9958_DIAG_VS_UV BIT(2)   // Supply undervoltage
+#define L9958_DIAG_VDD_OV BIT(3)  // Logic supply overvoltage
+#define L9958_DIAG_ILIM BIT(4)    // Current limit reached
+#define L9958_DIAG_TWARN BIT(5)   // Temperature warning
+#define L9958_DIAG_TSD BIT(6)     // Thermal shutdown
+#define L9958_DIAG_ACT BIT(7)     // Bridge active
+#define L9958_DIAG_OC_LS1 BIT(8)  // Overcurrent low side 1
+#define L9958_DIAG_OC_LS2 BIT(9)  // Overcurrent low side 2
+#define L9958_DIAG_OC_HS1 BIT(10) // Overcurrent high side 1
+#define L9958_DIAG_OC_HS2 BIT(11) // Overcurrent high side 2
+#define L9958_DIAG_SGND_OFF BIT(14) // Short to ground in off state
+#define L9958_DIAG_SBAT_OFF BIT(15) // Short to battery in off state
+#define L9958_DIAG_OC (L9958_DIAG_OC_LS1 | L9958_DIAG_OC_LS2 | L9958_DIAG_OC_HS1 | L9958_DIAG_OC_HS2)
+#define L9958_DIAG_FLOATING 0xFFFF  // MISO pulled up with nothing driving it, not a real diag word
+
+typedef struct l9958_s l9958_t;
+
+l9958_t *l9958_init(spi_host_device_t host, int cs, uint16_t config); // Add the device on an initialised bus
+void *l9958_end(l9958_t *l);                                            // Close and free
+int l9958_read_diag(l9958_t *l);     // Send config, return diagnostic register or -ve esp_err_t
+int l9958_clear_diag(l9958_t *l);    // Same, with DR set to clear latched faults
+void l9958_set_config(l9958_t *l, uint16_t config);
+
+#endif
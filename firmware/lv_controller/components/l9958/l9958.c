@@ -0,0 +1,95 @@
+// L9958 H-bridge SPI driver
+#include <stdlib.h>
+#include <string.h>
+
+#include "driver/spi_master.h"
+#include "esp_log.h"
+
+#include "l9958.h"
+
+static const char *TAG = "L9958";
+
+struct l9958_s
+{
+    spi_device_handle_t spi;
+    uint16_t config; // Sent with every frame
+};
+
+l9958_t *l9958_init(spi_host_device_t host, int cs, uint16_t config)
+{
+    l9958_t *l = malloc(sizeof(*l));
+    if (!l)
+        return l;
+    memset(l, 0, sizeof(*l));
+    l->config = config;
+
+    // 16 bit frames, CPOL 0 / CPHA 1, LSB first
+    spi_device_interface_config_t devcfg = {
+        .clock_speed_hz = L9958_SPI_CLOCK_HZ,
+        .mode = 1,
+        .spics_io_num = cs,
+        .queue_size = 1,
+        .flags = SPI_DEVICE_TXBIT_LSBFIRST | SPI_DEVICE_RXBIT_LSBFIRST,
+    };
+    esp_err_t err = spi_bus_add_device(host, &devcfg, &l->spi);
+    if (err)
+    {
+        ESP_LOGE(TAG, "SPI add device fail %s", esp_err_to_name(err));
+        free(l);
+        return NULL;
+    }
+
+    // First frame loads the config and clears anything latched at power up
+    int diag = l9958_clear_diag(l);
+    if (diag < 0)
+        return l9958_end(l);
+    if (diag == 0 || diag == L9958_DIAG_FLOATING)
+    { // MISO stuck low or high, the part is missing or not powered
+        ESP_LOGE(TAG, "CS %d: no L9958 answering (diag 0x%04X)", cs, diag);
+        return l9958_end(l);
+    }
+    return l;
+}
+
+void *l9958_end(l9958_t *l)
+{
+    if (l)
+    {
+        if (l->spi)
+            spi_bus_remove_device(l->spi);
+        free(l);
+    }
+    return NULL;
+}
+
+static int l9958_xfer(l9958_t *l, uint16_t word)
+{
+    if (!l)
+        return -ESP_ERR_INVALID_ARG;
+    spi_transaction_t t = {
+        .flags = SPI_TRANS_USE_TXDATA | SPI_TRANS_USE_RXDATA,
+        .length = 16,
+    };
+    t.tx_data[0] = word & 0xFF;
+    t.tx_data[1] = word >> 8;
+    esp_err_t err = spi_device_polling_transmit(l->spi, &t);
+    if (err)
+        return -err;
+    return t.rx_data[0] | (t.rx_data[1] << 8);
+}
+
+int l9958_read_diag(l9958_t *l)
+{
+    return l9958_xfer(l, l ? l->config : 0);
+}
+
+int l9958_clear_diag(l9958_t *l)
+{
+    return l9958_xfer(l, l ? l->config | L9958_CFG_DR : 0);
+}
+
+void l9958_set_config(l9958_t *l, uint16_t config)
+{
+    if (l)
+        l->config = config;
+}
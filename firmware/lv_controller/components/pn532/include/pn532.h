@@ -10,6 +10,10 @@
 #include <string.h>
 #include <unistd.h>
 #include <malloc.h>
+#include <stdbool.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 
 #define pn532_errs                                                                                                                                                                      \
 	p(OK)                                                                                                                                                                               \
@@ -26,6 +30,7 @@
 												p(SPACE)                                                                                                                                \
 													p(CHECKSUM)                                                                                                                         \
 														p(POSTAMBLE)                                                                                                                    \
+														p(ABORTED)                                                                                                                      \
 															p(STATUS)                                                                                                                   \
 																s(0x01, TIMEOUT)                                                                                                        \
 																	s(0x02, CRC)                                                                                                        \
@@ -65,6 +70,51 @@ typedef enum
 } pn532_err_t;
 
 typedef struct pn532_s pn532_t;
+typedef struct pn532_cmd_s pn532_cmd_t;
+typedef void pn532_cb_t(pn532_t *, pn532_cmd_t *);
+
+// Async command, run by the reader's driver task in the order submitted. The command and the buffers it points
+// at belong to the driver from pn532_submit until it is done
+struct pn532_cmd_s
+{
+	uint8_t cmd;			// Command code
+	int len1;				// Data after cmd, up to two blocks
+	const uint8_t *data1;
+	int len2;
+	const uint8_t *data2;
+	int max1;				// Response data after the response code, in to up to two blocks
+	uint8_t *rx1;
+	int max2;
+	uint8_t *rx2;
+	int timeout;			// ms from the ACK to the response, 0 to wait until it comes or another command is submitted
+	pn532_cb_t *cb;			// Run on the driver task once done, NULL for none
+	void *arg;
+	SemaphoreHandle_t done; // Given once done if set, for pn532_wait
+	volatile int result;	// Response length or -ve error once done
+	uint8_t tx[3];			// Command data for the pn532_*_Submit functions, data1 points here
+	// Driver
+	volatile bool busy;
+	volatile bool cancel;
+	pn532_cmd_t *next;
+};
+
+// Round trips answered at one UART rate, command frame on the wire to response parsed
+typedef struct pn532_link_s
+{
+	uint32_t baud;
+	uint32_t count;
+	uint64_t sum_us;
+	uint32_t max_us;
+	uint32_t errors; // Corrupt or unacknowledged frames
+	uint64_t tx_bytes; // On the wire at this rate, wake ups included
+	uint64_t rx_bytes;
+} pn532_link_t;
+
+// PowerDown WakeUpEnable sources
+#define PN532_WAKE_INT0 0x01
+#define PN532_WAKE_INT1 0x02
+#define PN532_WAKE_RF 0x08  // External RF field, e.g. a phone, reported on P70_IRQ only
+#define PN532_WAKE_HSU 0x10 // Always on, the driver wakes the chip with the next frame
 
 // Functions
 
@@ -73,10 +123,18 @@ void *pn532_end(pn532_t *p);										// Close and free
 
 pn532_err_t pn532_lasterr(pn532_t *);
 const char *pn532_err_to_name(pn532_err_t);
+uint32_t pn532_baud(pn532_t *);						  // UART rate negotiated with the PN532
+int pn532_link(pn532_t *, pn532_link_t *, int max); // Stats for each rate used so far, slowest first, returns how many
+uint64_t pn532_asleep_us(pn532_t *, uint32_t *wakes); // Time spent powered down since init, and how many times it was woken
+
+// Async commands, several can be in flight from different tasks
+int pn532_submit(pn532_t *, pn532_cmd_t *);	 // Queue a command, 0 or -ve if it could not be queued
+int pn532_wait(pn532_cmd_t *, int ms);		 // Wait for a command submitted with done set, result or PN532_ERR_CMDPENDING if still going after ms
+void pn532_cancel(pn532_t *, pn532_cmd_t *); // Stop a submitted command, it still finishes through its callback or done
 
 // Low level access functions
-int pn532_tx(pn532_t *, uint8_t cmd, int, uint8_t *, int, uint8_t *); // Send data to PN532 (up to two blocks) return 0 or negative for error. Starts byte after cmd
-int pn532_ready(pn532_t *p);										  // For async command handling: >0 if response ready, 0 if not, -ve if error (e.g. no response expected)
+int pn532_tx(pn532_t *, uint8_t cmd, int, const uint8_t *, int, const uint8_t *); // Stage data for the PN532 (up to two blocks) return 0 or negative for error. Starts byte after cmd. Sent by pn532_rx, the blocks must stay valid until then
+int pn532_ready(pn532_t *p);													  // For async command handling: >0 if pn532_rx can collect the response, -ve if error (e.g. no response expected)
 int pn532_rx(pn532_t *, int, uint8_t *, int, uint8_t *, int ms);	  // Recv data from PN532, (in to up to two blocks) return total length or -ve for error, checks res=cmd+1 and returns from byte after
 uint8_t *pn532_nfcid(pn532_t *, char text[21]);						  // Get NFCID (first byte is len of following)
 uint8_t *pn532_ats(pn532_t *);										  // Get ATS (first byte is len of following - note, not as received were it is len inc the length byte)
@@ -85,6 +143,8 @@ uint8_t *pn532_ats(pn532_t *);										  // Get ATS (first byte is len of follo
 int pn532_dx(void *, unsigned int len, uint8_t *data, unsigned int max, const char **errstr);
 
 // Higher level useful PN532 functions
+int pn532_RFConfiguration(pn532_t *p, uint8_t item, int len, uint8_t *data); // Set one config item, 0 or -ve
+int pn532_PowerDown(pn532_t *p, uint8_t wake);	 // Soft power down, field off, until the next command or a source in wake (PN532_WAKE_*)
 int pn532_deselect(pn532_t *p, uint8_t n);		 // Send deselect ID 1 or 2
 int pn532_release(pn532_t *p, uint8_t n);		 // Send release ID 1 or 2
 int pn532_write_GPIO(pn532_t *p, uint8_t value); // (P72/P71 in top bits, P35-30 in rest)
@@ -94,4 +154,10 @@ int pn532_Cards(pn532_t *p);					 // How many cards present (does pn532_ILPT_Sen
 int pn532_Present(pn532_t *p);					 // Check if present still
 int pn532_Cards_and_return_data(pn532_t *p, uint8_t *uid, uint8_t *uidLength);
 
+// On the caller's command, done and the response buffer rx2/max2 are the caller's. Nothing is held while it runs, wait with pn532_wait
+int pn532_InAutoPoll_Submit(pn532_t *p, pn532_cmd_t *c, uint8_t period);				   // InAutoPoll for 106 kbps type A, period in 150ms units. Runs until a card turns up, another command is submitted (PN532_ERR_ABORTED) or pn532_cancel
+int pn532_InAutoPoll_Result(pn532_t *p, pn532_cmd_t *c, uint8_t *uid, uint8_t *uidLength); // Once done, as pn532_Cards_and_return_data
+int pn532_Present_Submit(pn532_t *p, pn532_cmd_t *c);									   // Presence check for a DESFire, InListPassiveTarget for the rest
+int pn532_Present_Result(pn532_t *p, pn532_cmd_t *c);									   // Once done, as pn532_Present
+
 #endif
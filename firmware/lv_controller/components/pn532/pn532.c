@@ -8,10 +8,42 @@ static const char TAG[] = "PN532";
 #include "esp_log.h"
 #include <driver/uart.h>
 #include <driver/gpio.h>
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_timer.h"
 
 #define HEXLOG ESP_LOG_DEBUG
 #define RX_BUF 280
 #define TX_BUF UART_FIFO_LEN + 1
+#define EVENT_QUEUE 16 // UART driver events
+#define CMD_QUEUE 8    // Submitted commands not yet picked up by the driver task
+#define RX_TOUT 3      // Symbols of silence before the UART driver posts the bytes it has
+#define ACK_MS 10      // After the command frame is on the wire
+#define FRAME_BYTES 12 // Framing around the response data, extended length
+#define LINK_ERRORS 3  // Corrupt frames in a row before the UART drops a rate
+#define LINK_PROBES 3  // GetFirmwareVersion round trips a new rate has to pass
+#define BR_DEFAULT 4   // SetSerialBaudRate code the PN532 powers up at
+#define WAKE_MS 2      // After PowerDown, the oscillator has to start before the PN532 takes a frame
+#define WAKE_MAX (2 + 921600 / 10 * WAKE_MS / 1000) // Wake up preamble at the fastest rate
+
+// SetSerialBaudRate codes, the PN532 also has 1288000 (8) which is not used
+static const uint32_t pn532_bauds[] = {9600, 19200, 38400, 57600, 115200, 230400, 460800, 921600};
+#define BR_COUNT (sizeof(pn532_bauds) / sizeof(*pn532_bauds))
+
+#define GARBLED(l) ((l) == -PN532_ERR_CHECKSUM || (l) == -PN532_ERR_POSTAMBLE) // The PN532 answered, the line mangled it
+
+enum parse_state
+{
+   PS_START0, // 00
+   PS_START1, // FF
+   PS_LEN,    // LEN LCS, or 00 FF ACK, FF 00 NACK, FF FF extended
+   PS_EXT,    // LENM LENL LCS
+   PS_TFI,
+   PS_CODE,
+   PS_DATA,
+   PS_DCS,
+   PS_POST,
+};
 
 struct pn532_s
 {
@@ -25,6 +57,43 @@ struct pn532_s
    uint8_t nfcid[11];        // First card ID last seen (starts with len)
    uint8_t ats[30];          // First card ATS last seen (starts with len)
    SemaphoreHandle_t mutex;  // DX mutex
+   uint32_t baud;            // UART rate
+   uint8_t br;               // SetSerialBaudRate code for baud
+   uint8_t br_max;           // Highest code the link may use, lowered by each fallback
+   uint8_t bad;              // Corrupt or unacknowledged frames in a row
+   pn532_link_t link[BR_COUNT];
+   uint8_t asleep;           // PowerDown answered, the next frame goes out behind a wake up
+   uint8_t drowsy;           // Last frame had no ACK, the PN532 may not have woken
+   uint32_t wakes;
+   int64_t slept;            // When it went down, us
+   uint64_t asleep_us;       // Up to the last wake up
+   // Driver task, owns the UART and runs the submitted commands one at a time
+   TaskHandle_t task;
+   QueueHandle_t events;     // UART driver events
+   QueueHandle_t cmds;       // Submitted commands, NULL just wakes the task
+   QueueSetHandle_t set;     // Both of the above
+   pn532_cmd_t *head;        // Picked up, waiting for the wire
+   pn532_cmd_t *tail;
+   pn532_cmd_t *cur;         // On the wire
+   uint8_t acked;            // cur has its ACK and waits for the response
+   uint8_t timed;            // deadline applies to cur
+   TickType_t deadline;
+   int64_t sent;             // When cur went on the wire, us
+   // Frame parser, fed whatever the UART driver has buffered and resumed where it left off
+   uint8_t ps;               // enum parse_state
+   uint8_t hdr[5];           // LEN/LCS, or the extended header
+   uint8_t hdr_n;
+   uint8_t sum;              // Running DCS
+   uint8_t tfi;
+   uint8_t code;
+   int len;                  // TFI onwards
+   int pos;                  // Of len seen so far
+   int perr;                 // Error to finish dst with once the frame is complete, 0 for none, -ve to drop the frame
+   pn532_cmd_t *dst;         // Command on the wire when the frame started, the payload goes straight in to its buffers
+   uint8_t rx[RX_BUF];       // What the UART driver had buffered, parsed in place
+   // pn532_tx/pn532_rx exchange, run through the driver like any other command
+   pn532_cmd_t sync;
+   SemaphoreHandle_t sync_done;
 };
 
 // Data
@@ -63,9 +132,9 @@ static int uart_rx(pn532_t *p, uint8_t *buf, uint32_t length, int ms)
    if (!p)
       return -PN532_ERR_NULL;
    ms /= portTICK_PERIOD_MS;
-   if (ms < 2)
-      ms = 2; // Ensure some timeout
    int l = uart_read_bytes(p->uart, buf, length, ms);
+   if (l > 0)
+      p->link[p->br].rx_bytes += l;
    // ESP_LOGI(TAG, "Rx %d", l);
 #ifdef CONFIG_PN532_DUMP
    if (l > 0)
@@ -81,6 +150,8 @@ static int uart_tx(pn532_t *p, const uint8_t *src, size_t size)
    if (!p)
       return -PN532_ERR_NULL;
    int l = uart_write_bytes(p->uart, (char *)src, size);
+   if (l > 0)
+      p->link[p->br].tx_bytes += l;
    // ESP_LOGI(TAG, "Tx %d/%d", l, size);
 #ifdef CONFIG_PN532_DUMP
    if (l > 0)
@@ -91,20 +162,388 @@ static int uart_tx(pn532_t *p, const uint8_t *src, size_t size)
    return l;
 }
 
-static int uart_preamble(pn532_t *p, int ms)
-{ // Wait for preamble
-   if (!p)
-      return -PN532_ERR_NULL;
-   uint8_t last = 0xFF;
+static int wire_ms(pn532_t *p, int bytes)
+{ // 10 bits per byte
+   return (bytes * 10 * 1000 + p->baud - 1) / p->baud;
+}
+
+static void uart_ack(pn532_t *p)
+{ // ACK from the host, stops whatever the PN532 is doing
+   static const uint8_t ack[] = {0x00, 0x00, 0xFF, 0x00, 0xFF, 0x00};
+   uart_tx(p, ack, sizeof(ack));
+}
+
+static int hsu_wake(pn532_t *p)
+{ // 0x55 wakes the HSU, the zeros after it last until the PN532 can take a frame. Bytes sent
+   static const uint8_t preamble[WAKE_MAX] = {0x55, 0x55};
+   int n = 2 + p->baud / 10 * WAKE_MS / 1000;
+   uart_tx(p, preamble, n);
+   if (p->asleep)
+   {
+      p->asleep_us += esp_timer_get_time() - p->slept;
+      p->wakes++;
+   }
+   p->asleep = 0;
+   p->drowsy = 0;
+   return n;
+}
+
+static void send_frame(pn532_t *p, pn532_cmd_t *c)
+{ // Command frame, the driver task is the only writer
+   int w = p->asleep || p->drowsy ? hsu_wake(p) : 0;
+   uint8_t buf[20],
+       *b = buf;
+   *b++ = 0x55;
+   *b++ = 0x55;
+   *b++ = 0x55;
+   *b++ = 0x00; // Preamble
+   *b++ = 0x00; // Start 1
+   *b++ = 0xFF; // Start 2
+   int l = c->len1 + c->len2 + 2;
+   if (l >= 0x100)
+   {
+      *b++ = 0xFF; // Extended len
+      *b++ = 0xFF;
+      *b++ = (l >> 8); // len
+      *b++ = (l & 0xFF);
+      *b++ = -(l >> 8) - (l & 0xFF); // Checksum
+   }
+   else
+   {
+      *b++ = l;  // Len
+      *b++ = -l; // Checksum
+   }
+   *b++ = 0xD4; // Direction (host to PN532)
+   *b++ = c->cmd;
+   uint8_t sum = 0xD4 + c->cmd;
+   for (l = 0; l < c->len1; l++)
+      sum += c->data1[l];
+   for (l = 0; l < c->len2; l++)
+      sum += c->data2[l];
+   int n = w + b - buf + c->len1 + c->len2 + 2;
+   uart_tx(p, buf, b - buf);
+   if (c->len1)
+      uart_tx(p, c->data1, c->len1);
+   if (c->len2)
+      uart_tx(p, c->data2, c->len2);
+   buf[0] = -sum; // Checksum
+   buf[1] = 0x00; // Postamble
+   uart_tx(p, buf, 2);
+   p->acked = 0;
+   p->timed = 1;
+   p->sent = esp_timer_get_time();
+   p->deadline = xTaskGetTickCount() + pdMS_TO_TICKS(wire_ms(p, n + 6) + ACK_MS) + 1;
+}
+
+static void complete(pn532_t *p, pn532_cmd_t *c, int result)
+{ // Hand a command back, it belongs to the submitter again once the callback runs
+   if (c == p->cur)
+   {
+      pn532_link_t *k = &p->link[p->br];
+      if (result >= 0)
+      {
+         p->bad = 0;
+         if (c->timeout)
+         { // Open ended commands wait on the field, not the link
+            uint32_t us = esp_timer_get_time() - p->sent;
+            k->count++;
+            k->sum_us += us;
+            if (us > k->max_us)
+               k->max_us = us;
+         }
+      }
+      else if (GARBLED(result) || result == -PN532_ERR_TIMEOUTACK)
+      {
+         p->bad++;
+         k->errors++;
+         p->drowsy = result == -PN532_ERR_TIMEOUTACK; // An awake PN532 ignores the wake up
+      }
+      p->cur = NULL;
+   }
+   if (p->dst == c)
+      p->dst = NULL; // The rest of a frame it timed out in must not land in its buffers once they are the submitter's again
+   if (result < 0)
+      p->lasterr = -result;
+   c->result = result;
+   c->busy = 0;
+   if (c->cb)
+      c->cb(p, c);
+   if (c->done)
+      xSemaphoreGive(c->done);
+}
+
+static void abort_cur(pn532_t *p, int result)
+{
+   uart_ack(p);
+   complete(p, p->cur, result);
+}
+
+static void start_next(pn532_t *p)
+{ // Next command straight after the last response, no round trip through the submitter
+   while (!p->cur && p->head)
+   {
+      pn532_cmd_t *c = p->head;
+      p->head = c->next;
+      if (!p->head)
+         p->tail = NULL;
+      if (c->cancel)
+      {
+         complete(p, c, -PN532_ERR_TIMEOUT);
+         continue;
+      }
+      p->cur = c;
+      send_frame(p, c);
+   }
+}
+
+static void reap(pn532_t *p)
+{ // Cancelled commands still waiting for the wire
+   pn532_cmd_t **pp = &p->head,
+               *prev = NULL;
+   while (*pp)
+   {
+      pn532_cmd_t *c = *pp;
+      if (!c->cancel)
+      {
+         prev = c;
+         pp = &c->next;
+         continue;
+      }
+      *pp = c->next;
+      if (p->tail == c)
+         p->tail = prev;
+      complete(p, c, -PN532_ERR_TIMEOUT);
+   }
+}
+
+static void got_ack(pn532_t *p)
+{
+   if (!p->cur || p->acked)
+      return; // Stray
+   p->acked = 1;
+   p->timed = p->cur->timeout > 0;
+   p->deadline = xTaskGetTickCount() + pdMS_TO_TICKS(p->cur->timeout + wire_ms(p, p->cur->max1 + p->cur->max2 + FRAME_BYTES)) + 1;
+}
+
+static void frame_start(pn532_t *p)
+{ // TFI and command code are in, pick where the payload goes
+   pn532_cmd_t *c = p->cur;
+   p->dst = c;
+   p->perr = 0;
+   if (!c || !p->acked)
+      p->perr = -1; // Nothing waiting for it, drop
+   else if (p->len < 2 || p->tfi != 0xD5)
+      p->perr = PN532_ERR_HEADER; // Not reply, e.g. syntax error frame
+   else if (p->code != c->cmd + 1)
+      p->perr = PN532_ERR_CMDMISMATCH; // Not right reply
+   else if (p->len - 2 > c->max1 + c->max2)
+      p->perr = PN532_ERR_SPACE; // Too big
+}
+
+static void frame_end(pn532_t *p, uint8_t post)
+{
+   pn532_cmd_t *c = p->cur;
+   p->ps = PS_START0;
+   if (p->perr < 0 || !c || p->dst != c)
+      return; // Not for the command on the wire, or it timed out part way through
+   if (p->sum)
+      complete(p, c, -PN532_ERR_CHECKSUM);
+   else if (post)
+      complete(p, c, -PN532_ERR_POSTAMBLE);
+   else if (p->perr)
+      complete(p, c, -p->perr);
+   else
+      complete(p, c, p->len - 2);
+}
+
+static int payload(pn532_t *p, const uint8_t *b, int n)
+{ // Run of payload bytes, summed and copied once in to the command's buffers
+   int left = p->len - p->pos;
+   if (n > left)
+      n = left;
+   uint8_t sum = p->sum; // Local, the bytes could alias anything in p
+   for (int i = 0; i < n; i++)
+      sum += b[i];
+   p->sum = sum;
+   pn532_cmd_t *c = p->dst;
+   if (!p->perr && c && c == p->cur)
+   {
+      int at = p->pos - 2; // Into the response data
+      int l = at < c->max1 ? c->max1 - at : 0;
+      if (l > n)
+         l = n;
+      if (l)
+         memcpy(c->rx1 + at, b, l);
+      if (n > l)
+         memcpy(c->rx2 + at + l - c->max1, b + l, n - l);
+   }
+   p->pos += n;
+   if (p->pos == p->len)
+      p->ps = PS_DCS;
+   return n;
+}
+
+static void parse(pn532_t *p, const uint8_t *b, int n)
+{ // Incremental, a frame may be split anywhere across calls
+   const uint8_t *e = b + n;
+   while (b < e)
+   {
+      if (p->ps == PS_DATA)
+      {
+         b += payload(p, b, e - b);
+         continue;
+      }
+      uint8_t c = *b++;
+      switch (p->ps)
+      {
+      case PS_START0:
+         if (!c)
+            p->ps = PS_START1;
+         break;
+      case PS_START1:
+         p->ps = c == 0xFF ? PS_LEN : c ? PS_START0 : PS_START1;
+         p->hdr_n = 0;
+         break;
+      case PS_LEN:
+         p->hdr[p->hdr_n++] = c;
+         if (p->hdr_n < 2)
+            break;
+         if (!p->hdr[0] && p->hdr[1] == 0xFF)
+         { // ACK
+            got_ack(p);
+            p->ps = PS_START0;
+         }
+         else if (p->hdr[0] == 0xFF && !p->hdr[1])
+         { // NACK
+            if (p->cur && !p->acked)
+               complete(p, p->cur, -PN532_ERR_NACK);
+            p->ps = PS_START0;
+         }
+         else if (p->hdr[0] == 0xFF && p->hdr[1] == 0xFF)
+            p->ps = PS_EXT;
+         else if ((uint8_t)(p->hdr[0] + p->hdr[1]) || !p->hdr[0])
+         { // Not a frame header after all, the LCS byte may start the next one
+            p->ps = PS_START0;
+            b--;
+         }
+         else
+         {
+            p->len = p->hdr[0];
+            p->ps = PS_TFI;
+         }
+         break;
+      case PS_EXT:
+         p->hdr[p->hdr_n++] = c;
+         if (p->hdr_n < 5)
+            break;
+         p->len = (p->hdr[2] << 8) + p->hdr[3];
+         if ((uint8_t)(p->hdr[2] + p->hdr[3] + p->hdr[4]) || !p->len)
+            p->ps = PS_START0; // Bad checksum
+         else
+            p->ps = PS_TFI;
+         break;
+      case PS_TFI:
+         p->tfi = c;
+         p->sum = c;
+         p->pos = 1;
+         p->code = 0;
+         if (p->len == 1)
+         {
+            frame_start(p);
+            p->ps = PS_DCS;
+         }
+         else
+            p->ps = PS_CODE;
+         break;
+      case PS_CODE:
+         p->code = c;
+         p->sum += c;
+         p->pos = 2;
+         frame_start(p);
+         p->ps = p->len > 2 ? PS_DATA : PS_DCS;
+         break;
+      case PS_DCS:
+         p->sum += c;
+         p->ps = PS_POST;
+         break;
+      case PS_POST:
+         frame_end(p, c);
+         break;
+      default:
+         p->ps = PS_START0;
+         break;
+      }
+   }
+}
+
+static void uart_event(pn532_t *p, uart_event_t *event)
+{
+   switch (event->type)
+   {
+   case UART_DATA:
+   {
+      size_t len = 0;
+      uart_get_buffered_data_len(p->uart, &len);
+      while (len)
+      { // Everything buffered, in one read unless it is more than a frame
+         int l = uart_rx(p, p->rx, len < sizeof(p->rx) ? len : sizeof(p->rx), 0);
+         if (l <= 0)
+            break;
+         parse(p, p->rx, l);
+         len -= l;
+      }
+      break;
+   }
+   case UART_FIFO_OVF:
+   case UART_BUFFER_FULL:
+      ESP_LOGW(TAG, "UART %d rx overflow", p->uart);
+      uart_flush_input(p->uart);
+      p->ps = PS_START0;
+      break;
+   default:
+      break;
+   }
+}
+
+static void pn532_task(void *arg)
+{ // Sleeps until the UART driver has bytes, a command is submitted or the command on the wire times out
+   pn532_t *p = arg;
    while (1)
    {
-      uint8_t c;
-      int l = uart_rx(p, &c, 1, ms);
-      if (l < 1)
-         return l;
-      if (last == 0x00 && c == 0xFF)
-         return 2;
-      last = c;
+      TickType_t wait = portMAX_DELAY;
+      if (p->cur && p->timed)
+      {
+         int32_t left = p->deadline - xTaskGetTickCount();
+         wait = left > 0 ? left : 0;
+      }
+      QueueSetMemberHandle_t m = xQueueSelectFromSet(p->set, wait);
+      if (m == p->events)
+      {
+         uart_event_t event;
+         if (xQueueReceive(p->events, &event, 0))
+            uart_event(p, &event);
+      }
+      else if (m == p->cmds)
+      {
+         pn532_cmd_t *c;
+         if (xQueueReceive(p->cmds, &c, 0) && c)
+         {
+            c->next = NULL;
+            if (p->tail)
+               p->tail->next = c;
+            else
+               p->head = c;
+            p->tail = c;
+         }
+      }
+      if (p->cur && p->timed && (int32_t)(xTaskGetTickCount() - p->deadline) >= 0)
+         abort_cur(p, p->acked ? -PN532_ERR_TIMEOUT : -PN532_ERR_TIMEOUTACK);
+      else if (p->cur && p->cur->cancel)
+         abort_cur(p, -PN532_ERR_TIMEOUT);
+      else if (p->cur && p->acked && !p->cur->timeout && p->head)
+         abort_cur(p, -PN532_ERR_ABORTED); // Open ended, e.g. InAutoPoll, gives way to the next command
+      reap(p);
+      start_next(p);
    }
 }
 
@@ -112,12 +551,25 @@ void *pn532_end(pn532_t *p)
 {
    if (p)
    {
+      if (p->task)
+         vTaskDelete(p->task);
+      if (p->events)
+         uart_driver_delete(p->uart); // Next pn532_init gets a fresh event queue
+      if (p->set)
+         vQueueDelete(p->set);
+      if (p->cmds)
+         vQueueDelete(p->cmds);
+      if (p->sync_done)
+         vSemaphoreDelete(p->sync_done);
       vSemaphoreDelete(p->mutex);
       free(p);
    }
    return NULL;
 }
 
+static void link_hunt(pn532_t *p);
+static void link_negotiate(pn532_t *p);
+
 pn532_t *pn532_init(int8_t uart, int8_t tx, int8_t rx, uint8_t outputs)
 { // Init PN532
    // gpio_set_direction(GPIO_NUM_36, GPIO_MODE_INPUT);
@@ -147,12 +599,17 @@ pn532_t *pn532_init(int8_t uart, int8_t tx, int8_t rx, uint8_t outputs)
       return p;
    memset(p, 0, sizeof(*p));
    p->uart = uart;
+   p->br = BR_DEFAULT;
+   p->baud = pn532_bauds[p->br];
+   p->br_max = p->br;
+   while (p->br_max + 1 < BR_COUNT && pn532_bauds[p->br_max + 1] <= CONFIG_PN532_BAUD)
+      p->br_max++;
    p->mutex = xSemaphoreCreateBinary();
    xSemaphoreGive(p->mutex);
    esp_err_t err = 0;
    { // Init UART
       uart_config_t uart_config = {
-          .baud_rate = 115200,
+          .baud_rate = p->baud,
           .data_bits = UART_DATA_8_BITS,
           .parity = UART_PARITY_DISABLE,
           .stop_bits = UART_STOP_BITS_1,
@@ -171,11 +628,15 @@ pn532_t *pn532_init(int8_t uart, int8_t tx, int8_t rx, uint8_t outputs)
          // gpio_config(&cfg_tx);
          err = uart_set_pin(uart, tx, rx, -1, -1);
       }
-      if (!err && !uart_is_driver_installed(uart))
+      if (!err && uart_is_driver_installed(uart))
+         err = uart_driver_delete(uart); // The event queue only comes with a fresh install
+      if (!err)
       {
          ESP_LOGI(TAG, "Installing UART driver %d", uart);
-         err = uart_driver_install(uart, RX_BUF, TX_BUF, 0, NULL, 0);
+         err = uart_driver_install(uart, RX_BUF, TX_BUF, EVENT_QUEUE, &p->events, 0);
       }
+      if (!err)
+         err = uart_set_rx_timeout(uart, RX_TOUT);
       if (err)
       {
          ESP_LOGE(TAG, "UART fail %s", esp_err_to_name(err));
@@ -196,6 +657,22 @@ pn532_t *pn532_init(int8_t uart, int8_t tx, int8_t rx, uint8_t outputs)
    uart_tx(p, buf, sizeof(buf));
    uart_wait_tx_done(p->uart, 1000 / portTICK_PERIOD_MS);
    uart_flush_input(p->uart);
+   // Driver task, everything from here on goes through it
+   p->cmds = xQueueCreate(CMD_QUEUE, sizeof(pn532_cmd_t *));
+   p->set = xQueueCreateSet(EVENT_QUEUE + CMD_QUEUE);
+   p->sync_done = xSemaphoreCreateBinary();
+   if (!p->cmds || !p->set || !p->sync_done)
+      return pn532_end(p);
+   if (xQueueAddToSet(p->events, p->set) != pdPASS || xQueueAddToSet(p->cmds, p->set) != pdPASS)
+   { // The task would never see them
+      ESP_LOGE(TAG, "UART %d queue set fail", uart);
+      return pn532_end(p);
+   }
+   if (xTaskCreate(pn532_task, "pn532", 3072, p, CONFIG_PN532_TASK_PRIORITY, &p->task) != pdPASS)
+   {
+      p->task = NULL;
+      return pn532_end(p);
+   }
    // Set up PN532 (SAM first as in vLowBat mode)
    // SAMConfiguration
    n = 0;
@@ -204,8 +681,11 @@ pn532_t *pn532_init(int8_t uart, int8_t tx, int8_t rx, uint8_t outputs)
    buf[n++] = 20;   // *50ms timeout
    buf[n++] = 0x00; // Not use IRQ
    if (pn532_tx(p, 0x14, 0, NULL, n, buf) < 0 || pn532_rx(p, 0, NULL, sizeof(buf), buf, 50) < 0)
-   {                                     // Again
-      uart_rx(p, buf, sizeof(buf), 100); // Wait long enough for command response timeout before we try again
+   {                                   // Again
+      vTaskDelay(100 / portTICK_PERIOD_MS); // Wait long enough for command response timeout before we try again
+      xSemaphoreTake(p->mutex, portMAX_DELAY);
+      link_hunt(p); // Still at the rate a previous init left it on if only we restarted
+      xSemaphoreGive(p->mutex);
       // SAMConfiguration
       n = 0;
       buf[n++] = 0x01; // Normal
@@ -218,6 +698,10 @@ pn532_t *pn532_init(int8_t uart, int8_t tx, int8_t rx, uint8_t outputs)
          return pn532_end(p);
       }
    }
+   // SetSerialBaudRate, as fast as the line holds
+   xSemaphoreTake(p->mutex, portMAX_DELAY);
+   link_negotiate(p);
+   xSemaphoreGive(p->mutex);
    // GetFirmwareVersion
    if (pn532_tx(p, 0x02, 0, NULL, 0, NULL) < 0 || pn532_rx(p, 0, NULL, sizeof(buf), buf, 50) < 0)
    {
@@ -308,76 +792,186 @@ uint8_t *pn532_nfcid(pn532_t *p, char text[21])
    return p->nfcid;
 }
 
-// Low level access functions
-int pn532_tx_mutex(pn532_t *p, uint8_t cmd, int len1, uint8_t *data1, int len2, uint8_t *data2)
-{ // Send data to PN532
-   if (p->pending)
+// Async commands
+int pn532_submit(pn532_t *p, pn532_cmd_t *c)
+{ // Queue a command for the driver task, it runs once those ahead of it are done
+   if (!p)
+      return -PN532_ERR_NULL;
+   if (c->busy)
       return -(p->lasterr = PN532_ERR_CMDPENDING);
-   uint8_t buf[20],
-       *b = buf;
-   *b++ = 0x55;
-   *b++ = 0x55;
-   *b++ = 0x55;
-   *b++ = 0x00; // Preamble
-   *b++ = 0x00; // Start 1
-   *b++ = 0xFF; // Start 2
-   int l = len1 + len2 + 2;
-   if (l >= 0x100)
+   c->busy = 1;
+   c->cancel = 0;
+   c->result = 0;
+   if (xQueueSend(p->cmds, &c, 0) != pdTRUE)
    {
-      *b++ = 0xFF; // Extended len
-      *b++ = 0xFF;
-      *b++ = (l >> 8); // len
-      *b++ = (l & 0xFF);
-      *b++ = -(l >> 8) - (l & 0xFF); // Checksum
+      c->busy = 0;
+      return -(p->lasterr = PN532_ERR_CMDPENDING); // Queue full
    }
-   else
+   return 0;
+}
+
+int pn532_wait(pn532_cmd_t *c, int ms)
+{ // Future style, for commands submitted with done set. ms < 0, e.g. portMAX_DELAY, waits until it is done
+   if (!c->done)
+      return -PN532_ERR_NULL;
+   if (xSemaphoreTake(c->done, ms < 0 ? portMAX_DELAY : ms / portTICK_PERIOD_MS) != pdTRUE)
+      return -PN532_ERR_CMDPENDING; // Still going
+   return c->result;
+}
+
+void pn532_cancel(pn532_t *p, pn532_cmd_t *c)
+{ // Finishes with PN532_ERR_TIMEOUT unless the response beat it, the callback or done still follow
+   if (!p || !c->busy)
+      return;
+   c->cancel = 1;
+   pn532_cmd_t *wake = NULL;
+   xQueueSendToFront(p->cmds, &wake, portMAX_DELAY);
+}
+
+// Low level access functions
+static int sync_wait(pn532_t *p, int ms)
+{ // Response length, or -ve. Gives up on the command after ms
+   int l = pn532_wait(&p->sync, ms);
+   if (l == -PN532_ERR_CMDPENDING)
    {
-      *b++ = l;  // Len
-      *b++ = -l; // Checksum
+      pn532_cancel(p, &p->sync);
+      xSemaphoreTake(p->sync_done, portMAX_DELAY);
+      l = p->sync.result;
    }
-   *b++ = 0xD4; // Direction (host to PN532)
-   *b++ = cmd;
-   uint8_t sum = 0xD4 + cmd;
-   for (l = 0; l < len1; l++)
-      sum += data1[l];
-   for (l = 0; l < len2; l++)
-      sum += data2[l];
-   uart_flush_input(p->uart);
-   // Send data
-   uart_tx(p, buf, b - buf);
-   if (len1)
-      uart_tx(p, data1, len1);
-   if (len2)
-      uart_tx(p, data2, len2);
-   buf[0] = -sum; // Checksum
-   buf[1] = 0x00; // Postamble
-   uart_tx(p, buf, 2);
-   uart_wait_tx_done(p->uart, 100 / portTICK_PERIOD_MS);
-   // Get ACK and check it
-   l = uart_preamble(p, 10);
-   // l = uart_preamble(p, 50); // increase timeout to 50 ms
-   if (l < 2)
+   if (l < 0)
+      p->lasterr = -l;
+   return l;
+}
+
+static pn532_cmd_t *sync_cmd(pn532_t *p, uint8_t cmd, int len1, const uint8_t *data1, int len2, const uint8_t *data2, int max1, uint8_t *rx1, int max2, uint8_t *rx2, int ms)
+{ // Caller holds the mutex, the caller's buffers go to the driver as they are and the response lands straight in them
+   pn532_cmd_t *c = &p->sync;
+   c->cmd = cmd;
+   c->len1 = len1;
+   c->data1 = data1;
+   c->len2 = len2;
+   c->data2 = data2;
+   c->max1 = max1;
+   c->rx1 = rx1;
+   c->max2 = max2;
+   c->rx2 = rx2;
+   c->timeout = ms;
+   c->cb = NULL;
+   c->arg = NULL;
+   c->done = p->sync_done;
+   return c;
+}
+
+static int exchange_mutex(pn532_t *p, uint8_t cmd, int len1, uint8_t *data1, int len2, uint8_t *data2, int max1, uint8_t *rx1, int max2, uint8_t *rx2, int ms)
+{ // Blocking round trip
+   int l = pn532_submit(p, sync_cmd(p, cmd, len1, data1, len2, data2, max1, rx1, max2, rx2, ms));
+   if (l >= 0)
+      l = sync_wait(p, portMAX_DELAY); // The driver times it out
+   return l;
+}
+
+// UART rate, moved with SetSerialBaudRate. Everything here runs with the mutex held and nothing pending
+static void set_baud(pn532_t *p, uint8_t br)
+{
+   uart_wait_tx_done(p->uart, portMAX_DELAY);
+   uart_set_baudrate(p->uart, pn532_bauds[br]);
+   p->baud = pn532_bauds[br];
+   p->br = br;
+   p->bad = 0;
+}
+
+static void baud_cb(pn532_t *p, pn532_cmd_t *c)
+{ // Driver task, the PN532 only moves once it has an ACK for its SetSerialBaudRate response
+   if (c->result < 0 && !GARBLED(c->result))
+      return; // Never got there
+   uart_ack(p);
+   set_baud(p, (uintptr_t)c->arg);
+}
+
+static int link_probe(pn532_t *p, int n)
+{ // n GetFirmwareVersion round trips at the rate the host is at, 0 if all were clean
+   uint8_t ver[4];
+   int l = 0;
+   while (n-- && l >= 0)
+      l = exchange_mutex(p, 0x02, 0, NULL, 0, NULL, 0, NULL, sizeof(ver), ver, 50);
+   return l < 0 ? l : 0;
+}
+
+static void link_hunt(pn532_t *p)
+{ // Find the rate the PN532 is at, e.g. after we restarted and it did not
+   for (int br = BR_COUNT - 1; br >= BR_DEFAULT; br--)
    {
-      // ESP_LOGI(TAG, "TX with l from preamble: %d", l);
-      return -(p->lasterr = PN532_ERR_TIMEOUTACK);
+      set_baud(p, br);
+      int l = link_probe(p, 1);
+      if (l >= 0 || GARBLED(l))
+         return; // Something answered, if badly the fallback takes it down from here
    }
-   l = uart_rx(p, buf, 3, 10);
-   if (l < 3)
+   set_baud(p, BR_DEFAULT); // Not answering at all, where it powers up
+}
+
+static int link_rate(pn532_t *p, uint8_t br)
+{ // Both ends to br and prove it, else back to wherever the PN532 answers
+   pn532_cmd_t *c = sync_cmd(p, 0x10, 1, &br, 0, NULL, 0, NULL, 0, NULL, 50);
+   c->cb = baud_cb;
+   c->arg = (void *)(uintptr_t)br;
+   int l = pn532_submit(p, c);
+   if (l >= 0)
+      l = sync_wait(p, portMAX_DELAY);
+   if (l >= 0 || GARBLED(l))
+   {
+      vTaskDelay(1); // The PN532 takes a moment to retune its UART
+      if (!(l = link_probe(p, LINK_PROBES)))
+         return 0;
+   }
+   ESP_LOGW(TAG, "UART %d: %lu baud failed %s", p->uart, (unsigned long)pn532_bauds[br], pn532_err_to_name(-l));
+   link_hunt(p);
+   return l;
+}
+
+static void link_negotiate(pn532_t *p)
+{ // Fastest rate up to br_max that holds, a step lower each time one does not
+   while (p->br != p->br_max && link_rate(p, p->br_max) && p->br_max > BR_DEFAULT)
+      p->br_max--;
+   ESP_LOGI(TAG, "UART %d at %lu baud", p->uart, (unsigned long)p->baud);
+}
+
+static void link_check(pn532_t *p)
+{ // After each exchange, a line that keeps mangling frames drops a rate for good
+   if (p->bad < LINK_ERRORS || p->br <= BR_DEFAULT)
+      return;
+   ESP_LOGW(TAG, "UART %d: %d bad frames in a row at %lu baud", p->uart, p->bad, (unsigned long)p->baud);
+   p->br_max = p->br - 1;
+   link_negotiate(p);
+}
+
+static void link_recheck(pn532_t *p)
+{ // link_check for commands submitted without the mutex, only taken when there is a rate to drop
+   if (p->bad < LINK_ERRORS)
+      return;
+   xSemaphoreTake(p->mutex, portMAX_DELAY);
+   link_check(p);
+   xSemaphoreGive(p->mutex);
+}
+
+static void sleep_cb(pn532_t *p, pn532_cmd_t *c)
+{ // Driver task, the PN532 powers down once it has answered so the next frame has to wake it
+   if (c->result >= 1 && !c->rx2[0])
    {
-      // ESP_LOGI(TAG, "RX with l: %d", l);
-      return -(p->lasterr = PN532_ERR_TIMEOUTACK);
-   }
-   if (buf[2])
-      return -(p->lasterr = PN532_ERR_BADACK);
-   if (buf[0] == 0xFF && !buf[1])
-      return -(p->lasterr = PN532_ERR_NACK);
-   if (buf[0] || buf[1] != 0xFF)
-      return -(p->lasterr = PN532_ERR_BADACK); // Bad
+      p->asleep = 1;
+      p->slept = esp_timer_get_time();
+   }
+}
+
+int pn532_tx_mutex(pn532_t *p, uint8_t cmd, int len1, const uint8_t *data1, int len2, const uint8_t *data2)
+{ // Send data to PN532, once pn532_rx has the buffers for the response. The data stays the caller's until then
+   if (p->pending)
+      return -(p->lasterr = PN532_ERR_CMDPENDING);
+   sync_cmd(p, cmd, len1, data1, len2, data2, 0, NULL, 0, NULL, 0);
    p->pending = cmd + 1;
    return len1 + len2;
 }
 
-int pn532_tx(pn532_t *p, uint8_t cmd, int len1, uint8_t *data1, int len2, uint8_t *data2)
+int pn532_tx(pn532_t *p, uint8_t cmd, int len1, const uint8_t *data1, int len2, const uint8_t *data2)
 { // Send data to PN532
    if (!p)
       return -PN532_ERR_NULL;
@@ -389,83 +983,18 @@ int pn532_tx(pn532_t *p, uint8_t cmd, int len1, uint8_t *data1, int len2, uint8_
 }
 
 int pn532_rx_mutex(pn532_t *p, int max1, uint8_t *data1, int max2, uint8_t *data2, int ms)
-{ // Recv data from PN532
-   uint8_t pending = p->pending;
+{ // Recv data from PN532, the command staged by pn532_tx goes out now with the caller's buffers to land the response in
+   pn532_cmd_t *c = &p->sync;
    p->pending = 0;
-   int l = uart_preamble(p, ms);
-   if (l < 2)
-      return -(p->lasterr = PN532_ERR_TIMEOUT);
-   uint8_t buf[9];
-   l = uart_rx(p, buf, 4, 10);
-   if (l < 4)
-      return -(p->lasterr = PN532_ERR_TIMEOUT);
-   int len = 0;
-   if (buf[0] == 0xFF && buf[1] == 0xFF)
-   { // Extended
-      l = uart_rx(p, buf + 4, 3, 10);
-      if (l < 3)
-         return -(p->lasterr = PN532_ERR_TIMEOUT);
-      if ((uint8_t)(buf[2] + buf[3] + buf[4]))
-         return -(p->lasterr = PN532_ERR_HEADER); // Bad checksum
-      len = (buf[2] << 8) + buf[3];
-      if (buf[5] != 0xD5)
-         return -(p->lasterr = PN532_ERR_HEADER); // Not reply
-      if (buf[6] != pending)
-         return -(p->lasterr = PN532_ERR_CMDMISMATCH); // Not right reply
-   }
-   else
-   { // Normal
-      if ((uint8_t)(buf[0] + buf[1]))
-         return -(p->lasterr = PN532_ERR_HEADER); // Bad checksum
-      len = buf[0];
-      if (buf[2] != 0xD5)
-         return -(p->lasterr = PN532_ERR_HEADER); // Not reply
-      if (buf[3] != pending)
-         return -(p->lasterr = PN532_ERR_CMDMISMATCH); // Not right reply
-   }
-   if (len < 2)
-      return -(p->lasterr = PN532_ERR_HEADER); // Invalid
-   len -= 2;
-   int res = len;
-   uint8_t sum = 0xD5 + pending;
-   if (len > max1 + max2)
-      return -(p->lasterr = PN532_ERR_SPACE); // Too big
-   if (data1)
-   {
-      l = max1;
-      if (l > len)
-         l = len;
-      if (l)
-      {
-         if (uart_rx(p, data1, l, 10) < l)
-            return -(p->lasterr = PN532_ERR_TIMEOUT); // Bad read
-         len -= l;
-         while (l)
-            sum += data1[--l];
-      }
-   }
-   if (data2)
-   {
-      l = max2;
-      if (l > len)
-         l = len;
-      if (l)
-      {
-         if (uart_rx(p, data2, l, 10) < l)
-            return -(p->lasterr = PN532_ERR_TIMEOUT); // Bad read
-         len -= l;
-         while (l)
-            sum += data2[--l];
-      }
-   }
-   l = uart_rx(p, buf, 2, 10);
-   if (l < 2)
-      return -(p->lasterr = PN532_ERR_TIMEOUT); // Postamble
-   if ((uint8_t)(buf[0] + sum))
-      return -(p->lasterr = PN532_ERR_CHECKSUM); // checksum
-   if (buf[1])
-      return -(p->lasterr = PN532_ERR_POSTAMBLE); // postamble
-   return res;
+   c->max1 = data1 ? max1 : 0;
+   c->rx1 = data1;
+   c->max2 = data2 ? max2 : 0;
+   c->rx2 = data2;
+   c->timeout = ms > 0 ? ms : 1; // 0 would leave it open ended
+   int l = pn532_submit(p, c);
+   if (l >= 0)
+      l = sync_wait(p, portMAX_DELAY); // The driver times it out
+   return l;
 }
 
 int pn532_rx(pn532_t *p, int max1, uint8_t *data1, int max2, uint8_t *data2, int ms)
@@ -475,6 +1004,7 @@ int pn532_rx(pn532_t *p, int max1, uint8_t *data1, int max2, uint8_t *data2, int
    if (!p->pending)
       return -(p->lasterr = PN532_ERR_NOTPENDING);
    int l = pn532_rx_mutex(p, max1, data1, max2, data2, ms);
+   link_check(p);
    xSemaphoreGive(p->mutex);
    return l;
 }
@@ -485,10 +1015,50 @@ int pn532_ready(pn532_t *p)
       return -PN532_ERR_NULL;
    if (!p->pending)
       return -(p->lasterr = PN532_ERR_NOTPENDING); // Nothing pending
-   size_t length;
-   if (uart_get_buffered_data_len(p->uart, &length))
-      return -(p->lasterr = 2); // Error
-   return length;
+   return 1; // pn532_rx runs the exchange
+}
+
+static int exchange(pn532_t *p, uint8_t cmd, int len1, uint8_t *data1, int len2, uint8_t *data2, int max1, uint8_t *rx1, int max2, uint8_t *rx2, int ms)
+{ // Blocking round trip, the caller's buffers go to the driver as they are and the response lands straight in them
+   xSemaphoreTake(p->mutex, portMAX_DELAY);
+   int l = exchange_mutex(p, cmd, len1, data1, len2, data2, max1, rx1, max2, rx2, ms);
+   link_check(p);
+   xSemaphoreGive(p->mutex);
+   return l;
+}
+
+uint32_t pn532_baud(pn532_t *p)
+{
+   if (!p)
+      return 0;
+   return p->baud;
+}
+
+uint64_t pn532_asleep_us(pn532_t *p, uint32_t *wakes)
+{
+   if (!p)
+      return 0;
+   if (wakes)
+      *wakes = p->wakes;
+   uint64_t us = p->asleep_us;
+   if (p->asleep)
+      us += esp_timer_get_time() - p->slept;
+   return us;
+}
+
+int pn532_link(pn532_t *p, pn532_link_t *link, int max)
+{
+   if (!p)
+      return -PN532_ERR_NULL;
+   int n = 0;
+   for (int br = 0; br < BR_COUNT && n < max; br++)
+   {
+      if (!p->link[br].count && !p->link[br].errors && !p->link[br].tx_bytes && br != p->br)
+         continue;
+      link[n] = p->link[br];
+      link[n++].baud = pn532_bauds[br];
+   }
+   return n;
 }
 
 // Data exchange (for DESFire use)
@@ -504,11 +1074,10 @@ int pn532_dx(void *pv, unsigned int len, uint8_t *data, unsigned int max, const
 #ifdef CONFIG_PN532_DEBUG_DX
    ESP_LOG_BUFFER_HEX_LEVEL("NFCTx", data, len, HEXLOG);
 #endif
-   int l = pn532_tx(p, 0x40, 1, &p->tg, len, data);
+   uint8_t status;
+   int l = exchange(p, 0x40, 1, &p->tg, len, data, 1, &status, max, data, 500);
    if (l >= 0)
    {
-      uint8_t status;
-      l = pn532_rx(p, 1, &status, max, data, 500);
       if (!l)
          l = -PN532_ERR_SHORT;
       else if (l >= 1 && status)
@@ -537,12 +1106,12 @@ int pn532_ILPT_Send(pn532_t *p)
 {
    if (!p)
       return -PN532_ERR_NULL;
-   uint8_t buf[3];
-   // InListPassiveTarget
-   // buf[0] = 2; // 2 tags (we only report 1)
-   buf[0] = 1; // 1 tag
-   buf[1] = 0; // 106 kbps type A (ISO/IEC14443 Type A)
-   int l = pn532_tx(p, 0x4A, 2, buf, 0, NULL);
+   // InListPassiveTarget, static as it goes out later with pn532_rx
+   static const uint8_t buf[] = {
+       1, // 1 tag (we only report 1)
+       0, // 106 kbps type A (ISO/IEC14443 Type A)
+   };
+   int l = pn532_tx(p, 0x4A, sizeof(buf), buf, 0, NULL);
    if (l < 0)
       return l;
    return 0; // Waiting
@@ -571,6 +1140,38 @@ int pn532_Present(pn532_t *p)
    return pn532_Cards(p); // Look for card - older MIFARE need re-doing to see if present still
 }
 
+int pn532_PowerDown(pn532_t *p, uint8_t wake)
+{ // Field off and the PN532 in soft power down, the driver wakes it over the HSU before the next command
+   if (!p)
+      return -PN532_ERR_NULL;
+   uint8_t buf[1];
+   uint8_t status;
+   buf[0] = wake | PN532_WAKE_HSU; // Our only way back in without the IRQ line
+   xSemaphoreTake(p->mutex, portMAX_DELAY);
+   pn532_cmd_t *c = sync_cmd(p, 0x16, 1, buf, 0, NULL, 0, NULL, 1, &status, 50);
+   c->cb = sleep_cb;
+   int l = pn532_submit(p, c);
+   if (l >= 0)
+      l = sync_wait(p, portMAX_DELAY);
+   link_check(p);
+   xSemaphoreGive(p->mutex);
+   if (l < 0)
+      return l;
+   if (l < 1)
+      return -(p->lasterr = PN532_ERR_SHORT);
+   if (status)
+      return -(p->lasterr = PN532_ERR_STATUS + (status & 0x3F));
+   return 0;
+}
+
+int pn532_RFConfiguration(pn532_t *p, uint8_t item, int len, uint8_t *data)
+{ // Config item and its data as in the user manual, e.g. 0x05 MaxRetries
+   if (!p)
+      return -PN532_ERR_NULL;
+   int l = exchange(p, 0x32, 1, &item, len, data, 0, NULL, 0, NULL, 50);
+   return l < 0 ? l : 0;
+}
+
 int pn532_deselect(pn532_t *p, uint8_t n)
 { // Send a release
    if (!p)
@@ -623,6 +1224,48 @@ int pn532_read_GPIO(pn532_t *p)
    return (buf[0] & 0x3F) | ((buf[1] & 0x06) << 5);
 }
 
+static int target_data(pn532_t *p, uint8_t *b, uint8_t *e)
+{ // Details of the first card, 106 kbps type A target data as in InListPassiveTarget and InAutoPoll
+   if (b + 5 > e)
+      return -(p->lasterr = PN532_ERR_SPACE); // No card data
+   p->tg = *b++;
+   p->sens_res = (b[0] << 8) + b[1];
+   b += 2;
+   p->sel_res = *b++;
+   if (b + *b + 1 > e)
+      return -(p->lasterr = PN532_ERR_SHORT); // Too short
+   if (*b < sizeof(p->nfcid))
+      memcpy(p->nfcid, b, *b + 1); // OK
+   else
+      memset(p->nfcid, 0, sizeof(p->nfcid)); // Too big
+   b += *b + 1;
+   if (b < e)
+   { // ATS
+      if (!*b || b + *b > e)
+         return -(p->lasterr = PN532_ERR_SHORT); // Zero or missing ATS
+      if (*b <= sizeof(p->ats))
+      {
+         memcpy(p->ats, b, *b); // OK
+         (*p->ats)--;           // Make len of what follows for consistency
+      }
+   }
+   return 0;
+}
+
+static int list_data(pn532_t *p, uint8_t *b, int l)
+{ // InListPassiveTarget response, -ve for error, else number of cards
+   memset(p->nfcid, 0, sizeof(p->nfcid));
+   memset(p->ats, 0, sizeof(p->ats));
+   // Extract first card ID
+   uint8_t *e = b + l; // end
+   if (b >= e)
+      return -(p->lasterr = PN532_ERR_SHORT); // No card count
+   p->cards = *b++;
+   if (p->cards && (l = target_data(p, b, e)) < 0)
+      return l;
+   return p->cards;
+}
+
 int pn532_Cards(pn532_t *p)
 { // -ve for error, else number of cards
    if (!p)
@@ -639,43 +1282,7 @@ int pn532_Cards(pn532_t *p)
    int l = pn532_rx(p, 0, NULL, sizeof(buf), buf, 110);
    if (l < 0)
       return l;
-   memset(p->nfcid, 0, sizeof(p->nfcid));
-   memset(p->ats, 0, sizeof(p->ats));
-   // Extract first card ID
-   uint8_t *b = buf,
-           *e = buf + l; // end
-   if (b >= e)
-      return -(p->lasterr = PN532_ERR_SHORT); // No card count
-   p->cards = *b++;
-   if (p->cards)
-   { // Get details of first card
-
-      if (b + 5 > e)
-         return -(p->lasterr = PN532_ERR_SPACE); // No card data
-      p->tg = *b++;
-      p->sens_res = (b[0] << 8) + b[1];
-      b += 2;
-      p->sel_res = *b++;
-      if (b + *b + 1 > e)
-         return -(p->lasterr = PN532_ERR_SHORT); // Too short
-      if (*b < sizeof(p->nfcid))
-         memcpy(p->nfcid, b, *b + 1); // OK
-      else
-         memset(p->nfcid, 0, sizeof(p->nfcid)); // Too big
-      b += *b + 1;
-      if (b < e)
-      { // ATS
-         if (!*b || b + *b > e)
-            return -(p->lasterr = PN532_ERR_SHORT); // Zero or missing ATS
-         if (*b <= sizeof(p->ats))
-         {
-            memcpy(p->ats, b, *b); // OK
-            (*p->ats)--;           // Make len of what follows for consistency
-         }
-         b += *b; // ready for second target (which we are not looking at)
-      }
-   }
-   return p->cards;
+   return list_data(p, buf, l);
 }
 
 int pn532_Cards_and_return_data(pn532_t *p, uint8_t *uid, uint8_t *uidLength)
@@ -692,47 +1299,102 @@ int pn532_Cards_and_return_data(pn532_t *p, uint8_t *uid, uint8_t *uidLength)
    if (p->pending != 0x4B)
       return -(p->lasterr = PN532_ERR_CMDMISMATCH); // We expect to be waiting for InListPassiveTarget response
    int l = pn532_rx(p, 0, NULL, sizeof(buf), buf, 110);
+   if (l < 0)
+      return l;
+   if ((l = list_data(p, buf, l)) < 0)
+      return l;
+   if (p->cards)
+   {
+      *uidLength = p->nfcid[0];
+      memcpy(uid, p->nfcid + 1, p->nfcid[0]);
+   }
+   return p->cards;
+}
+
+// Submitted on the caller's command without the mutex, other commands go ahead of or in between them as they come
+int pn532_InAutoPoll_Submit(pn532_t *p, pn532_cmd_t *c, uint8_t period)
+{ // Period in 150ms units
+   if (!p)
+      return -PN532_ERR_NULL;
+   c->tx[0] = 0xFF;   // Poll until a card turns up
+   c->tx[1] = period; // Between polls
+   c->tx[2] = 0x10;   // 106 kbps type A (Mifare, ISO/IEC14443-4 and DESFire)
+   c->cmd = 0x60;
+   c->len1 = 3;
+   c->data1 = c->tx;
+   c->len2 = 0;
+   c->max1 = 0;
+   c->timeout = 0; // Any other command submitted stops it
+   c->cb = NULL;
+   return pn532_submit(p, c);
+}
+
+int pn532_InAutoPoll_Result(pn532_t *p, pn532_cmd_t *c, uint8_t *uid, uint8_t *uidLength)
+{ // As pn532_Cards_and_return_data
+   if (!p)
+      return -PN532_ERR_NULL;
+   int l = c->result;
+   link_recheck(p);
    if (l < 0)
       return l;
    memset(p->nfcid, 0, sizeof(p->nfcid));
    memset(p->ats, 0, sizeof(p->ats));
-   // Extract first card ID
-   uint8_t *b = buf,
-           *e = buf + l; // end
+   uint8_t *b = c->rx2,
+           *e = c->rx2 + l; // end
    if (b >= e)
       return -(p->lasterr = PN532_ERR_SHORT); // No card count
    p->cards = *b++;
-   if (p->cards)
-   { // Get details of first card
-      *uidLength = buf[5];
-      for (uint8_t i = 0; i < buf[5]; i++)
-      {
-         uid[i] = buf[6 + i];
-      }
-      if (b + 5 > e)
-         return -(p->lasterr = PN532_ERR_SPACE); // No card data
-      p->tg = *b++;
-      p->sens_res = (b[0] << 8) + b[1];
-      b += 2;
-      p->sel_res = *b++;
-      if (b + *b + 1 > e)
-         return -(p->lasterr = PN532_ERR_SHORT); // Too short
-      if (*b < sizeof(p->nfcid))
-         memcpy(p->nfcid, b, *b + 1); // OK
-      else
-         memset(p->nfcid, 0, sizeof(p->nfcid)); // Too big
-      b += *b + 1;
-      if (b < e)
-      { // ATS
-         if (!*b || b + *b > e)
-            return -(p->lasterr = PN532_ERR_SHORT); // Zero or missing ATS
-         if (*b <= sizeof(p->ats))
-         {
-            memcpy(p->ats, b, *b); // OK
-            (*p->ats)--;           // Make len of what follows for consistency
-         }
-         b += *b; // ready for second target (which we are not looking at)
-      }
+   if (!p->cards)
+      return -(p->lasterr = PN532_ERR_SHORT); // Polling ended with nothing found
+   if (b + 2 > e || b + 2 + b[1] > e)
+      return -(p->lasterr = PN532_ERR_SHORT); // No type and length
+   e = b + 2 + b[1];                         // First target only
+   b += 2;
+   if ((l = target_data(p, b, e)) < 0)
+      return l;
+   *uidLength = p->nfcid[0];
+   memcpy(uid, p->nfcid + 1, p->nfcid[0]);
+   return p->cards;
+}
+
+int pn532_Present_Submit(pn532_t *p, pn532_cmd_t *c)
+{ // Card presence detection for a DESFire we have, InListPassiveTarget for anything else
+   if (!p)
+      return -PN532_ERR_NULL;
+   if (p->cards && *p->ats && p->ats[1] == 0x75) // DESFire
+   {                                            // Diagnose
+      c->cmd = 0x00;
+      c->tx[0] = 6; // Test 6 Attention Request Test or ISO/IEC14443-4 card presence detection
+      c->len1 = 1;
+   }
+   else
+   { // InListPassiveTarget
+      c->cmd = 0x4A;
+      c->tx[0] = 1; // 1 tag
+      c->tx[1] = 0; // 106 kbps type A (ISO/IEC14443 Type A)
+      c->len1 = 2;
    }
+   c->data1 = c->tx;
+   c->len2 = 0;
+   c->max1 = 0;
+   c->timeout = 110;
+   c->cb = NULL;
+   return pn532_submit(p, c);
+}
+
+int pn532_Present_Result(pn532_t *p, pn532_cmd_t *c)
+{ // As pn532_Cards, a DESFire that failed its presence check counts as gone and the next check lists the field again
+   if (!p)
+      return -PN532_ERR_NULL;
+   int l = c->result;
+   link_recheck(p);
+   if (l < 0)
+      return l;
+   if (c->cmd == 0x4A)
+      return list_data(p, c->rx2, l);
+   if (l < 1)
+      return -(p->lasterr = PN532_ERR_SHORT);
+   if (*c->rx2)
+      p->cards = 0; // Gone
    return p->cards;
 }
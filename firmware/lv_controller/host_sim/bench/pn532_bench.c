@@ -0,0 +1,233 @@
+// Microbenchmark of the PN532 response path: ACK and response frames fed through the driver's UART event
+// handler exactly as the driver task sees them, against the UART mock only. Wall clock, no virtual time.
+//
+//   ./pn532_bench [frames] [old]
+//
+// pn532.c is built into this file so the static parser can be driven without a reader on the other end. With old,
+// the same streams go through the byte-at-a-time reader the driver had before its task, for a before and after.
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "pn532.c"
+#include "sim_hw.h"
+
+#define BENCH_UART 0
+
+struct bench_case
+{
+    const char *name;
+    int data_len; // Response data after the response code
+    int chunk;    // Bytes per UART_DATA event, 0 for the whole exchange in one
+};
+
+static const struct bench_case cases[] = {
+    {"ILPT 7 byte UID, one event", 13, 0},
+    {"ILPT 7 byte UID, 6 B events", 13, 6},
+    {"DESFire 64 B, one event", 65, 0},
+    {"DESFire 64 B, 16 B events", 65, 16},
+    {"DESFire 250 B, one event", 251, 0},
+    {"DESFire 250 B, 120 B events", 251, 120},
+};
+
+static int bench_frames = 200000;
+static bool bench_old;
+
+static int build(uint8_t *f, uint8_t cmd, int len)
+{ // ACK then the response, as the PN532 sends them
+    static const uint8_t ack[] = {0x00, 0x00, 0xFF, 0x00, 0xFF, 0x00};
+    int n = 0;
+    memcpy(f, ack, sizeof(ack));
+    n += sizeof(ack);
+    f[n++] = 0x00;
+    f[n++] = 0x00;
+    f[n++] = 0xFF;
+    f[n++] = len + 2;
+    f[n++] = -(len + 2);
+    f[n++] = 0xD5;
+    f[n++] = cmd + 1;
+    uint8_t sum = 0xD5 + cmd + 1;
+    for (int i = 0; i < len; i++)
+    {
+        f[n] = i;
+        sum += f[n++];
+    }
+    f[n++] = -sum;
+    f[n++] = 0x00;
+    return n;
+}
+
+static double now_s(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// Reader from before the driver task, blocking uart_rx calls as pn532_tx_mutex and pn532_rx_mutex made them
+static int old_preamble(pn532_t *p, int ms)
+{ // Wait for preamble
+    uint8_t last = 0xFF;
+    while (1)
+    {
+        uint8_t c;
+        int l = uart_rx(p, &c, 1, ms);
+        if (l < 1)
+            return l;
+        if (last == 0x00 && c == 0xFF)
+            return 2;
+        last = c;
+    }
+}
+
+static int old_rx_frame(pn532_t *p, uint8_t pending, int max1, uint8_t *data1, int max2, uint8_t *data2)
+{ // Rest of a response frame, after the preamble
+    uint8_t buf[9];
+    int l = uart_rx(p, buf, 4, 10);
+    if (l < 4)
+        return -PN532_ERR_TIMEOUT;
+    int len = 0;
+    if (buf[0] == 0xFF && buf[1] == 0xFF)
+    { // Extended
+        l = uart_rx(p, buf + 4, 3, 10);
+        if (l < 3)
+            return -PN532_ERR_TIMEOUT;
+        if ((uint8_t)(buf[2] + buf[3] + buf[4]))
+            return -PN532_ERR_HEADER; // Bad checksum
+        len = (buf[2] << 8) + buf[3];
+        if (buf[5] != 0xD5)
+            return -PN532_ERR_HEADER; // Not reply
+        if (buf[6] != pending)
+            return -PN532_ERR_CMDMISMATCH; // Not right reply
+    }
+    else
+    { // Normal
+        if ((uint8_t)(buf[0] + buf[1]))
+            return -PN532_ERR_HEADER; // Bad checksum
+        len = buf[0];
+        if (buf[2] != 0xD5)
+            return -PN532_ERR_HEADER; // Not reply
+        if (buf[3] != pending)
+            return -PN532_ERR_CMDMISMATCH; // Not right reply
+    }
+    if (len < 2)
+        return -PN532_ERR_HEADER; // Invalid
+    len -= 2;
+    int res = len;
+    uint8_t sum = 0xD5 + pending;
+    if (len > max1 + max2)
+        return -PN532_ERR_SPACE; // Too big
+    if (data1)
+    {
+        l = max1;
+        if (l > len)
+            l = len;
+        if (l)
+        {
+            if (uart_rx(p, data1, l, 10) < l)
+                return -PN532_ERR_TIMEOUT; // Bad read
+            len -= l;
+            while (l)
+                sum += data1[--l];
+        }
+    }
+    if (data2)
+    {
+        l = max2;
+        if (l > len)
+            l = len;
+        if (l)
+        {
+            if (uart_rx(p, data2, l, 10) < l)
+                return -PN532_ERR_TIMEOUT; // Bad read
+            len -= l;
+            while (l)
+                sum += data2[--l];
+        }
+    }
+    l = uart_rx(p, buf, 2, 10);
+    if (l < 2)
+        return -PN532_ERR_TIMEOUT; // Postamble
+    if ((uint8_t)(buf[0] + sum))
+        return -PN532_ERR_CHECKSUM; // checksum
+    if (buf[1])
+        return -PN532_ERR_POSTAMBLE; // postamble
+    return res;
+}
+
+static int old_read(pn532_t *p, uint8_t cmd, int max, uint8_t *rx)
+{ // ACK, then the response
+    uint8_t ack[3];
+    if (old_preamble(p, 10) < 2 || uart_rx(p, ack, 3, 10) < 3)
+        return -PN532_ERR_TIMEOUTACK;
+    if (ack[0] || ack[1] != 0xFF || ack[2])
+        return -PN532_ERR_BADACK;
+    if (old_preamble(p, 10) < 2)
+        return -PN532_ERR_TIMEOUT;
+    return old_rx_frame(p, cmd + 1, 0, NULL, max, rx);
+}
+
+static void run(pn532_t *p, const struct bench_case *bc)
+{
+    uint8_t stream[300];
+    uint8_t rx[300];
+    int n = build(stream, 0x40, bc->data_len);
+    int chunk = bc->chunk ? bc->chunk : n;
+    pn532_cmd_t c = {.cmd = 0x40, .max2 = sizeof(rx), .rx2 = rx};
+    double start = now_s();
+    for (int i = 0; i < bench_frames; i++)
+    {
+        if (bench_old)
+        { // The UART holds whatever has arrived, the reader blocks on it a few bytes at a time
+            for (int off = 0; off < n; off += chunk)
+                sim_uart_reply(BENCH_UART, stream + off, n - off < chunk ? n - off : chunk, 0);
+            c.result = old_read(p, 0x40, sizeof(rx), rx);
+            if (c.result != bc->data_len || rx[bc->data_len - 1] != (uint8_t)(bc->data_len - 1))
+            {
+                printf("%s: frame %d not read (%d)\n", bc->name, i, c.result);
+                exit(1);
+            }
+            continue;
+        }
+        c.busy = 1;
+        p->cur = &c;
+        p->acked = 0;
+        p->timed = 0;
+        for (int off = 0; off < n; off += chunk)
+        {
+            int l = n - off < chunk ? n - off : chunk;
+            sim_uart_reply(BENCH_UART, stream + off, l, 0);
+            uart_event_t event = {.type = UART_DATA, .size = l};
+            uart_event(p, &event);
+        }
+        if (c.busy || c.result != bc->data_len || rx[bc->data_len - 1] != (uint8_t)(bc->data_len - 1))
+        {
+            printf("%s: frame %d not delivered (%d)\n", bc->name, i, c.result);
+            exit(1);
+        }
+    }
+    double s = now_s() - start;
+    printf("%-32s %12.0f %10.0f\n", bc->name, bench_frames / s, s * 1e9 / bench_frames);
+}
+
+static void bench_task(void *params)
+{
+    pn532_t *p = calloc(1, sizeof(*p));
+    p->uart = BENCH_UART;
+    p->baud = 115200;
+    uart_driver_install(BENCH_UART, RX_BUF, TX_BUF, 0, NULL, 0);
+    printf("%s reader\n%-32s %12s %10s\n", bench_old ? "Byte-at-a-time" : "Incremental", "case", "frames/s", "ns/frame");
+    for (int i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+        run(p, &cases[i]);
+    exit(0);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1)
+        bench_frames = atoi(argv[1]);
+    bench_old = argc > 2 && !strcmp(argv[2], "old");
+    xTaskCreate(bench_task, "bench", 8192, NULL, 1, NULL);
+    vTaskStartScheduler();
+    return 0;
+}
@@ -0,0 +1,18 @@
+#ifndef SIM_DRIVER_RMT_ENCODER_H
+#define SIM_DRIVER_RMT_ENCODER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+typedef struct rmt_encoder_t *rmt_encoder_handle_t;
+
+typedef struct
+{
+    int unused;
+} rmt_copy_encoder_config_t;
+
+esp_err_t rmt_del_encoder(rmt_encoder_handle_t encoder);
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef ESP_INTR_ALLOC_H
+#define ESP_INTR_ALLOC_H
+
+#include "esp_bit_defs.h"
+
+#define ESP_INTR_FLAG_IRAM BIT(10)
+
+#endif
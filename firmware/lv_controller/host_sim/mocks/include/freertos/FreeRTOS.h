@@ -0,0 +1,25 @@
+#ifndef SIM_FREERTOS_FREERTOS_H
+#define SIM_FREERTOS_FREERTOS_H
+
+// ESP-IDF keeps the kernel headers under freertos/, the POSIX port build does not
+#include <FreeRTOS.h>
+
+#include "esp_bit_defs.h"
+
+// ESP-IDF spinlocks, a plain critical section on the single core POSIX port
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portMUX_INITIALIZE(mux) (*(mux) = portMUX_INITIALIZER_UNLOCKED)
+#undef portENTER_CRITICAL
+#undef portEXIT_CRITICAL
+// Variadic so the kernel's argument-less use still expands, the mux is referenced so static locks count as used
+#define portENTER_CRITICAL(...) ((void)(__VA_ARGS__ + 0), vPortEnterCritical())
+#define portEXIT_CRITICAL(...) ((void)(__VA_ARGS__ + 0), vPortExitCritical())
+#define portENTER_CRITICAL_ISR(mux) vPortEnterCritical()
+#define portEXIT_CRITICAL_ISR(mux) vPortExitCritical()
+
+// One tick is one virtual millisecond, whatever rate the port really ticks at (see FreeRTOSConfig.h)
+#undef portTICK_PERIOD_MS
+#define portTICK_PERIOD_MS ((TickType_t)1)
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef SIM_HAL_GPIO_LL_H
+#define SIM_HAL_GPIO_LL_H
+
+#include <stdint.h>
+
+#include "soc/gpio_struct.h"
+#include "driver/gpio.h"
+
+static inline int gpio_ll_get_level(gpio_dev_t *hw, uint32_t gpio_num)
+{
+    return gpio_get_level((gpio_num_t)gpio_num);
+}
+
+static inline void gpio_ll_set_level(gpio_dev_t *hw, uint32_t gpio_num, uint32_t level)
+{
+    gpio_set_level((gpio_num_t)gpio_num, level);
+}
+
+#endif
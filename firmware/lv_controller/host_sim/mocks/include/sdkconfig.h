@@ -0,0 +1,10 @@
+#ifndef SDKCONFIG_H
+#define SDKCONFIG_H
+
+// Host simulation, menuconfig defaults for what the firmware uses
+#define CONFIG_IDF_TARGET "linux"
+#define CONFIG_FREERTOS_HZ 1000
+#define CONFIG_PN532_TASK_PRIORITY 11
+#define CONFIG_PN532_BAUD 921600
+
+#endif
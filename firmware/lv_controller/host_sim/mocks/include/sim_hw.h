@@ -0,0 +1,23 @@
+#ifndef SIM_HW_H
+#define SIM_HW_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Simulator side of the mocked peripherals, used by the plant model and the PN532 emulator
+
+// Drive an input pin, runs the pin's ISR on a matching edge like the real GPIO matrix would
+void sim_gpio_drive_input(int gpio_num, int level);
+int sim_gpio_level(int gpio_num);
+
+// Current LEDC duty as a fraction of full scale, including any fade in progress
+float sim_ledc_duty(int channel);
+
+// Bytes the firmware wrote to a UART are handed to the device model on that port
+typedef void (*sim_uart_device_t)(int uart_num, const uint8_t *data, size_t len);
+void sim_uart_attach(int uart_num, sim_uart_device_t device);
+// Device replies, readable by the firmware once delay_ms of virtual time has passed
+void sim_uart_reply(int uart_num, const uint8_t *data, size_t len, int delay_ms);
+uint32_t sim_uart_baudrate(int uart_num);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef SIM_SOC_GPIO_STRUCT_H
+#define SIM_SOC_GPIO_STRUCT_H
+
+#include <stdint.h>
+
+typedef union
+{
+    struct
+    {
+        uint32_t data : 22;
+        uint32_t reserved22 : 10;
+    };
+    uint32_t val;
+} gpio_out1_reg_t;
+
+// Output registers only, the GPIO mock applies direct register writes to the pin levels the plant reads
+typedef struct
+{
+    volatile uint32_t out;         // GPIO 0-31
+    volatile uint32_t out_w1ts;    // Write 1 to set
+    volatile uint32_t out_w1tc;    // Write 1 to clear
+    volatile gpio_out1_reg_t out1; // GPIO 32 and up
+    volatile gpio_out1_reg_t out1_w1ts;
+    volatile gpio_out1_reg_t out1_w1tc;
+} gpio_dev_t;
+
+// Each task gets its own register image, every access applies the writes left in it by the task's last one
+gpio_dev_t *sim_gpio_regs(void);
+#define GPIO (*sim_gpio_regs())
+
+#endif
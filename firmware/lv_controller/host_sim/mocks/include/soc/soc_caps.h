@@ -0,0 +1,6 @@
+#ifndef SIM_SOC_CAPS_H
+#define SIM_SOC_CAPS_H
+
+// Host simulation, no GPIO glitch filter, switch bounce is left to the software debounce
+
+#endif
@@ -0,0 +1,92 @@
+#include <stdlib.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/timers.h"
+#include "esp_timer.h"
+
+struct esp_timer
+{
+    TimerHandle_t timer;
+    esp_timer_cb_t callback;
+    void *arg;
+};
+
+static void timer_trampoline(TimerHandle_t t)
+{ // Runs on the FreeRTOS timer task, which stands in for the esp_timer task
+    struct esp_timer *et = pvTimerGetTimerID(t);
+    et->callback(et->arg);
+}
+
+static TickType_t us_to_ticks(uint64_t us)
+{
+    TickType_t ticks = (us + 999) / 1000;
+    return ticks ? ticks : 1;
+}
+
+int64_t esp_timer_get_time(void)
+{
+    return (int64_t)xTaskGetTickCount() * 1000;
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args, esp_timer_handle_t *out_handle)
+{
+    struct esp_timer *et = calloc(1, sizeof(*et));
+    if (!et)
+        return ESP_ERR_NO_MEM;
+    et->callback = create_args->callback;
+    et->arg = create_args->arg;
+    et->timer = xTimerCreate(create_args->name ? create_args->name : "esp_timer", 1, pdFALSE, et, timer_trampoline);
+    if (!et->timer)
+    {
+        free(et);
+        return ESP_ERR_NO_MEM;
+    }
+    *out_handle = et;
+    return ESP_OK;
+}
+
+static esp_err_t start(esp_timer_handle_t timer, uint64_t us, UBaseType_t reload)
+{
+    if (!timer)
+        return ESP_ERR_INVALID_ARG;
+    if (xTimerIsTimerActive(timer->timer))
+        return ESP_ERR_INVALID_STATE;
+    vTimerSetReloadMode(timer->timer, reload);
+    // Changing the period also starts the timer
+    return xTimerChangePeriod(timer->timer, us_to_ticks(us), portMAX_DELAY) == pdPASS ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    return start(timer, timeout_us, pdFALSE);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period)
+{
+    return start(timer, period, pdTRUE);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    if (!timer)
+        return ESP_ERR_INVALID_ARG;
+    if (!xTimerIsTimerActive(timer->timer))
+        return ESP_ERR_INVALID_STATE;
+    xTimerStop(timer->timer, portMAX_DELAY);
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer)
+{
+    if (!timer)
+        return ESP_ERR_INVALID_ARG;
+    xTimerDelete(timer->timer, portMAX_DELAY);
+    free(timer);
+    return ESP_OK;
+}
+
+bool esp_timer_is_active(esp_timer_handle_t timer)
+{
+    return timer && xTimerIsTimerActive(timer->timer);
+}
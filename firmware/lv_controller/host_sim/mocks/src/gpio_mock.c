@@ -0,0 +1,225 @@
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "freertos/FreeRTOS.h"
+#include "driver/gpio.h"
+#include "soc/gpio_struct.h"
+#include "sim_hw.h"
+
+static struct
+{
+    int level;
+    gpio_mode_t mode;
+    gpio_int_type_t intr_type;
+    bool intr_enabled;
+    gpio_isr_t isr;
+    void *isr_arg;
+} pins[SIM_GPIO_COUNT];
+
+#define CHECK_PIN(n)                           \
+    do                                         \
+    {                                          \
+        if ((n) < 0 || (n) >= SIM_GPIO_COUNT)  \
+            return ESP_ERR_INVALID_ARG;        \
+    } while (0)
+
+#define SIM_GPIO_IMAGES 32
+
+static uint32_t out_banks[2]; // Output levels, GPIO 0-31 and 32 and up
+static gpio_dev_t images[SIM_GPIO_IMAGES];
+static int num_images;
+static __thread gpio_dev_t *task_image;
+static portMUX_TYPE gpio_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void apply_writes(void)
+{ // An image only holds its task's last register write, every earlier one was applied by the access after it. Caller holds gpio_lock
+    for (int i = 0; i < num_images; i++)
+    {
+        gpio_dev_t *r = &images[i];
+        out_banks[0] = (out_banks[0] & ~r->out_w1tc) | r->out_w1ts;
+        out_banks[1] = (out_banks[1] & ~r->out1_w1tc.val) | r->out1_w1ts.val;
+        r->out_w1ts = r->out_w1tc = 0;
+        r->out1_w1ts.val = r->out1_w1tc.val = 0;
+    }
+}
+
+gpio_dev_t *sim_gpio_regs(void)
+{
+    portENTER_CRITICAL(&gpio_lock);
+    if (!task_image)
+    {
+        if (num_images == SIM_GPIO_IMAGES)
+            abort();
+        task_image = &images[num_images++];
+    }
+    apply_writes();
+    task_image->out = out_banks[0];
+    task_image->out1.val = out_banks[1];
+    portEXIT_CRITICAL(&gpio_lock);
+    return task_image;
+}
+
+static uint32_t *out_reg(int gpio_num)
+{ // Caller holds gpio_lock
+    apply_writes();
+    return &out_banks[gpio_num < 32 ? 0 : 1];
+}
+
+static bool is_output(int gpio_num)
+{
+    return pins[gpio_num].mode & GPIO_MODE_OUTPUT;
+}
+
+esp_err_t gpio_config(const gpio_config_t *cfg)
+{
+    for (int i = 0; i < SIM_GPIO_COUNT; i++)
+    {
+        if (!(cfg->pin_bit_mask & BIT64(i)))
+            continue;
+        pins[i].mode = cfg->mode;
+        pins[i].intr_type = cfg->intr_type;
+        pins[i].intr_enabled = cfg->intr_type != GPIO_INTR_DISABLE;
+        if (cfg->pull_up_en)
+            pins[i].level = 1;
+    }
+    return ESP_OK;
+}
+
+esp_err_t gpio_reset_pin(gpio_num_t gpio_num)
+{
+    CHECK_PIN(gpio_num);
+    pins[gpio_num].mode = GPIO_MODE_DISABLE;
+    pins[gpio_num].intr_type = GPIO_INTR_DISABLE;
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_direction(gpio_num_t gpio_num, gpio_mode_t mode)
+{
+    CHECK_PIN(gpio_num);
+    pins[gpio_num].mode = mode;
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level)
+{
+    CHECK_PIN(gpio_num);
+    portENTER_CRITICAL(&gpio_lock);
+    if (level)
+        *out_reg(gpio_num) |= BIT(gpio_num % 32);
+    else
+        *out_reg(gpio_num) &= ~BIT(gpio_num % 32);
+    portEXIT_CRITICAL(&gpio_lock);
+    return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t gpio_num)
+{
+    if (gpio_num < 0 || gpio_num >= SIM_GPIO_COUNT)
+        return 0;
+    if (is_output(gpio_num))
+    {
+        portENTER_CRITICAL(&gpio_lock);
+        int level = (*out_reg(gpio_num) >> (gpio_num % 32)) & 1;
+        portEXIT_CRITICAL(&gpio_lock);
+        return level;
+    }
+    return pins[gpio_num].level;
+}
+
+esp_err_t gpio_pullup_en(gpio_num_t gpio_num)
+{
+    CHECK_PIN(gpio_num);
+    return ESP_OK;
+}
+
+esp_err_t gpio_pullup_dis(gpio_num_t gpio_num)
+{
+    CHECK_PIN(gpio_num);
+    return ESP_OK;
+}
+
+esp_err_t gpio_pulldown_en(gpio_num_t gpio_num)
+{
+    CHECK_PIN(gpio_num);
+    return ESP_OK;
+}
+
+esp_err_t gpio_pulldown_dis(gpio_num_t gpio_num)
+{
+    CHECK_PIN(gpio_num);
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_intr_type(gpio_num_t gpio_num, gpio_int_type_t intr_type)
+{
+    CHECK_PIN(gpio_num);
+    pins[gpio_num].intr_type = intr_type;
+    pins[gpio_num].intr_enabled = intr_type != GPIO_INTR_DISABLE;
+    return ESP_OK;
+}
+
+esp_err_t gpio_intr_enable(gpio_num_t gpio_num)
+{
+    CHECK_PIN(gpio_num);
+    pins[gpio_num].intr_enabled = true;
+    return ESP_OK;
+}
+
+esp_err_t gpio_intr_disable(gpio_num_t gpio_num)
+{
+    CHECK_PIN(gpio_num);
+    pins[gpio_num].intr_enabled = false;
+    return ESP_OK;
+}
+
+esp_err_t gpio_install_isr_service(int intr_alloc_flags)
+{
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_add(gpio_num_t gpio_num, gpio_isr_t isr_handler, void *args)
+{
+    CHECK_PIN(gpio_num);
+    pins[gpio_num].isr_arg = args;
+    pins[gpio_num].isr = isr_handler;
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_remove(gpio_num_t gpio_num)
+{
+    CHECK_PIN(gpio_num);
+    pins[gpio_num].isr = NULL;
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_drive_capability(gpio_num_t gpio_num, gpio_drive_cap_t strength)
+{
+    CHECK_PIN(gpio_num);
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_glitch_filter(gpio_num_t gpio_num, bool enable)
+{
+    CHECK_PIN(gpio_num);
+    return ESP_OK;
+}
+
+void sim_gpio_drive_input(int gpio_num, int level)
+{
+    if (gpio_num < 0 || gpio_num >= SIM_GPIO_COUNT)
+        return;
+    level = level ? 1 : 0;
+    int prev = pins[gpio_num].level;
+    pins[gpio_num].level = level;
+    if (prev == level || !pins[gpio_num].intr_enabled || !pins[gpio_num].isr)
+        return;
+    gpio_int_type_t t = pins[gpio_num].intr_type;
+    if (t == GPIO_INTR_ANYEDGE || (t == GPIO_INTR_POSEDGE && level) || (t == GPIO_INTR_NEGEDGE && !level) ||
+        (t == GPIO_INTR_HIGH_LEVEL && level) || (t == GPIO_INTR_LOW_LEVEL && !level))
+        pins[gpio_num].isr(pins[gpio_num].isr_arg); // Runs on the plant task, standing in for the ISR
+}
+
+int sim_gpio_level(int gpio_num)
+{
+    return gpio_get_level(gpio_num);
+}
@@ -0,0 +1,133 @@
+#include <stdbool.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/ledc.h"
+#include "sim_hw.h"
+
+static struct
+{
+    uint32_t duty;       // Output duty, or fade start duty
+    uint32_t next_duty;  // Set by ledc_set_duty, applied by ledc_update_duty
+    uint32_t fade_target;
+    int fade_ms;
+    TickType_t fade_start;
+    bool fading;
+    uint32_t max_duty;
+} channels[LEDC_CHANNEL_MAX];
+
+static uint32_t timer_max[LEDC_TIMER_MAX];
+
+static uint32_t current_duty(int ch)
+{ // Linear fade in virtual time, the hardware steps in small increments so this is close enough
+    if (!channels[ch].fading)
+        return channels[ch].duty;
+    int elapsed = xTaskGetTickCount() - channels[ch].fade_start;
+    if (elapsed >= channels[ch].fade_ms)
+    {
+        channels[ch].duty = channels[ch].fade_target;
+        channels[ch].fading = false;
+        return channels[ch].duty;
+    }
+    int64_t from = channels[ch].duty;
+    int64_t to = channels[ch].fade_target;
+    return from + (to - from) * elapsed / channels[ch].fade_ms;
+}
+
+esp_err_t ledc_timer_config(const ledc_timer_config_t *timer_conf)
+{
+    if (timer_conf->timer_num >= LEDC_TIMER_MAX)
+        return ESP_ERR_INVALID_ARG;
+    timer_max[timer_conf->timer_num] = (1u << timer_conf->duty_resolution) - 1;
+    return ESP_OK;
+}
+
+esp_err_t ledc_channel_config(const ledc_channel_config_t *ledc_conf)
+{
+    if (ledc_conf->channel >= LEDC_CHANNEL_MAX || ledc_conf->timer_sel >= LEDC_TIMER_MAX)
+        return ESP_ERR_INVALID_ARG;
+    channels[ledc_conf->channel].max_duty = timer_max[ledc_conf->timer_sel] ? timer_max[ledc_conf->timer_sel] : 1023;
+    channels[ledc_conf->channel].duty = ledc_conf->duty;
+    channels[ledc_conf->channel].next_duty = ledc_conf->duty;
+    channels[ledc_conf->channel].fading = false;
+    return ESP_OK;
+}
+
+esp_err_t ledc_set_duty(ledc_mode_t speed_mode, ledc_channel_t channel, uint32_t duty)
+{
+    if (channel >= LEDC_CHANNEL_MAX)
+        return ESP_ERR_INVALID_ARG;
+    channels[channel].next_duty = duty;
+    return ESP_OK;
+}
+
+esp_err_t ledc_update_duty(ledc_mode_t speed_mode, ledc_channel_t channel)
+{
+    if (channel >= LEDC_CHANNEL_MAX)
+        return ESP_ERR_INVALID_ARG;
+    vPortEnterCritical();
+    channels[channel].fading = false;
+    channels[channel].duty = channels[channel].next_duty;
+    vPortExitCritical();
+    return ESP_OK;
+}
+
+uint32_t ledc_get_duty(ledc_mode_t speed_mode, ledc_channel_t channel)
+{
+    if (channel >= LEDC_CHANNEL_MAX)
+        return 0;
+    vPortEnterCritical();
+    uint32_t duty = current_duty(channel);
+    vPortExitCritical();
+    return duty;
+}
+
+esp_err_t ledc_fade_func_install(int intr_alloc_flags)
+{
+    return ESP_OK;
+}
+
+esp_err_t ledc_set_fade_with_time(ledc_mode_t speed_mode, ledc_channel_t channel, uint32_t target_duty, int max_fade_time_ms)
+{
+    if (channel >= LEDC_CHANNEL_MAX)
+        return ESP_ERR_INVALID_ARG;
+    vPortEnterCritical();
+    channels[channel].duty = current_duty(channel);
+    channels[channel].fade_target = target_duty;
+    channels[channel].fade_ms = max_fade_time_ms;
+    vPortExitCritical();
+    return ESP_OK;
+}
+
+esp_err_t ledc_fade_start(ledc_mode_t speed_mode, ledc_channel_t channel, ledc_fade_mode_t fade_mode)
+{
+    if (channel >= LEDC_CHANNEL_MAX)
+        return ESP_ERR_INVALID_ARG;
+    vPortEnterCritical();
+    channels[channel].fade_start = xTaskGetTickCount();
+    channels[channel].fading = channels[channel].fade_ms > 0;
+    if (!channels[channel].fading)
+        channels[channel].duty = channels[channel].fade_target;
+    vPortExitCritical();
+    if (fade_mode == LEDC_FADE_WAIT_DONE && channels[channel].fade_ms > 0)
+        vTaskDelay(channels[channel].fade_ms);
+    return ESP_OK;
+}
+
+esp_err_t ledc_fade_stop(ledc_mode_t speed_mode, ledc_channel_t channel)
+{
+    if (channel >= LEDC_CHANNEL_MAX)
+        return ESP_ERR_INVALID_ARG;
+    vPortEnterCritical();
+    channels[channel].duty = current_duty(channel);
+    channels[channel].fading = false;
+    vPortExitCritical();
+    return ESP_OK;
+}
+
+float sim_ledc_duty(int channel)
+{
+    if (channel < 0 || channel >= LEDC_CHANNEL_MAX || !channels[channel].max_duty)
+        return 0;
+    return (float)ledc_get_duty(LEDC_LOW_SPEED_MODE, channel) / channels[channel].max_duty;
+}
@@ -0,0 +1,148 @@
+#include <string.h>
+#include <stdlib.h>
+
+#include "freertos/FreeRTOS.h"
+#include "nvs.h"
+
+#define NVS_MAX_ENTRIES 64
+#define NVS_MAX_NAMESPACES 16
+#define NVS_KEY_LEN 16
+
+static struct
+{
+    uint8_t ns; // Namespace index + 1, 0 = free
+    char key[NVS_KEY_LEN];
+    void *value;
+    size_t len;
+} entries[NVS_MAX_ENTRIES];
+static char namespaces[NVS_MAX_NAMESPACES][NVS_KEY_LEN];
+
+static int find(nvs_handle_t handle, const char *key)
+{
+    for (int i = 0; i < NVS_MAX_ENTRIES; i++)
+    {
+        if (entries[i].ns == handle && !strncmp(entries[i].key, key, NVS_KEY_LEN))
+            return i;
+    }
+    return -1;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+{
+    for (int i = 0; i < NVS_MAX_NAMESPACES; i++)
+    {
+        if (!strncmp(namespaces[i], name, NVS_KEY_LEN))
+        {
+            *out_handle = i + 1;
+            return ESP_OK;
+        }
+        if (!namespaces[i][0])
+        {
+            if (open_mode == NVS_READONLY)
+                return ESP_ERR_NVS_NOT_FOUND;
+            strncpy(namespaces[i], name, NVS_KEY_LEN - 1);
+            *out_handle = i + 1;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NO_MEM;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+    vPortEnterCritical();
+    int i = find(handle, key);
+    if (i < 0)
+    {
+        for (i = 0; i < NVS_MAX_ENTRIES && entries[i].ns; i++)
+            ;
+    }
+    if (i >= NVS_MAX_ENTRIES)
+    {
+        vPortExitCritical();
+        return ESP_ERR_NO_MEM;
+    }
+    void *copy = malloc(length);
+    memcpy(copy, value, length);
+    free(entries[i].value);
+    entries[i].ns = handle;
+    strncpy(entries[i].key, key, NVS_KEY_LEN - 1);
+    entries[i].value = copy;
+    entries[i].len = length;
+    vPortExitCritical();
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length)
+{
+    vPortEnterCritical();
+    int i = find(handle, key);
+    if (i < 0)
+    {
+        vPortExitCritical();
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    if (!out_value)
+    {
+        *length = entries[i].len;
+        vPortExitCritical();
+        return ESP_OK;
+    }
+    if (*length < entries[i].len)
+    {
+        vPortExitCritical();
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(out_value, entries[i].value, entries[i].len);
+    *length = entries[i].len;
+    vPortExitCritical();
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char *key, uint32_t value)
+{
+    return nvs_set_blob(handle, key, &value, sizeof(value));
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char *key, uint32_t *out_value)
+{
+    size_t len = sizeof(*out_value);
+    return nvs_get_blob(handle, key, out_value, &len);
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+    vPortEnterCritical();
+    int i = find(handle, key);
+    if (i >= 0)
+    {
+        free(entries[i].value);
+        memset(&entries[i], 0, sizeof(entries[i]));
+    }
+    vPortExitCritical();
+    return i >= 0 ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_erase_all(nvs_handle_t handle)
+{
+    vPortEnterCritical();
+    for (int i = 0; i < NVS_MAX_ENTRIES; i++)
+    {
+        if (entries[i].ns == handle)
+        {
+            free(entries[i].value);
+            memset(&entries[i], 0, sizeof(entries[i]));
+        }
+    }
+    vPortExitCritical();
+    return ESP_OK;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+}
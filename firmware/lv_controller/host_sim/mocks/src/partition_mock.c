@@ -0,0 +1,76 @@
+#include <string.h>
+#include <stdlib.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_partition.h"
+
+// The allow-list partition from partitions.csv, erased at the start of every run
+static esp_partition_t sim_parts[] = {
+    {.type = ESP_PARTITION_TYPE_DATA, .subtype = 0x40, .address = 0x110000, .size = 0xC0000, .label = "allowlist"},
+};
+static uint8_t *sim_flash[sizeof(sim_parts) / sizeof(*sim_parts)];
+
+static uint8_t *flash(const esp_partition_t *partition)
+{
+    int i = partition - sim_parts;
+    if (!sim_flash[i])
+    {
+        sim_flash[i] = malloc(partition->size);
+        memset(sim_flash[i], 0xFF, partition->size);
+    }
+    return sim_flash[i];
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label)
+{
+    for (int i = 0; i < sizeof(sim_parts) / sizeof(*sim_parts); i++)
+    {
+        if (sim_parts[i].type == type && sim_parts[i].subtype == subtype && (!label || !strcmp(sim_parts[i].label, label)))
+            return &sim_parts[i];
+    }
+    return NULL;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size)
+{
+    if (src_offset + size > partition->size)
+        return ESP_ERR_INVALID_SIZE;
+    memcpy(dst, flash(partition) + src_offset, size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size)
+{ // Programming can only take bits from 1 to 0
+    if (dst_offset + size > partition->size)
+        return ESP_ERR_INVALID_SIZE;
+    uint8_t *f = flash(partition) + dst_offset;
+    vPortEnterCritical();
+    for (size_t i = 0; i < size; i++)
+        f[i] &= ((const uint8_t *)src)[i];
+    vPortExitCritical();
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size)
+{
+    if (offset % SIM_FLASH_SECTOR || size % SIM_FLASH_SECTOR || offset + size > partition->size)
+        return ESP_ERR_INVALID_ARG;
+    vPortEnterCritical();
+    memset(flash(partition) + offset, 0xFF, size);
+    vPortExitCritical();
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_mmap(const esp_partition_t *partition, size_t offset, size_t size,
+                             esp_partition_mmap_memory_t memory, const void **out_ptr, esp_partition_mmap_handle_t *out_handle)
+{ // Reads see writes straight away, as they do through the flash cache once the driver has flushed it
+    if (offset + size > partition->size)
+        return ESP_ERR_INVALID_SIZE;
+    *out_ptr = flash(partition) + offset;
+    *out_handle = partition - sim_parts + 1;
+    return ESP_OK;
+}
+
+void esp_partition_munmap(esp_partition_mmap_handle_t handle)
+{
+}
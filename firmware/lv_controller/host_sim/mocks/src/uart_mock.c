@@ -0,0 +1,221 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/uart.h"
+#include "sim_hw.h"
+
+#define SIM_UART_COUNT 3
+#define SIM_UART_RX_LEN 1024
+
+// Rx bytes carry the virtual time they arrive at, so device latency shows up in the firmware
+static struct
+{
+    bool installed;
+    uint32_t baudrate;
+    sim_uart_device_t device;
+    uint8_t rx[SIM_UART_RX_LEN];
+    TickType_t rx_ready[SIM_UART_RX_LEN];
+    unsigned rx_head;
+    unsigned rx_tail;
+    QueueHandle_t events;  // UART_DATA once bytes arrive, if the driver was installed with a queue
+    unsigned rx_posted;    // Bytes up to here have had their UART_DATA event
+    TaskHandle_t rx_isr;   // Stands in for the rx timeout interrupt
+} ports[SIM_UART_COUNT];
+
+#define CHECK_PORT(n)                            \
+    do                                           \
+    {                                            \
+        if ((n) < 0 || (n) >= SIM_UART_COUNT)    \
+            return ESP_ERR_INVALID_ARG;          \
+    } while (0)
+
+static size_t ready_len(int n)
+{
+    TickType_t now = xTaskGetTickCount();
+    size_t len = 0;
+    for (unsigned i = ports[n].rx_tail; i != ports[n].rx_head; i++, len++)
+    {
+        if ((int32_t)(ports[n].rx_ready[i % SIM_UART_RX_LEN] - now) > 0)
+            break;
+    }
+    return len;
+}
+
+esp_err_t uart_param_config(uart_port_t uart_num, const uart_config_t *uart_config)
+{
+    CHECK_PORT(uart_num);
+    ports[uart_num].baudrate = uart_config->baud_rate;
+    return ESP_OK;
+}
+
+esp_err_t uart_set_pin(uart_port_t uart_num, int tx_io_num, int rx_io_num, int rts_io_num, int cts_io_num)
+{
+    CHECK_PORT(uart_num);
+    return ESP_OK;
+}
+
+bool uart_is_driver_installed(uart_port_t uart_num)
+{
+    return uart_num >= 0 && uart_num < SIM_UART_COUNT && ports[uart_num].installed;
+}
+
+static void rx_isr(void *params)
+{ // One UART_DATA per tick that saw bytes arrive, like the rx timeout interrupt at the end of a burst
+    int n = (intptr_t)params;
+    while (true)
+    {
+        vTaskDelay(1);
+        vPortEnterCritical();
+        unsigned ready = ports[n].rx_tail + ready_len(n);
+        if ((int)(ports[n].rx_posted - ports[n].rx_tail) < 0)
+            ports[n].rx_posted = ports[n].rx_tail; // Flushed
+        uart_event_t event = {.type = UART_DATA, .size = ready - ports[n].rx_posted, .timeout_flag = true};
+        ports[n].rx_posted = ready;
+        vPortExitCritical();
+        if (event.size)
+            xQueueSend(ports[n].events, &event, 0);
+    }
+}
+
+esp_err_t uart_driver_install(uart_port_t uart_num, int rx_buffer_size, int tx_buffer_size, int queue_size, QueueHandle_t *uart_queue, int intr_alloc_flags)
+{
+    CHECK_PORT(uart_num);
+    if (ports[uart_num].installed)
+        return ESP_FAIL;
+    if (queue_size && uart_queue)
+    {
+        ports[uart_num].events = xQueueCreate(queue_size, sizeof(uart_event_t));
+        ports[uart_num].rx_posted = ports[uart_num].rx_head;
+        xTaskCreate(rx_isr, "uart_rx_isr", 2048, (void *)(intptr_t)uart_num, configMAX_PRIORITIES - 1, &ports[uart_num].rx_isr);
+        *uart_queue = ports[uart_num].events;
+    }
+    else if (uart_queue)
+    {
+        *uart_queue = NULL;
+    }
+    ports[uart_num].installed = true;
+    return ESP_OK;
+}
+
+esp_err_t uart_driver_delete(uart_port_t uart_num)
+{
+    CHECK_PORT(uart_num);
+    if (ports[uart_num].rx_isr)
+    {
+        vTaskDelete(ports[uart_num].rx_isr);
+        ports[uart_num].rx_isr = NULL;
+    }
+    if (ports[uart_num].events)
+    {
+        vQueueDelete(ports[uart_num].events);
+        ports[uart_num].events = NULL;
+    }
+    ports[uart_num].installed = false;
+    return ESP_OK;
+}
+
+esp_err_t uart_set_baudrate(uart_port_t uart_num, uint32_t baudrate)
+{
+    CHECK_PORT(uart_num);
+    ports[uart_num].baudrate = baudrate;
+    return ESP_OK;
+}
+
+esp_err_t uart_get_baudrate(uart_port_t uart_num, uint32_t *baudrate)
+{
+    CHECK_PORT(uart_num);
+    *baudrate = ports[uart_num].baudrate;
+    return ESP_OK;
+}
+
+int uart_write_bytes(uart_port_t uart_num, const void *src, size_t size)
+{
+    if (uart_num < 0 || uart_num >= SIM_UART_COUNT || !ports[uart_num].installed)
+        return -1;
+    if (ports[uart_num].device)
+        ports[uart_num].device(uart_num, src, size);
+    return size;
+}
+
+int uart_read_bytes(uart_port_t uart_num, void *buf, uint32_t length, TickType_t ticks_to_wait)
+{
+    if (uart_num < 0 || uart_num >= SIM_UART_COUNT || !ports[uart_num].installed)
+        return -1;
+    TickType_t start = xTaskGetTickCount();
+    while (true)
+    {
+        vPortEnterCritical();
+        size_t avail = ready_len(uart_num);
+        if (avail >= length || xTaskGetTickCount() - start >= ticks_to_wait)
+        {
+            if (avail > length)
+                avail = length;
+            for (size_t i = 0; i < avail; i++)
+                ((uint8_t *)buf)[i] = ports[uart_num].rx[ports[uart_num].rx_tail++ % SIM_UART_RX_LEN];
+            vPortExitCritical();
+            return avail;
+        }
+        vPortExitCritical();
+        vTaskDelay(1);
+    }
+}
+
+esp_err_t uart_wait_tx_done(uart_port_t uart_num, TickType_t ticks_to_wait)
+{
+    CHECK_PORT(uart_num);
+    return ESP_OK;
+}
+
+esp_err_t uart_flush_input(uart_port_t uart_num)
+{
+    CHECK_PORT(uart_num);
+    vPortEnterCritical();
+    ports[uart_num].rx_tail = ports[uart_num].rx_head;
+    vPortExitCritical();
+    return ESP_OK;
+}
+
+esp_err_t uart_get_buffered_data_len(uart_port_t uart_num, size_t *size)
+{
+    CHECK_PORT(uart_num);
+    vPortEnterCritical();
+    *size = ready_len(uart_num);
+    vPortExitCritical();
+    return ESP_OK;
+}
+
+void sim_uart_attach(int uart_num, sim_uart_device_t device)
+{
+    if (uart_num >= 0 && uart_num < SIM_UART_COUNT)
+        ports[uart_num].device = device;
+}
+
+void sim_uart_reply(int uart_num, const uint8_t *data, size_t len, int delay_ms)
+{
+    if (uart_num < 0 || uart_num >= SIM_UART_COUNT)
+        return;
+    vPortEnterCritical();
+    TickType_t ready = xTaskGetTickCount() + delay_ms;
+    for (size_t i = 0; i < len && ports[uart_num].rx_head - ports[uart_num].rx_tail < SIM_UART_RX_LEN; i++)
+    {
+        ports[uart_num].rx[ports[uart_num].rx_head % SIM_UART_RX_LEN] = data[i];
+        ports[uart_num].rx_ready[ports[uart_num].rx_head % SIM_UART_RX_LEN] = ready;
+        ports[uart_num].rx_head++;
+    }
+    vPortExitCritical();
+}
+
+esp_err_t uart_set_rx_timeout(uart_port_t uart_num, const uint8_t tout_thresh)
+{ // Events are per tick, far coarser than any threshold
+    CHECK_PORT(uart_num);
+    return ESP_OK;
+}
+
+uint32_t sim_uart_baudrate(int uart_num)
+{
+    if (uart_num < 0 || uart_num >= SIM_UART_COUNT)
+        return 0;
+    return ports[uart_num].baudrate;
+}
@@ -0,0 +1,158 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sim_hw.h"
+#include "plant.h"
+
+#include "bay.h"
+#include "limit_switches.h"
+
+#define PLANT_STEP_MS 1
+
+struct plant
+{
+    const struct bay_config *wiring; // NULL until plant_init
+    struct plant_config cfg;
+    struct plant_stats stats;
+    float sled_pos; // mm from the in switch
+    bool door_closed;
+    bool want_open;
+    bool want_close;
+    TickType_t door_timer; // When the pending user door action happens, 0 = none
+    bool was_moving;
+    bool at_stop;
+    int contact[BAY_NUM_LIM]; // Level the switch settles at
+    int bounce[BAY_NUM_LIM];  // Edges left to bounce before it does
+};
+
+static struct plant plants[MAX_BAYS];
+
+static void set_switch(struct plant *p, int sw, bool pressed, float speed)
+{ // Switches are pulled up, pressed reads 0
+    int pin = p->wiring->lim_gpio[sw];
+    int level = pressed ? 0 : 1;
+    if (p->bounce[sw])
+    { // Ends on the settled level
+        p->bounce[sw]--;
+        sim_gpio_drive_input(pin, p->bounce[sw] % 2 ? !p->contact[sw] : p->contact[sw]);
+    }
+    if (p->contact[sw] == level)
+        return;
+    p->contact[sw] = level;
+    p->bounce[sw] = 2 * p->cfg.switch_bounces;
+    if (pressed && (sw == LIM1 || sw == LIM3))
+    {
+        p->stats.hits++;
+        p->stats.hit_speed_sum += speed;
+        if (speed > p->stats.hit_speed_max)
+            p->stats.hit_speed_max = speed;
+    }
+    sim_gpio_drive_input(pin, level);
+}
+
+static void step_sled(struct plant *p, float dt)
+{
+    const struct bay_config *w = p->wiring;
+    bool enabled = sim_gpio_level(w->en_gpio) && !sim_gpio_level(w->di_gpio);
+    float speed = enabled ? p->cfg.sled_speed_mm_s * sim_ledc_duty(w->motor_channel) : 0;
+    if (enabled && speed > 0 && !p->was_moving)
+        p->stats.sled_moves++;
+    p->was_moving = enabled && speed > 0;
+
+    float dir = sim_gpio_level(w->dir_gpio) ? 1 : -1; // Forward drives the sled out
+    float pos = p->sled_pos + dir * speed * dt;
+    bool stopped = pos < -p->cfg.overtravel_mm || pos > p->cfg.sled_travel_mm + p->cfg.overtravel_mm;
+    if (stopped)
+    {
+        if (!p->at_stop)
+            p->stats.end_stop_hits++; // Still driven when it reached the mechanical stop
+        pos = pos < 0 ? -p->cfg.overtravel_mm : p->cfg.sled_travel_mm + p->cfg.overtravel_mm;
+    }
+    p->at_stop = stopped;
+    p->sled_pos = pos;
+
+    set_switch(p, LIM3, p->sled_pos <= p->cfg.switch_zone_mm, speed);
+    set_switch(p, LIM1, p->sled_pos >= p->cfg.sled_travel_mm - p->cfg.switch_zone_mm, speed);
+}
+
+static void step_door(struct plant *p)
+{
+    TickType_t now = xTaskGetTickCount();
+    bool unlocked = sim_ledc_duty(p->wiring->solenoid_channel) > 0;
+    bool sled_in = p->sled_pos <= p->cfg.switch_zone_mm;
+
+    if (p->door_closed && p->want_open && unlocked && !p->door_timer)
+        p->door_timer = now + p->cfg.door_open_ms;
+    if (!p->door_closed && p->want_close && sled_in && !p->door_timer)
+        p->door_timer = now + p->cfg.door_close_ms;
+    if (p->door_timer && (int32_t)(now - p->door_timer) >= 0)
+    {
+        p->door_timer = 0;
+        if (p->door_closed && p->want_open && unlocked)
+        {
+            p->door_closed = false;
+            p->want_open = false;
+            p->stats.door_cycles++;
+        }
+        else if (!p->door_closed && p->want_close && sled_in)
+        {
+            p->door_closed = true;
+            p->want_close = false;
+        }
+    }
+    set_switch(p, LIM4, p->door_closed, 0);
+}
+
+void plant_init(int bay, const struct bay_config *wiring, const struct plant_config *c)
+{
+    struct plant *p = &plants[bay];
+    p->cfg = *c;
+    p->sled_pos = 0;
+    p->door_closed = true;
+    // Sled in, door closed
+    sim_gpio_drive_input(wiring->lim_gpio[LIM1], 1);
+    sim_gpio_drive_input(wiring->lim_gpio[LIM2], 1);
+    sim_gpio_drive_input(wiring->lim_gpio[LIM3], 0);
+    sim_gpio_drive_input(wiring->lim_gpio[LIM4], 0);
+    for (int sw = 0; sw < BAY_NUM_LIM; sw++)
+        p->contact[sw] = sim_gpio_level(wiring->lim_gpio[sw]);
+    p->wiring = wiring;
+}
+
+void plant_task(void *params)
+{
+    TickType_t last = xTaskGetTickCount();
+    while (true)
+    {
+        vTaskDelayUntil(&last, PLANT_STEP_MS);
+        // Switch edges run the firmware ISR from here, so no critical section around the steps
+        for (int i = 0; i < MAX_BAYS; i++)
+        {
+            if (!plants[i].wiring)
+                continue;
+            step_sled(&plants[i], PLANT_STEP_MS / 1000.0f);
+            step_door(&plants[i]);
+        }
+    }
+}
+
+void plant_user_open_door(int bay)
+{
+    plants[bay].want_open = true;
+}
+
+void plant_user_close_door(int bay)
+{
+    plants[bay].want_close = true;
+}
+
+float plant_sled_position(int bay)
+{
+    return plants[bay].sled_pos;
+}
+
+void plant_get_stats(int bay, struct plant_stats *out)
+{
+    vPortEnterCritical();
+    *out = plants[bay].stats;
+    vPortExitCritical();
+}
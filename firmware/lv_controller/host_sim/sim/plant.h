@@ -0,0 +1,50 @@
+#ifndef PLANT_H
+#define PLANT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Physical model of a bay: sled on a lead screw between LIM3 (in) and LIM1 (out), door on LIM4
+struct plant_config
+{
+    float sled_travel_mm;  // Switch to switch
+    float sled_speed_mm_s; // At 100% duty, speed is taken as proportional to duty
+    float switch_zone_mm;  // Switch stays pressed this far from the end
+    float overtravel_mm;   // Mechanical stop past the switch
+    int switch_bounces;    // Contact bounces after every switch edge, one per millisecond
+    int door_open_ms;      // User opens the door this long after the bolt releases
+    int door_close_ms;     // User closes the door this long after the sled is back in
+};
+
+struct plant_stats
+{
+    uint32_t sled_moves;
+    uint32_t end_stop_hits; // Drove into the mechanical stop past a switch
+    float hit_speed_sum;    // Speed when an end switch closed, mm/s
+    float hit_speed_max;
+    uint32_t hits;
+    uint32_t door_cycles;
+};
+
+#define PLANT_DEFAULT_CONFIG                \
+    {                                       \
+        .sled_travel_mm = 600,              \
+        .sled_speed_mm_s = 250,             \
+        .switch_zone_mm = 3,                \
+        .overtravel_mm = 8,                 \
+        .switch_bounces = 2,                \
+        .door_open_ms = 2000,               \
+        .door_close_ms = 3000,              \
+    }
+
+struct bay_config;
+
+// One model per bay, wired to that bay's pins and channels
+void plant_init(int bay, const struct bay_config *wiring, const struct plant_config *cfg);
+void plant_task(void *params); // Steps every initialised bay
+void plant_user_open_door(int bay);  // Open the door next time the solenoid releases it
+void plant_user_close_door(int bay); // Close the door once the sled is back in
+float plant_sled_position(int bay);
+void plant_get_stats(int bay, struct plant_stats *out);
+
+#endif
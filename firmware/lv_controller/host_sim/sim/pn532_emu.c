@@ -0,0 +1,403 @@
+#include <string.h>
+#include <stdbool.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sim_hw.h"
+#include "pn532_emu.h"
+
+#define EMU_BUF_LEN 320
+#define EMU_MAX_UARTS 2
+#define EMU_POLL_FIELD_MS 3 // Field on for each InAutoPoll poll of an empty field
+#define EMU_TRY_MS 1        // Each activation try of an InListPassiveTarget that finds nothing
+
+struct pn532_emu
+{
+    int uart;
+    uint8_t rx[EMU_BUF_LEN]; // Bytes from the host not parsed yet
+    int rx_len;
+    uint8_t tag_uid[10];
+    volatile int tag_len;
+    uint32_t frames;
+    bool autopoll;         // InAutoPoll running, answered by the next poll that finds a tag
+    int poll_ms;           // Between polls
+    TickType_t poll_start; // Polls land at poll_start + n * poll_ms
+    uint32_t baud;         // Chip's side of the HSU link
+    uint32_t baud_next;    // SetSerialBaudRate answered, taken up on the host's ACK
+    uint32_t max_baud;     // Response frames above this are corrupted on the way, 0 for a clean line
+    uint8_t passive_retries; // RFConfiguration MxRtyPassiveActivation
+    // Power
+    bool asleep;           // PowerDown answered
+    uint8_t wake;          // Its WakeUpEnable
+    TickType_t since;      // Last change between awake and asleep
+    TickType_t tag_at;     // Tag put in the field and not reported yet, 0 for none
+    struct pn532_emu_power power;
+};
+
+// SetSerialBaudRate codes
+static const uint32_t emu_bauds[] = {9600, 19200, 38400, 57600, 115200, 230400, 460800, 921600, 1288000};
+
+static struct pn532_emu emus[EMU_MAX_UARTS];
+
+static int wire_ms(struct pn532_emu *emu, int bytes)
+{ // 10 bits per byte on the wire
+    return (bytes * 10 * 1000 + emu->baud - 1) / emu->baud;
+}
+
+static void reply(struct pn532_emu *emu, const uint8_t *data, int len, int delay_ms)
+{ // Garbage if the host listens at another rate, a bad data byte if the line is too noisy for this one
+    uint8_t f[EMU_BUF_LEN];
+    memcpy(f, data, len);
+    if (sim_uart_baudrate(emu->uart) != emu->baud)
+    {
+        for (int i = 0; i < len; i++)
+            f[i] ^= 0xA5;
+    }
+    else if (emu->max_baud && emu->baud > emu->max_baud && len > 8)
+    {
+        f[len - 3] ^= 0x04; // ACKs are short enough to get through
+    }
+    emu->power.wire_us += len * 10000000ULL / emu->baud;
+    sim_uart_reply(emu->uart, f, len, delay_ms);
+}
+
+static void account(struct pn532_emu *emu)
+{ // Time since the last change of power state
+    TickType_t now = xTaskGetTickCount();
+    if (emu->asleep)
+        emu->power.asleep_ms += now - emu->since;
+    else
+        emu->power.awake_ms += now - emu->since;
+    emu->since = now;
+}
+
+static void detected(struct pn532_emu *emu, int delay_ms)
+{ // A response naming the tag goes out after delay_ms, latency runs from the tag entering the field
+    if (!emu->tag_at)
+        return;
+    uint32_t ms = xTaskGetTickCount() + delay_ms - emu->tag_at;
+    emu->power.detections++;
+    emu->power.latency_sum_ms += ms;
+    emu->power.latency_last_ms = ms;
+    if (ms > emu->power.latency_max_ms)
+        emu->power.latency_max_ms = ms;
+    emu->tag_at = 0;
+}
+
+static void autopoll_stop(struct pn532_emu *emu, int extra_polls)
+{ // Field time for the polls run since InAutoPoll started
+    if (!emu->autopoll)
+        return;
+    int since = xTaskGetTickCount() - emu->poll_start;
+    emu->power.field_ms += (since / emu->poll_ms + 1 + extra_polls) * EMU_POLL_FIELD_MS;
+    emu->autopoll = false;
+}
+
+static void send_ack(struct pn532_emu *emu)
+{
+    static const uint8_t ack[] = {0x00, 0x00, 0xFF, 0x00, 0xFF, 0x00};
+    reply(emu, ack, sizeof(ack), 1 + wire_ms(emu, sizeof(ack)));
+}
+
+static void send_error(struct pn532_emu *emu)
+{ // Syntax error frame, what the chip sends for commands it doesn't know
+    static const uint8_t err[] = {0x00, 0x00, 0xFF, 0x01, 0xFF, 0x7F, 0x81, 0x00};
+    reply(emu, err, sizeof(err), 1 + wire_ms(emu, sizeof(err)));
+}
+
+static void send_response(struct pn532_emu *emu, uint8_t cmd, const uint8_t *data, int len, int process_ms)
+{
+    uint8_t f[EMU_BUF_LEN];
+    int n = 0;
+    f[n++] = 0x00;
+    f[n++] = 0x00;
+    f[n++] = 0xFF;
+    f[n++] = len + 2;
+    f[n++] = -(len + 2);
+    f[n++] = 0xD5;
+    f[n++] = cmd + 1;
+    uint8_t sum = 0xD5 + cmd + 1;
+    for (int i = 0; i < len; i++)
+    {
+        f[n++] = data[i];
+        sum += data[i];
+    }
+    f[n++] = -sum;
+    f[n++] = 0x00;
+    // Replies queue behind the ACK already sent
+    reply(emu, f, n, 1 + wire_ms(emu, 6) + process_ms + wire_ms(emu, n));
+}
+
+static int target_data(struct pn532_emu *emu, uint8_t *r)
+{ // 106 kbps type A target, caller holds the critical section
+    int n = 0;
+    int l = emu->tag_len;
+    r[n++] = 1;    // Tg
+    r[n++] = 0x00; // SENS_RES
+    r[n++] = 0x44;
+    r[n++] = 0x00; // SEL_RES
+    r[n++] = l;
+    memcpy(&r[n], emu->tag_uid, l);
+    return n + l;
+}
+
+static void autopoll_found(struct pn532_emu *emu)
+{ // Caller holds the critical section, the response goes out after the next poll of the field
+    uint8_t r[32];
+    int n = 0;
+    r[n++] = 1;    // NbTg
+    r[n++] = 0x10; // Type, 106 kbps type A
+    n++;           // Length of the target data
+    int l = target_data(emu, &r[n]);
+    r[n - 1] = l;
+    n += l;
+    int since = xTaskGetTickCount() - emu->poll_start;
+    int wait = emu->poll_ms - since % emu->poll_ms;
+    autopoll_stop(emu, 1);
+    detected(emu, wait + 5);
+    send_response(emu, 0x60, r, n, wait + 5);
+}
+
+static void handle_command(struct pn532_emu *emu, uint8_t cmd, const uint8_t *data, int len)
+{
+    uint8_t r[32];
+    int n = 0;
+    emu->frames++;
+    autopoll_stop(emu, 0); // Any frame stops it
+    emu->baud_next = 0;
+    send_ack(emu);
+    switch (cmd)
+    {
+    case 0x10: // SetSerialBaudRate
+        if (len < 1 || data[0] >= sizeof(emu_bauds) / sizeof(*emu_bauds))
+        {
+            send_error(emu);
+            break;
+        }
+        send_response(emu, cmd, r, 0, 1);
+        emu->baud_next = emu_bauds[data[0]];
+        break;
+    case 0x16: // PowerDown, down once the response is out
+        if (len < 1)
+        {
+            send_error(emu);
+            break;
+        }
+        r[n++] = 0x00;
+        send_response(emu, cmd, r, n, 1);
+        account(emu);
+        emu->asleep = true;
+        emu->wake = data[0];
+        break;
+    case 0x00: // Diagnose
+        r[n++] = 0x00;
+        send_response(emu, cmd, r, n, 1);
+        break;
+    case 0x02: // GetFirmwareVersion
+        r[n++] = 0x32;
+        r[n++] = 0x01;
+        r[n++] = 0x06;
+        r[n++] = 0x07;
+        send_response(emu, cmd, r, n, 1);
+        break;
+    case 0x06: // ReadRegister
+        for (int i = 0; i + 1 < len && n < sizeof(r); i += 2)
+            r[n++] = 0x00;
+        send_response(emu, cmd, r, n, 1);
+        break;
+    case 0x0C: // ReadGPIO
+        r[n++] = 0xFF;
+        r[n++] = 0xFF;
+        r[n++] = 0x00;
+        send_response(emu, cmd, r, n, 1);
+        break;
+    case 0x08: // WriteRegister
+    case 0x0E: // WriteGPIO
+    case 0x32: // RFConfiguration
+        if (len >= 4 && data[0] == 0x05)
+            emu->passive_retries = data[3];
+        send_response(emu, cmd, r, 0, 1);
+        break;
+    case 0x14: // SAMConfiguration
+        send_response(emu, cmd, r, 0, 1);
+        break;
+    case 0x44: // InDeselect
+    case 0x52: // InRelease
+        r[n++] = 0x00;
+        send_response(emu, cmd, r, n, 1);
+        break;
+    case 0x4A: // InListPassiveTarget, 106 kbps type A only
+    {
+        vPortEnterCritical();
+        int l = emu->tag_len;
+        int ms = l ? 5 : 1 + (emu->passive_retries + 1) * EMU_TRY_MS; // 0xFF would wait for a tag, not modelled
+        if (l)
+        {
+            r[n++] = 1; // NbTg
+            n += target_data(emu, &r[n]);
+        }
+        else
+        {
+            r[n++] = 0; // Nothing in the field after the retries
+        }
+        if (l)
+            detected(emu, 5);
+        emu->power.field_ms += ms;
+        vPortExitCritical();
+        send_response(emu, cmd, r, n, ms);
+        break;
+    }
+    case 0x60: // InAutoPoll, 106 kbps type A only
+        if (len < 3 || data[1] < 1 || data[1] > 0x0F)
+        {
+            send_error(emu);
+            break;
+        }
+        vPortEnterCritical();
+        emu->poll_ms = data[1] * 150;
+        emu->poll_start = xTaskGetTickCount();
+        emu->autopoll = true;
+        if (emu->tag_len)
+            autopoll_found(emu);
+        vPortExitCritical();
+        break;
+    default:
+        send_error(emu);
+        break;
+    }
+}
+
+static void parse(struct pn532_emu *emu)
+{
+    uint8_t *rx = emu->rx;
+    while (true)
+    {
+        int start = -1;
+        for (int i = 0; i + 1 < emu->rx_len; i++)
+        {
+            if (rx[i] == 0x00 && rx[i + 1] == 0xFF)
+            {
+                start = i;
+                break;
+            }
+        }
+        if (start < 0)
+        { // Keep a trailing 0x00 in case the start code is split
+            if (emu->rx_len && rx[emu->rx_len - 1] == 0x00)
+            {
+                rx[0] = 0x00;
+                emu->rx_len = 1;
+            }
+            else
+            {
+                emu->rx_len = 0;
+            }
+            return;
+        }
+        uint8_t *f = &rx[start + 2];
+        int avail = emu->rx_len - start - 2;
+        if (avail < 2)
+            return;
+        int len = f[0];
+        if (len == 0 && f[1] == 0xFF)
+        { // ACK from the host, aborts InAutoPoll or confirms a new rate
+            autopoll_stop(emu, 0);
+            if (emu->baud_next)
+                emu->baud = emu->baud_next;
+            emu->baud_next = 0;
+            memmove(rx, &rx[start + 4], avail - 2);
+            emu->rx_len = avail - 2;
+            continue;
+        }
+        if ((uint8_t)(f[0] + f[1]) || len == 0)
+        { // Not a frame header, skip this start code
+            memmove(rx, &rx[start + 2], avail);
+            emu->rx_len = avail;
+            continue;
+        }
+        if (avail < 2 + len + 1)
+            return; // Wait for the rest
+        uint8_t sum = 0;
+        for (int i = 0; i < len + 1; i++)
+            sum += f[2 + i];
+        if (!sum && f[2] == 0xD4)
+            handle_command(emu, f[3], &f[4], len - 2);
+        int used = start + 2 + 2 + len + 1;
+        memmove(rx, &rx[used], emu->rx_len - used);
+        emu->rx_len -= used;
+    }
+}
+
+static void on_host_bytes(int uart_num, const uint8_t *data, size_t len)
+{
+    struct pn532_emu *emu = &emus[uart_num];
+    emu->power.wire_us += len * 10000000ULL / sim_uart_baudrate(uart_num);
+    if (emu->asleep)
+    { // The bytes that wake the HSU are lost while the oscillator starts
+        if (emu->wake & 0x10)
+        {
+            account(emu);
+            emu->asleep = false;
+            emu->power.wakes++;
+        }
+        return;
+    }
+    if (sim_uart_baudrate(uart_num) != emu->baud)
+        return; // Framing errors at the chip's end, nothing it can parse
+    for (size_t i = 0; i < len; i++)
+    {
+        if (emu->rx_len == EMU_BUF_LEN)
+            emu->rx_len = 0; // Garbage, start again
+        emu->rx[emu->rx_len++] = data[i];
+    }
+    parse(emu);
+}
+
+void pn532_emu_init(int uart_num)
+{
+    emus[uart_num].uart = uart_num;
+    emus[uart_num].baud = 115200;
+    emus[uart_num].passive_retries = 0xFF; // Chip default
+    sim_uart_attach(uart_num, on_host_bytes);
+}
+
+void pn532_emu_set_tag(int uart_num, const uint8_t *uid, int len)
+{
+    struct pn532_emu *emu = &emus[uart_num];
+    if (len > sizeof(emu->tag_uid))
+        len = sizeof(emu->tag_uid);
+    vPortEnterCritical();
+    memcpy(emu->tag_uid, uid, len);
+    if (!len)
+        emu->tag_at = 0;
+    else if (!emu->tag_len)
+        emu->tag_at = xTaskGetTickCount() ? xTaskGetTickCount() : 1;
+    emu->tag_len = len;
+    if (len && emu->autopoll)
+        autopoll_found(emu);
+    vPortExitCritical();
+}
+
+uint32_t pn532_emu_frames(int uart_num)
+{
+    return emus[uart_num].frames;
+}
+
+void pn532_emu_set_max_baud(int uart_num, uint32_t baud)
+{
+    emus[uart_num].max_baud = baud;
+}
+
+uint32_t pn532_emu_baud(int uart_num)
+{
+    return emus[uart_num].baud;
+}
+
+void pn532_emu_power(int uart_num, struct pn532_emu_power *power)
+{
+    struct pn532_emu *emu = &emus[uart_num];
+    vPortEnterCritical();
+    account(emu);
+    *power = emu->power;
+    vPortExitCritical();
+}
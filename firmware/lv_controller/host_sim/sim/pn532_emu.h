@@ -0,0 +1,35 @@
+#ifndef PN532_EMU_H
+#define PN532_EMU_H
+
+#include <stdint.h>
+
+// Supply current in each state, ballpark for a PN532 board at 3.3 V
+#define PN532_EMU_VOLTS 3.3
+#define PN532_EMU_SLEEP_MA 0.01 // Soft power down
+#define PN532_EMU_AWAKE_MA 25.0 // Running with the field off
+#define PN532_EMU_FIELD_MA 80.0 // On top while the field is on
+
+struct pn532_emu_power
+{
+    uint32_t asleep_ms;
+    uint32_t awake_ms;
+    uint32_t field_ms; // Of awake_ms
+    uint32_t wakes;
+    uint32_t detections; // Tags reported, each timed from entering the field to the response
+    uint32_t latency_sum_ms;
+    uint32_t latency_max_ms;
+    uint32_t latency_last_ms;
+    uint64_t wire_us; // UART busy, both directions
+};
+
+// Byte level PN532 model on a simulated UART, answers the commands the pn532 component sends. One per UART
+void pn532_emu_init(int uart_num);
+// Put a tag in the field, len 0 takes it away
+void pn532_emu_set_tag(int uart_num, const uint8_t *uid, int len);
+uint32_t pn532_emu_frames(int uart_num);
+// Noisy line, response frames sent faster than baud fail their checksum. 0 for a clean line at every rate
+void pn532_emu_set_max_baud(int uart_num, uint32_t baud);
+uint32_t pn532_emu_baud(int uart_num);
+void pn532_emu_power(int uart_num, struct pn532_emu_power *power);
+
+#endif
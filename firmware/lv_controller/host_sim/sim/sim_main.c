@@ -0,0 +1,491 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "driver/gpio.h"
+#include "driver/ledc.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "allow_list.h"
+#include "bay.h"
+#include "actuator.h"
+#include "commands.h"
+#include "cycle.h"
+#include "limit_switches.h"
+#include "motion_profile.h"
+#include "nfc_module.h"
+#include "ring_light.h"
+#include "sled_estimator.h"
+#include "bay_journal.h"
+#include "stats.h"
+#include "solenoid.h"
+#include "state_machine.h"
+#include "trace.h"
+
+#include "plant.h"
+#include "pn532_emu.h"
+
+// User and BBB behaviour, all virtual time
+#define TAP_HOLD_MS 1000      // Tag held on the reader
+#define USER_STEP_MS 1500     // Between taps, the tag is off the reader for the rest
+#define USER_LOAD_MS 5000     // Wheeling the bike on or off the sled
+#define CV_MS 3000            // BBB computer vision and gantry alignment
+#define BBB_LATENCY_MS 500    // BBB reacting to a console banner
+#define OWNER_BACK_MS 5000    // Charge over to the owner at the door
+#define STEP_TIMEOUT_MS 300000
+
+struct sim_event
+{
+    enum transitions t;
+    int result;
+    int64_t total_us;
+    TickType_t at;
+};
+
+struct transition_stats
+{
+    uint32_t count;
+    int64_t latency_sum_ms; // Trigger (tap or BBB command) to done
+    int64_t latency_max_ms;
+    int64_t engine_sum_us; // Time inside the state machine engine
+};
+
+enum sim_tap
+{ // Taps in a cycle
+    TAP_CLAIM,
+    TAP_LOAD,
+    TAP_CLOSE,
+    TAP_PICKUP,
+    TAP_UNLOAD,
+    TAP_LEAVE,
+    NUM_SIM_TAPS,
+};
+
+static const char *tap_names[NUM_SIM_TAPS] = {"claim", "load", "close", "pickup", "unload", "leave"};
+
+struct tap_stats
+{ // Tag entering the field to the PN532 naming it
+    uint32_t count;
+    uint32_t latency_sum_ms;
+    uint32_t latency_max_ms;
+};
+
+// One simulated customer stream per bay, all bays run at once
+struct sim_bay
+{
+    struct bay *bay;
+    QueueHandle_t events;
+    struct transition_stats tstats[NUM_TRANSITIONS];
+    struct tap_stats taps[NUM_SIM_TAPS];
+    uint8_t uid[7];
+    uint8_t stranger[7]; // Another subscriber's tag, same length as the owner's
+    TickType_t last_tap;
+    int done;
+    int64_t cycle_sum_ms;
+    int64_t cycle_max_ms;
+};
+
+static const char *TAG = "sim";
+static struct sim_bay sim_bays[NUM_BAYS];
+static QueueHandle_t sim_finished = NULL; // Bay index, sent by each cycle task when it stops
+static const uint8_t sim_uid[] = {0x04, 0xA2, 0x3B, 0x5C, 0x61, 0x80, 0x11};
+static int sim_cycles = 5;
+static int sim_charge_ms = 60000;
+static bool sim_manual = false; // Cycle script off, every step on a tap or BBB command as before
+static int sim_allow_size = 30000; // Other subscribers on the allow-list besides the sim's customers
+static uint32_t sim_max_baud = 0; // PN532 line corrupts response frames above this, 0 for clean
+
+static void sim_observer(struct bay *bay, enum transitions t, int result, int64_t total_us)
+{ // State machine task, just hand the result to that bay's driver
+    struct sim_event e = {.t = t, .result = result, .total_us = total_us, .at = xTaskGetTickCount()};
+    xQueueSend(sim_bays[bay->index].events, &e, portMAX_DELAY);
+}
+
+static void user_tap(struct sim_bay *sb, enum sim_tap tap)
+{
+    int uart = sb->bay->cfg->nfc_uart;
+    struct pn532_emu_power pw;
+    TickType_t now = xTaskGetTickCount();
+    if (sb->last_tap && now - sb->last_tap < USER_STEP_MS)
+        vTaskDelay(USER_STEP_MS - (now - sb->last_tap));
+    pn532_emu_power(uart, &pw);
+    uint32_t detections = pw.detections;
+    sb->last_tap = xTaskGetTickCount();
+    pn532_emu_set_tag(uart, sb->uid, sizeof(sb->uid));
+    vTaskDelay(TAP_HOLD_MS);
+    pn532_emu_set_tag(uart, NULL, 0);
+    pn532_emu_power(uart, &pw);
+    if (pw.detections == detections)
+        return; // Missed while held
+    struct tap_stats *ts = &sb->taps[tap];
+    ts->count++;
+    ts->latency_sum_ms += pw.latency_last_ms;
+    if (pw.latency_last_ms > ts->latency_max_ms)
+        ts->latency_max_ms = pw.latency_last_ms;
+}
+
+static int stranger_tap(struct sim_bay *sb)
+{ // Someone else's tag at a bay holding a bike, 1 if the firmware took it as the owner's
+    struct bay *bay = sb->bay;
+    int uart = bay->cfg->nfc_uart;
+    int next_state = bay->nfc_next_state;
+    TickType_t now = xTaskGetTickCount();
+    if (sb->last_tap && now - sb->last_tap < USER_STEP_MS)
+        vTaskDelay(USER_STEP_MS - (now - sb->last_tap));
+    sb->last_tap = xTaskGetTickCount();
+    pn532_emu_set_tag(uart, sb->stranger, sizeof(sb->stranger));
+    vTaskDelay(TAP_HOLD_MS);
+    pn532_emu_set_tag(uart, NULL, 0);
+    vTaskDelay(BBB_LATENCY_MS);
+    if (!bay->tap_us && bay->nfc_next_state == next_state && !uxQueueMessagesWaiting(sb->events))
+        return 0;
+    printf("SIM: bay %d took a stranger's tag at pick-up\n", bay->index);
+    return 1;
+}
+
+static int wait_transition(struct sim_bay *sb, enum transitions t, TickType_t trigger)
+{ // Wait for t to finish and record how long it took from the trigger
+    struct sim_event e;
+    while (xQueueReceive(sb->events, &e, STEP_TIMEOUT_MS) == pdTRUE)
+    {
+        if (e.t != t)
+        {
+            ESP_LOGW(TAG, "Bay %d: unexpected %s while waiting for %s", sb->bay->index, sm_transition_name(e.t), sm_transition_name(t));
+            continue;
+        }
+        if (e.result)
+        {
+            printf("SIM: bay %d %s failed (%d)\n", sb->bay->index, sm_transition_name(t), e.result);
+            return 1;
+        }
+        struct transition_stats *ts = &sb->tstats[t];
+        int64_t latency = e.at - trigger;
+        ts->count++;
+        ts->latency_sum_ms += latency;
+        if (latency > ts->latency_max_ms)
+            ts->latency_max_ms = latency;
+        ts->engine_sum_us += e.total_us;
+        return 0;
+    }
+    printf("SIM: bay %d timed out waiting for %s\n", sb->bay->index, sm_transition_name(t));
+    return 1;
+}
+
+static int run_cycle(struct sim_bay *sb)
+{ // One customer: drop off, charge, pick up
+    struct bay *bay = sb->bay;
+    TickType_t trigger;
+
+    plant_user_open_door(bay->index);
+    user_tap(sb, TAP_CLAIM);
+    trigger = sb->last_tap;
+    if (wait_transition(sb, T_UNLOCKEDEM, trigger))
+        return 1;
+
+    user_tap(sb, TAP_LOAD);
+    if (wait_transition(sb, T_LOADING, sb->last_tap))
+        return 1;
+
+    vTaskDelay(USER_LOAD_MS);
+    plant_user_close_door(bay->index);
+    user_tap(sb, TAP_CLOSE);
+    if (wait_transition(sb, T_CLOSED, sb->last_tap))
+        return 1;
+    trigger = xTaskGetTickCount(); // Chained by the NFC module
+    if (wait_transition(sb, T_COMPVISION, trigger))
+        return 1;
+
+    vTaskDelay(CV_MS);
+    trigger = xTaskGetTickCount();
+    if (sim_manual)
+        to_charging(bay);
+    else
+        cycle_post_gate(bay, CG_CHARGER_ON);
+    if (wait_transition(sb, T_CHARGING, trigger))
+        return 1;
+
+    vTaskDelay(sim_charge_ms / 2);
+    if (stranger_tap(sb)) // Mid-charge, so the pickup tap is not timed inside the stranger's fast window
+        return 1;
+    vTaskDelay(sim_charge_ms - sim_charge_ms / 2);
+    if (!sim_manual)
+        cycle_post_gate(bay, CG_CHARGER_CLEAR); // Charge over, the BBB answers the gate before the owner is back
+    vTaskDelay(OWNER_BACK_MS);
+    plant_user_open_door(bay->index);
+    user_tap(sb, TAP_PICKUP); // WaitForBBBFin, the BBB unlocks when it sees the banner
+    if (sim_manual)
+    {
+        vTaskDelay(BBB_LATENCY_MS);
+        to_unlocked(bay);
+    }
+    if (wait_transition(sb, T_UNLOCKED, sb->last_tap))
+        return 1;
+
+    user_tap(sb, TAP_UNLOAD);
+    if (wait_transition(sb, T_UNLOADING, sb->last_tap))
+        return 1;
+
+    vTaskDelay(USER_LOAD_MS);
+    plant_user_close_door(bay->index);
+    user_tap(sb, TAP_LEAVE);
+    if (wait_transition(sb, T_EMPTY, sb->last_tap))
+        return 1;
+    return 0;
+}
+
+static void cycle_task(void *params)
+{
+    struct sim_bay *sb = params;
+    for (; sb->done < sim_cycles; sb->done++)
+    {
+        TickType_t start = xTaskGetTickCount();
+        if (run_cycle(sb))
+            break;
+        int64_t ms = xTaskGetTickCount() - start;
+        sb->cycle_sum_ms += ms;
+        if (ms > sb->cycle_max_ms)
+            sb->cycle_max_ms = ms;
+        printf("SIM: bay %d cycle %d done in %.2f s\n", sb->bay->index, sb->done + 1, ms / 1000.0);
+    }
+    int index = sb->bay->index;
+    xQueueSend(sim_finished, &index, portMAX_DELAY);
+    vTaskDelete(NULL);
+}
+
+static void report_bay(struct sim_bay *sb)
+{
+    struct plant_stats ps;
+    plant_get_stats(sb->bay->index, &ps);
+
+    printf("-- Bay %d: %d cycles\n", sb->bay->index, sb->done);
+    if (!sb->done)
+        return;
+    double mean_s = sb->cycle_sum_ms / 1000.0 / sb->done;
+    printf("Cycle time: mean %.2f s, max %.2f s (charge %d s)\n", mean_s, sb->cycle_max_ms / 1000.0, sim_charge_ms / 1000);
+    printf("Throughput: %.2f bikes/hour\n", 3600.0 / mean_s);
+    printf("%-14s %6s %12s %12s %12s\n", "transition", "count", "mean ms", "max ms", "engine ms");
+    for (int t = 0; t < NUM_TRANSITIONS; t++)
+    {
+        struct transition_stats *ts = &sb->tstats[t];
+        if (!ts->count)
+            continue;
+        printf("%-14s %6u %12.1f %12lld %12.1f\n", sm_transition_name(t), ts->count,
+               (double)ts->latency_sum_ms / ts->count, (long long)ts->latency_max_ms,
+               ts->engine_sum_us / 1000.0 / ts->count);
+    }
+    printf("Sled: %u moves, switch hit speed mean %.1f mm/s max %.1f mm/s, %u mechanical stop hits\n",
+           ps.sled_moves, ps.hits ? ps.hit_speed_sum / ps.hits : 0, ps.hit_speed_max, ps.end_stop_hits);
+    printf("PN532 frames: %u\n", pn532_emu_frames(sb->bay->cfg->nfc_uart));
+    struct pn532_emu_power pw;
+    pn532_emu_power(sb->bay->cfg->nfc_uart, &pw);
+    double mj = PN532_EMU_VOLTS * (PN532_EMU_SLEEP_MA * pw.asleep_ms + PN532_EMU_AWAKE_MA * pw.awake_ms +
+                                   PN532_EMU_FIELD_MA * pw.field_ms) / 1000.0;
+    uint32_t total_ms = pw.asleep_ms + pw.awake_ms;
+    printf("PN532 power: asleep %.1f%%, field on %.1f%%, %u wake-ups, mean %.1f mW, %.1f mJ per detection\n",
+           total_ms ? 100.0 * pw.asleep_ms / total_ms : 0, total_ms ? 100.0 * pw.field_ms / total_ms : 0, pw.wakes,
+           total_ms ? mj * 1000.0 / total_ms : 0, pw.detections ? mj / pw.detections : 0);
+    printf("Tag detection: %u taps, latency mean %.1f ms, max %u ms, UART busy %.3f%%\n", pw.detections,
+           pw.detections ? (double)pw.latency_sum_ms / pw.detections : 0, pw.latency_max_ms,
+           total_ms ? pw.wire_us / 10.0 / total_ms : 0);
+    printf("%-14s %6s %12s %12s\n", "tap", "count", "mean ms", "max ms");
+    for (int t = 0; t < NUM_SIM_TAPS; t++)
+    {
+        struct tap_stats *ts = &sb->taps[t];
+        if (ts->count)
+            printf("%-14s %6u %12.1f %12u\n", tap_names[t], ts->count, (double)ts->latency_sum_ms / ts->count,
+                   ts->latency_max_ms);
+    }
+    char index[4];
+    snprintf(index, sizeof(index), "%d", sb->bay->index);
+    char *nfc[] = {"nfc", index};
+    nfc_comm(2, nfc);
+}
+
+static void report(double wall_s)
+{
+    double virt_s = xTaskGetTickCount() / 1000.0;
+    int cycles = 0;
+    double throughput = 0;
+
+    printf("\n==== LV CONTROLLER SIMULATION ====\n");
+    for (int i = 0; i < NUM_BAYS; i++)
+    {
+        report_bay(&sim_bays[i]);
+        cycles += sim_bays[i].done;
+        if (sim_bays[i].done)
+            throughput += 3600.0 * sim_bays[i].done / (sim_bays[i].cycle_sum_ms / 1000.0);
+    }
+    printf("-- Total: %d cycles on %d bay(s), virtual %.1f s in %.1f s wall (x%.1f)\n", cycles, NUM_BAYS, virt_s, wall_s,
+           wall_s > 0 ? virt_s / wall_s : 0);
+    printf("Throughput: %.2f bikes/hour\n", throughput);
+    printf("\n-- Firmware latency histograms --\n");
+    stats_comm(1, (char *[]){"stats", NULL});
+    printf("\n-- Limit switches --\n");
+    lim_comm(1, (char *[]){"lim", NULL});
+    printf("\n-- Allow-list --\n");
+    allow_comm(1, (char *[]){"allow", NULL});
+}
+
+static void sim_allow_list(void)
+{ // Subscribers the customers share the list with, 7 byte NXP UIDs from a fixed seed
+    uint32_t x = 2463534242u;
+    for (int i = 0; i < sim_allow_size; i++)
+    {
+        uint8_t uid[7] = {0x04};
+        for (int b = 1; b < sizeof(uid); b++)
+        {
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            uid[b] = x;
+        }
+        if (allow_add(uid, sizeof(uid)) != ESP_OK)
+        {
+            printf("SIM: allow-list full after %d tags\n", i);
+            break;
+        }
+    }
+}
+
+static void sim_ledc_init(void)
+{ // Same PWM setup as lv_controller.c, one channel per bay on timer 0
+    ledc_timer_config_t ledc_timer = {
+        .speed_mode = LEDC_MODE,
+        .timer_num = LEDC_TIMER_0,
+        .duty_resolution = LEDC_TIMER_10_BIT,
+        .freq_hz = 1000,
+        .clk_cfg = LEDC_AUTO_CLK};
+    ESP_ERROR_CHECK(ledc_timer_config(&ledc_timer));
+    for (int i = 0; i < NUM_BAYS; i++)
+    {
+        ledc_channel_config_t ledc_channel = {
+            .speed_mode = LEDC_MODE,
+            .channel = bays[i].cfg->motor_channel,
+            .timer_sel = LEDC_TIMER_0,
+            .intr_type = LEDC_INTR_DISABLE,
+            .gpio_num = bays[i].cfg->pwm_gpio,
+            .duty = 0,
+            .hpoint = 0};
+        ESP_ERROR_CHECK(ledc_channel_config(&ledc_channel));
+    }
+}
+
+static void sim_app_main(void *params)
+{ // Mirrors app_main without the console
+    struct plant_config pc = PLANT_DEFAULT_CONFIG;
+    struct timespec wall_start, wall_end;
+
+    init_trace();
+    init_bays();
+    for (int i = 0; i < NUM_BAYS; i++)
+    {
+        const struct bay_config *w = bays[i].cfg;
+        for (int sw = 0; sw < NUM_LIM_SWITCHES; sw++)
+        {
+            gpio_set_direction(w->lim_gpio[sw], GPIO_MODE_INPUT);
+            gpio_set_intr_type(w->lim_gpio[sw], GPIO_INTR_ANYEDGE);
+        }
+        gpio_set_direction(w->en_gpio, GPIO_MODE_OUTPUT);
+        gpio_set_direction(w->di_gpio, GPIO_MODE_OUTPUT);
+        gpio_set_direction(w->dir_gpio, GPIO_MODE_OUTPUT);
+        plant_init(i, w, &pc);
+        pn532_emu_init(w->nfc_uart);
+        pn532_emu_set_max_baud(w->nfc_uart, sim_max_baud);
+    }
+    init_actuators();
+
+    init_ring_light();
+    sim_ledc_init();
+    init_motion_profile();
+    init_solenoid();
+    init_sled_estimator();
+    init_bay_journal();
+    init_stats();
+    init_allow_list();
+    sim_allow_list();
+    init_limit_switches();
+    init_state_machine();
+    init_cycle();
+    for (int i = 0; i < NUM_BAYS && sim_manual; i++)
+    {
+        char index[4];
+        snprintf(index, sizeof(index), "%d", i);
+        char *off[] = {"cycle", "off", index};
+        cycle_comm(3, off);
+    }
+    sm_set_observer(sim_observer);
+
+    xTaskCreate(plant_task, "plant", 4096, NULL, configMAX_PRIORITIES - 2, NULL);
+    for (int i = 0; i < NUM_BAYS; i++)
+        xTaskCreate(read_single_nfc_tag, "nfc_module", 4096, &bays[i], 5, NULL);
+    vTaskDelay(1000); // Let the PN532s come up
+
+    clock_gettime(CLOCK_MONOTONIC, &wall_start);
+    for (int i = 0; i < NUM_BAYS; i++)
+    {
+        struct sim_bay *sb = &sim_bays[i];
+        sb->bay = &bays[i];
+        memcpy(sb->uid, sim_uid, sizeof(sb->uid));
+        sb->uid[sizeof(sb->uid) - 1] += i; // A different customer at each bay
+        allow_add(sb->uid, sizeof(sb->uid));
+        memcpy(sb->stranger, sb->uid, sizeof(sb->stranger));
+        sb->stranger[1] ^= 0x5A; // On the allow-list too, only the owner check stands in the way
+        allow_add(sb->stranger, sizeof(sb->stranger));
+        xTaskCreate(cycle_task, "sim_cycle", 8192, sb, 2, NULL);
+    }
+    bool ok = true;
+    for (int i = 0; i < NUM_BAYS; i++)
+    {
+        int index;
+        xQueueReceive(sim_finished, &index, portMAX_DELAY);
+        ok &= sim_bays[index].done == sim_cycles;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &wall_end);
+    report((wall_end.tv_sec - wall_start.tv_sec) + (wall_end.tv_nsec - wall_start.tv_nsec) / 1e9);
+    fflush(stdout);
+    exit(ok ? 0 : 1);
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "n:c:a:b:mv")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            sim_cycles = atoi(optarg);
+            break;
+        case 'c':
+            sim_charge_ms = atoi(optarg) * 1000;
+            break;
+        case 'a':
+            sim_allow_size = atoi(optarg);
+            break;
+        case 'b':
+            sim_max_baud = atoi(optarg);
+            break;
+        case 'm':
+            sim_manual = true;
+            break;
+        case 'v':
+            sim_log_level = sim_log_level < ESP_LOG_VERBOSE ? sim_log_level + 1 : sim_log_level;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-n cycles] [-c charge seconds] [-a allow-list size] [-b noisy above baud] [-m] [-v]...\n", argv[0]);
+            return 2;
+        }
+    }
+    for (int i = 0; i < NUM_BAYS; i++)
+        sim_bays[i].events = xQueueCreate(8, sizeof(struct sim_event));
+    sim_finished = xQueueCreate(NUM_BAYS, sizeof(int));
+    xTaskCreate(sim_app_main, "sim_main", 8192, NULL, 2, NULL);
+    vTaskStartScheduler();
+    return 1;
+}
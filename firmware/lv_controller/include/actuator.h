@@ -0,0 +1,45 @@
+#ifndef ACTUATOR_H
+#define ACTUATOR_H
+
+#include <stdint.h>
+
+#include "esp_bit_defs.h"
+
+// Outputs in a bay's actuator command word
+enum act_out
+{
+    ACT_DIR, // High drives the sled out
+    ACT_EN,  // L9958 enable
+    ACT_DI,  // L9958 disable, outputs are off while high
+    NUM_ACT_OUTS
+};
+
+#define ACT_DIR_BIT BIT(ACT_DIR)
+#define ACT_EN_BIT BIT(ACT_EN)
+#define ACT_DI_BIT BIT(ACT_DI)
+
+// Motor words, written over ACT_MOTOR_BITS in one go
+#define ACT_MOTOR_BITS (ACT_DIR_BIT | ACT_EN_BIT | ACT_DI_BIT)
+#define ACT_MOTOR_OUT (ACT_DIR_BIT | ACT_EN_BIT)
+#define ACT_MOTOR_IN ACT_EN_BIT
+#define ACT_MOTOR_OFF ACT_DI_BIT // Direction is left low, it does not matter with the outputs off
+
+#define ACT_DUTY_KEEP -1
+
+struct act_cmd
+{
+    uint32_t mask;     // Outputs this command drives, the others keep their level
+    uint32_t bits;     // New levels for the outputs in mask
+    int motor_duty;    // Percent, staged before the output write and latched right after, or ACT_DUTY_KEEP
+    int solenoid_duty; // Same for the solenoid channel
+};
+
+#define ACT_CMD(m, b) {.mask = (m), .bits = (b), .motor_duty = ACT_DUTY_KEEP, .solenoid_duty = ACT_DUTY_KEEP}
+
+struct bay;
+
+void init_actuators(void);
+void act_apply(struct bay *bay, const struct act_cmd *cmd);
+void act_apply_from_isr(struct bay *bay, uint32_t mask, uint32_t bits);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef ALLOW_LIST_H
+#define ALLOW_LIST_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "esp_err.h"
+
+#include "bay.h"
+
+// Tags allowed to claim a vacant bay, an open addressed hash table in its own data partition, read through the
+// flash cache. Adds only program erased slots and deletes only clear bits, so the list takes console updates
+// without erasing. A Bloom filter in RAM turns most unknown tags away without touching flash
+#define ALLOW_PARTITION "allowlist"
+#define ALLOW_PARTITION_SUBTYPE 0x40 // Custom data subtype, see partitions.csv
+#define ALLOW_MAGIC 0x574C4C41       // "ALLW"
+#define ALLOW_VERSION 1
+#define ALLOW_HEADER_SIZE 4096       // First sector, the slots start on the next
+#define ALLOW_MAX_LOAD 75            // Percent of slots used, live or deleted, before adds are refused
+#define ALLOW_BLOOM_BITS (1 << 18)   // 32 KB, about 3% false positives at 37k tags
+#define ALLOW_BLOOM_HASHES 5
+
+enum allow_state
+{
+    ALLOW_EMPTY = 0xFF, // Erased flash
+    ALLOW_LIVE = 0x0F,
+    ALLOW_DEAD = 0x00, // Deleted, probes go past it and it is only reused after 'allow clear'
+};
+
+struct allow_header
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t rec_size;
+    uint32_t slots;
+};
+
+// One slot, 16 bytes so a record never straddles a flash page
+struct allow_rec
+{
+    uint8_t state; // enum allow_state
+    uint8_t len;
+    uint8_t uid[BAY_UID_LEN];
+    uint32_t hash; // Of the UID, compared before the bytes
+};
+
+void init_allow_list(void);
+bool allow_check(const uint8_t *uid, uint8_t len); // True if the tag may claim a bay, always without the partition
+esp_err_t allow_add(const uint8_t *uid, uint8_t len);
+esp_err_t allow_del(const uint8_t *uid, uint8_t len);
+int allow_comm(int argc, char **argv);
+
+#endif
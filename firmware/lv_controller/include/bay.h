@@ -0,0 +1,95 @@
+#ifndef BAY_H
+#define BAY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/event_groups.h"
+#include "driver/gpio.h"
+#include "driver/ledc.h"
+#include "esp_timer.h"
+#include "pn532.h"
+
+// Bays driven by this controller, each needs its own motor channel, switches, solenoid, ring light and PN532
+#ifndef NUM_BAYS
+#define NUM_BAYS 1
+#endif
+#define MAX_BAYS 2 // The S2 has two UARTs for PN532 readers, the console is on USB
+#define BAY_NUM_LIM 4
+#define BAY_UID_LEN 10
+
+// Module state that only its own file touches, allocated by that module's init
+struct sled_est;
+struct ring_light;
+struct solenoid;
+struct motor_monitor;
+struct cycle;
+
+// Board wiring for one bay
+struct bay_config
+{
+    gpio_num_t en_gpio;
+    gpio_num_t di_gpio;
+    gpio_num_t pwm_gpio;
+    gpio_num_t dir_gpio;
+    ledc_channel_t motor_channel;        // On LEDC_TIMER_0 with every other bay's motor
+    gpio_num_t lim_gpio[BAY_NUM_LIM];    // LIM1 sled out, LIM2 unused, LIM3 sled in, LIM4 door closed
+    uint16_t lim_debounce_ms[BAY_NUM_LIM];
+    gpio_num_t solenoid_gpio;
+    ledc_channel_t solenoid_channel;     // On SOLENOID_LEDC_TIMER with every other bay's solenoid
+    gpio_num_t ring_light_gpio;
+    int nfc_uart;
+    int nfc_tx;
+    int nfc_rx;
+    int l9958_cs;                        // -1 if the bay has no L9958
+};
+
+struct bay
+{
+    int index;
+    const struct bay_config *cfg;
+
+    // State machine
+    int state; // enum states, private to state_machine.c
+    QueueHandle_t sm_queue;
+    QueueHandle_t sm_light_queue; // Light lane ops for the bay's light worker
+    QueueHandle_t sm_light_done;  // Light lane ops the engine joins on
+    volatile int64_t tap_us;      // Accepted tag read waiting for the transition it triggers, 0 for none
+
+    // Limit switches
+    atomic_uint lim_levels; // Bit set = switch reads high (released), updated by the ISR on every edge
+    int lim_state[BAY_NUM_LIM];
+    int64_t lim_last_edge_us[BAY_NUM_LIM];
+    EventGroupHandle_t lim_events;
+
+    // Sled motor
+    volatile int reflex_sw; // End switch the sled is driving towards, -1 for none
+    volatile uint32_t reflex_count;
+    volatile bool sled_moving;
+    esp_timer_handle_t approach_timer;
+
+    // NFC
+    pn532_t *nfc_reader;
+    int nfc_next_state; // enum nfc_states, private to nfc_module.c
+    volatile bool nfc_pending;
+    uint8_t uid[BAY_UID_LEN];
+    uint8_t uid_len;
+
+    struct sled_est *est;
+    struct ring_light *ring;
+    struct solenoid *sol;
+    struct motor_monitor *mon;
+    struct cycle *cycle;
+};
+
+extern struct bay bays[NUM_BAYS];
+
+void init_bays(void);
+struct bay *get_bay(int index);
+struct bay *bay_from_arg(int argc, char **argv, int i);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef BAY_JOURNAL_H
+#define BAY_JOURNAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "bay.h"
+
+#define BAY_JOURNAL_NVS_NAMESPACE "journal"
+#define BAY_JOURNAL_NVS_KEY "bay" // Bay index appended
+#define BAY_JOURNAL_VERSION 1
+// Commits inside this window go out as one NVS write, covers the to_closed -> to_compvision chain
+#define BAY_JOURNAL_BATCH_MS 250
+
+// What a bay needs to pick up where it left off after a reset
+struct bay_journal_rec
+{
+    uint32_t seq;     // Bumped on every write
+    uint8_t version;
+    int8_t state;     // enum states in state_machine.c
+    int8_t nfc_state; // enum nfc_states in nfc_module.c
+    uint8_t uid_len;
+    uint8_t uid[BAY_UID_LEN];
+};
+
+void init_bay_journal(void);
+bool bay_journal_restore(struct bay *bay, int num_states, int num_nfc_states);
+void bay_journal_commit(struct bay *bay);
+int journal_comm(int argc, char **argv);
+
+#endif
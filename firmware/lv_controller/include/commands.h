@@ -5,6 +5,7 @@
 #include "driver/ledc.h"
 #include "driver/gpio.h"
 
+// Bay 0 motor pins, see bay.c for the rest
 #define EN_GPIO GPIO_NUM_1
 #define DI_GPIO GPIO_NUM_2
 #define PWM_GPIO GPIO_NUM_3
@@ -12,7 +13,6 @@
 
 #define LEDC_GPIO PWM_GPIO
 #define LEDC_MODE LEDC_LOW_SPEED_MODE
-#define LEDC_CHANNEL LEDC_CHANNEL_0
 
 int calc_bits_from_duty(int duty);
 
@@ -0,0 +1,28 @@
+#ifndef CYCLE_H
+#define CYCLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define CYCLE_AUTO_DEFAULT true // Bays run the cycle script from boot, 'cycle off' hands taps back to the NFC sequence
+
+// External events a cycle script can block on
+enum cycle_gate
+{
+    CG_TAP,           // Owner's tag on the reader, only counts while the script is waiting for it
+    CG_CHARGER_ON,    // BBB: bike located, gantry aligned and the charger delivering power
+    CG_CHARGER_CLEAR, // BBB: charging stopped and gantry parked
+    NUM_CYCLE_GATES
+};
+
+struct bay;
+
+void init_cycle(void);
+bool cycle_active(struct bay *bay);
+bool cycle_tap(struct bay *bay, uint8_t uid[], uint8_t uidLength);
+int cycle_post_gate(struct bay *bay, enum cycle_gate g);
+bool cycle_gate_posted(struct bay *bay, enum cycle_gate g);
+int cycle_comm(int argc, char **argv);
+int gate_comm(int argc, char **argv);
+
+#endif
@@ -1,21 +1,72 @@
 #ifndef LIMIT_SWITCHES_H
 #define LIMIT_SWITCHES_H
 
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
 #include "driver/gpio.h"
 
+// Bay 0 switch pins, see bay.c for the rest
 #define LIM1_GPIO GPIO_NUM_13
 #define LIM2_GPIO GPIO_NUM_14
 #define LIM3_GPIO GPIO_NUM_15
 #define LIM4_GPIO GPIO_NUM_16
 
-extern int LIM1_state;
-extern int LIM2_state;
-extern int LIM3_state;
-extern int LIM4_state;
+// Switch index within a bay's switch set
+enum lim_switch
+{
+    LIM1, // Sled out
+    LIM2, // Unused
+    LIM3, // Sled in
+    LIM4, // Door closed
+    NUM_LIM_SWITCHES
+};
+
+// One bit per switch, used for level snapshots, waits and event group bits
+#define LIM1_BIT BIT(LIM1)
+#define LIM2_BIT BIT(LIM2)
+#define LIM3_BIT BIT(LIM3)
+#define LIM4_BIT BIT(LIM4)
+#define LIM_ALL_BITS (LIM1_BIT | LIM2_BIT | LIM3_BIT | LIM4_BIT)
+#define LIM_SLED_BITS (LIM1_BIT | LIM3_BIT)
+#define LIM_ABORT_BIT BIT4 // Motor fault, fails waits on a sled switch until the motor is next started
+
+#define LIM_EVT_RING_LEN 32 // Must be a power of 2
+// Re-sample the pins at least this often while waiting in case an edge was missed
+#define LIM_RECHECK_MS 1000
+
+// Debounce windows, the first edge goes through and any edge inside the window after it counts as bounce
+#define LIM_DEBOUNCE_END_MS 5   // Sled end switches
+#define LIM_DEBOUNCE_DOOR_MS 20 // Door switch rattles when the door is slammed
+
+// Switch wear, lifetime presses and bounces per switch live in NVS
+#define LIM_WEAR_NVS_NAMESPACE "lim"
+#define LIM_WEAR_NVS_KEY "wear" // Bay index appended
+#define LIM_WEAR_SAVE_PERIOD_MS (10 * 60 * 1000)
+#define LIM_RATED_ACTUATIONS 1000000 // Mechanical life of the microswitches
+
+struct lim_switch_event
+{
+    int64_t time_us; // esp_timer time the ISR ran
+    uint8_t pin;
+    uint8_t bay;
+    uint8_t sw; // enum lim_switch
+    uint8_t level;
+    uint8_t reflex; // Sled motor was stopped by the ISR
+};
+
+struct bay;
 
 void init_limit_switches(void);
 static void IRAM_ATTR gpio_interrupt_handler(void *args);
 void lim_switch_read(void *params);
 int get_lim_switch_curr_value(int pinNumber);
+uint32_t get_lim_switch_levels(struct bay *bay);
+int64_t get_lim_switch_last_edge_us(struct bay *bay, int sw);
+int wait_for_switch(struct bay *bay, uint32_t mask, int level, int timeout_ms);
+void abort_switch_waits(struct bay *bay);
+void arm_switch_waits(struct bay *bay);
+int lim_comm(int argc, char **argv);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,31 @@
+#ifndef MOTION_PROFILE_H
+#define MOTION_PROFILE_H
+
+// Default trapezoid for the sled motor, duties in %
+#define PROFILE_ACCEL_MS 250
+#define PROFILE_CRUISE_DUTY 100
+#define PROFILE_CRUISE_MS 0 // 0 = cruise until the end switch, no approach phase
+#define PROFILE_DECEL_MS 200
+#define PROFILE_APPROACH_DUTY 40
+
+struct bay;
+
+// Shared by every bay
+struct motion_profile
+{
+    int accel_ms;      // Ramp from 0 to cruise
+    int cruise_duty;
+    int cruise_ms;     // Time at cruise before slowing for the end of travel, 0 leaves it to the sled estimator
+    int decel_ms;      // Ramp from cruise down to approach
+    int approach_duty; // Creep speed into the limit switch
+};
+
+void init_motion_profile(void);
+void motion_profile_start(struct bay *bay);
+void motion_profile_approach(struct bay *bay);
+void motion_profile_stop(struct bay *bay);
+void set_motion_profile(const struct motion_profile *profile);
+void get_motion_profile(struct motion_profile *profile);
+int set_profile_comm(int argc, char **argv);
+
+#endif
@@ -1,8 +1,16 @@
 #ifndef MOTOR_H
 #define MOTOR_H
 
-void sled_out(void);
-void sled_in(void);
-void stop_sled(void);
+#include <stdbool.h>
+#include <stdint.h>
 
-#endif
\ No newline at end of file
+struct bay;
+
+void sled_out(struct bay *bay);
+void sled_in(struct bay *bay);
+void stop_sled(struct bay *bay);
+bool sled_reflex_from_isr(struct bay *bay, int sw, int level);
+uint32_t get_sled_reflex_count(struct bay *bay);
+bool is_sled_moving(struct bay *bay);
+
+#endif
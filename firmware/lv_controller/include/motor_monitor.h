@@ -0,0 +1,15 @@
+#ifndef MOTOR_MONITOR_H
+#define MOTOR_MONITOR_H
+
+#include "driver/spi_master.h"
+
+#define MONITOR_MOVING_PERIOD_MS 10
+#define MONITOR_IDLE_PERIOD_MS 500
+#define MONITOR_STALL_MS 200     // Current limited this long while moving = jammed
+#define MONITOR_OPEN_LOAD_MS 100 // Open load this long while moving = motor disconnected
+
+void init_motor_monitor(spi_host_device_t host);
+void motor_monitor(void *params);
+int motor_diag_comm(int argc, char **argv);
+
+#endif
@@ -3,14 +3,24 @@
 
 #include "pn532.h"
 
-// NFC reader global pointer
-extern pn532_t *nfc_reader;
+#define NFC_ACTIVE_MS 20000           // Polled fast for this long after any tap, the customer's next one may follow
+#define NFC_IDLE_MS 300000            // Nothing tapped and no state change for this long, fast drops to normal and slow to idle
+#define NFC_LOWPOWER_MAX_ERRORS 3     // In a row before leaving the PN532 powered and using InAutoPoll
+#define NFC_AUTOPOLL_WAIT_MS 1000     // Longest the reader task sleeps on the UART before waiting again
+#define NFC_AUTOPOLL_MAX_ERRORS 3     // In a row before falling back to polling with InListPassiveTarget
+#define NFC_PRESENCE_MS 100           // Between checks that a detected tag is still held to the reader
+#define NFC_REMOVED_MISSES 2          // Empty checks in a row before the tag counts as taken away
+#define NFC_PRESENCE_MAX_ERRORS 3     // Reader errors in a row before the tracker gives up and re-arms
+#define NFC_NUM_STATES 8              // enum nfc_states in nfc_module.c, range checked when the journal is restored
 
-int init_nfc_reader(void);
-void read_single_nfc_tag(void *);
-void nfc_state_machine(uint8_t uid[], uint8_t uidLength);
-int new_tag(uint8_t uid[], uint8_t uidLength);
-int check_tag(uint8_t uid[], uint8_t uidLength);
-void delete_tag(void);
+struct bay;
+
+int init_nfc_reader(struct bay *bay);
+void read_single_nfc_tag(void *params);
+void nfc_state_machine(struct bay *bay, uint8_t uid[], uint8_t uidLength);
+int new_tag(struct bay *bay, uint8_t uid[], uint8_t uidLength);
+int check_tag(struct bay *bay, uint8_t uid[], uint8_t uidLength);
+void delete_tag(struct bay *bay);
+int nfc_comm(int argc, char **argv);
 
 #endif
\ No newline at end of file
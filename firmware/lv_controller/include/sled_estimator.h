@@ -0,0 +1,32 @@
+#ifndef SLED_ESTIMATOR_H
+#define SLED_ESTIMATOR_H
+
+#include <stdint.h>
+
+#define SLED_DIR_IN 0  // Towards LIM3
+#define SLED_DIR_OUT 1 // Towards LIM1
+
+#define SLED_EST_PERIOD_MS 10
+#define SLED_EST_DUTY_BUCKETS 11     // Cruise duty learned in 10% steps
+#define SLED_EST_ZONE_PERMILLE 150   // Start the approach this far (of full travel) before the switch
+#define SLED_EST_OVERRUN_PERCENT 130 // Flag moves slower than this much of the learned time
+#define SLED_EST_NVS_NAMESPACE "sled_est"
+#define SLED_EST_NVS_KEY "travel" // Bay 0, later bays append their index
+
+struct sled_travel
+{
+    uint32_t duty_ms; // Integral of duty (%) over a full end to end move
+    uint32_t time_ms; // Wall time of a full end to end move
+    uint16_t count;   // Moves learned, 0 = nothing known yet
+};
+
+struct bay;
+
+void init_sled_estimator(void);
+void sled_estimator_start(struct bay *bay, int dir);
+void sled_estimator_arrived(struct bay *bay, int sw, int64_t time_us);
+void sled_estimator_stop(struct bay *bay);
+int sled_estimator_position(struct bay *bay);
+int sled_est_comm(int argc, char **argv);
+
+#endif
@@ -1,11 +1,26 @@
 #ifndef SOLENOID_H
 #define SOLENOID_H
 
+#include <stdbool.h>
+
 #include "driver/gpio.h"
+#include "driver/ledc.h"
+
+#define SOLENOID_GPIO GPIO_NUM_38 // Bay 0
+
+// Peak-and-hold drive on its own LEDC timer, the motors use timer 0. Every bay's solenoid channel shares it
+#define SOLENOID_LEDC_TIMER LEDC_TIMER_1
+#define SOLENOID_LEDC_CHANNEL LEDC_CHANNEL_1 // Bay 0
+#define SOLENOID_PWM_FREQ_HZ 20000 // Above hearing so the solenoid doesn't whine while holding
+#define SOLENOID_PULL_IN_MS 250    // Full current until the bolt has pulled in
+#define SOLENOID_HOLD_DUTY 30      // Percent, enough to keep the bolt held
+#define SOLENOID_RELOCK_MS 120000  // Lock again if nothing locked it first (door never opened)
 
-#define SOLENOID_GPIO GPIO_NUM_38
+struct bay;
 
-void lock_solenoid(void);
-void unlock_solenoid(void);
+void init_solenoid(void);
+void lock_solenoid(struct bay *bay);
+void unlock_solenoid(struct bay *bay);
+bool is_solenoid_unlocked(struct bay *bay);
 
-#endif
\ No newline at end of file
+#endif
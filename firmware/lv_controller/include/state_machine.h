@@ -1,13 +1,60 @@
 #ifndef STATE_MACHINE_H
 #define STATE_MACHINE_H
 
-int to_unlockedem(void);
-int to_loading(void);
-int to_closed(void);
-int to_compvision(void);
-int to_charging(void);
-int to_unlocked(void);
-int to_unloading(void);
-int to_empty(void);
-
-#endif
\ No newline at end of file
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SM_REQUEST_QUEUE_LEN 4
+#define SM_LIGHT_QUEUE_LEN 16
+#define SM_LIGHT_JOIN_TIMEOUT_MS 1000 // A stuck light op is logged and the transition carries on
+
+// Default per-step deadlines, a stuck switch fails the transition after this long
+#define SM_SLED_TIMEOUT_MS 20000
+#define SM_DOOR_TIMEOUT_MS 120000
+
+// Transition results
+#define SM_OK 0
+#define SM_ERR_STATE 1   // Not allowed from the current state
+#define SM_ERR_TIMEOUT 2 // A step missed its deadline, actuators were made safe
+#define SM_ERR_BUSY 3    // Request queue full
+#define SM_ERR_FAULT 4   // Motor driver fault during a step, actuators were made safe
+
+enum transitions
+{
+    T_UNLOCKEDEM,
+    T_LOADING,
+    T_CLOSED,
+    T_COMPVISION,
+    T_CHARGING,
+    T_UNLOCKED,
+    T_UNLOADING,
+    T_EMPTY,
+    NUM_TRANSITIONS
+};
+
+struct bay;
+
+// Called from the bay's state machine task once a requested transition finishes
+typedef void (*sm_done_cb_t)(struct bay *bay, enum transitions t, int result, void *arg);
+// Called from the bay's state machine task after every transition, whoever requested it
+typedef void (*sm_observer_t)(struct bay *bay, enum transitions t, int result, int64_t total_us);
+
+void init_state_machine(void);
+void state_machine(void *params);
+int sm_request(struct bay *bay, enum transitions t, int step_deadline_ms, sm_done_cb_t cb, void *arg);
+void sm_print_banner(struct bay *bay, const char *banner);
+const char *sm_transition_name(enum transitions t);
+bool sm_transition_allowed(struct bay *bay, enum transitions t);
+void sm_set_observer(sm_observer_t cb);
+
+// Non-blocking, queue the transition with default deadlines
+int to_unlockedem(struct bay *bay);
+int to_loading(struct bay *bay);
+int to_closed(struct bay *bay);
+int to_compvision(struct bay *bay);
+int to_charging(struct bay *bay);
+int to_unlocked(struct bay *bay);
+int to_unloading(struct bay *bay);
+int to_empty(struct bay *bay);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+
+#include "state_machine.h"
+
+#define STATS_NVS_NAMESPACE "stats"
+#define STATS_NVS_KEY "hist" // Bay index appended
+#define STATS_SAVE_PERIOD_MS (10 * 60 * 1000) // Snapshot to NVS this often if anything was recorded
+
+// Log scale buckets, two per octave from 128 us to 268 s, plus one under and one over
+#define STATS_MIN_SHIFT 7
+#define STATS_OCTAVES 21
+#define STATS_NUM_BUCKETS (2 * STATS_OCTAVES + 2)
+
+// One histogram per transition, then the rest
+enum stat_id
+{
+    STAT_SLED_OUT = NUM_TRANSITIONS, // sled_out() to LIM1
+    STAT_SLED_IN,                    // sled_in() to LIM3
+    STAT_NFC,                        // Accepted tag read to the start of the transition it triggered
+    STAT_DOOR_OPEN,                  // Waiting for LIM4 to release
+    STAT_DOOR_CLOSE,                 // Waiting for LIM4 to press
+    NUM_STATS
+};
+
+struct stats_hist
+{
+    uint32_t count;
+    uint32_t max_us;
+    uint64_t sum_us;
+    uint32_t buckets[STATS_NUM_BUCKETS];
+};
+
+struct bay;
+
+void init_stats(void);
+void stats_record(struct bay *bay, int id, int64_t us);
+int stats_comm(int argc, char **argv);
+
+#endif
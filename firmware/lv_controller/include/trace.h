@@ -0,0 +1,62 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#include "esp_attr.h"
+
+// Set to 0 to compile every TRACE() out
+#ifndef TRACE_ENABLED
+#define TRACE_ENABLED 1
+#endif
+
+#define TRACE_RING_LEN 512 // Records, must be a power of 2
+#define TRACE_DRAIN_MS 50
+
+// Fixed 16 byte record, dumped as hex and decoded on the host by tools/trace_decode.py
+struct trace_record
+{
+    uint32_t time_us; // Low 32 bits of esp_timer time, the decoder unwraps it
+    uint16_t id;      // enum trace_event, bay index in the high byte
+    uint16_t seq;     // Low 16 bits of the record index + 1, written last so torn records can be spotted
+    int32_t a0;
+    int32_t a1;
+};
+
+// Keep the values stable and the comments as "a0: ..., a1: ..." - the decoder reads them from this file
+enum trace_event
+{
+    TR_NONE = 0x00,
+    TR_LIM_EDGE = 0x01,     // a0: gpio, a1: level
+    TR_LIM_REFLEX = 0x02,   // a0: gpio, a1: -
+    TR_SLED_OUT = 0x10,     // a0: -, a1: -
+    TR_SLED_IN = 0x11,      // a0: -, a1: -
+    TR_SLED_STOP = 0x12,    // a0: -, a1: -
+    TR_PWM_DUTY = 0x13,     // a0: duty %, a1: duty bits
+    TR_APPROACH = 0x14,     // a0: approach duty %, a1: estimated position permille
+    TR_MOTOR_FAULT = 0x15,  // a0: diag word, a1: -
+    TR_ACT_WORD = 0x16,     // a0: actuator outputs written, a1: their levels
+    TR_SOL_UNLOCK = 0x20,   // a0: -, a1: -
+    TR_SOL_HOLD = 0x21,     // a0: hold duty %, a1: -
+    TR_SOL_LOCK = 0x22,     // a0: -, a1: -
+    TR_LED_MODE = 0x30,     // a0: 0 off / 1 white / 2 rainbow / 3 heartbeat, a1: -
+    TR_SM_START = 0x40,     // a0: transition, a1: state
+    TR_SM_WAIT = 0x41,      // a0: gpio, a1: level
+    TR_SM_WAIT_DONE = 0x42, // a0: gpio, a1: waited us or error
+    TR_SM_DONE = 0x43,      // a0: transition, a1: total us or -error
+    TR_SM_LIGHT = 0x44,     // a0: transition, a1: op index, light lane op starting
+};
+
+#if TRACE_ENABLED
+#define TRACE(id, a0, a1) trace_emit((id), (int32_t)(a0), (int32_t)(a1))
+#else
+#define TRACE(id, a0, a1) ((void)0)
+#endif
+#define TRACE_BAY(bay, id, a0, a1) TRACE(((bay) << 8) | (id), a0, a1)
+
+void init_trace(void);
+void IRAM_ATTR trace_emit(uint16_t id, int32_t a0, int32_t a1);
+void trace_drain(void *params);
+int trace_comm(int argc, char **argv);
+
+#endif
@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "driver/gpio.h"
+#include "driver/ledc.h"
+#include "soc/gpio_struct.h"
+#include "esp_attr.h"
+
+#include "bay.h"
+#include "actuator.h"
+#include "commands.h"
+#include "trace.h"
+
+#define ACT_WORDS BIT(NUM_ACT_OUTS)
+
+// Output register masks for every combination of outputs, bank 0 is GPIO 0-31, bank 1 is GPIO 32 and up
+struct act_map
+{
+    uint32_t pins[ACT_WORDS][2];
+};
+
+/* GLOBALS */
+static struct act_map act_maps[NUM_BAYS];
+
+static gpio_num_t out_gpio(const struct bay_config *cfg, int out)
+{
+    switch (out)
+    {
+    case ACT_DIR:
+        return cfg->dir_gpio;
+    case ACT_EN:
+        return cfg->en_gpio;
+    default:
+        return cfg->di_gpio;
+    }
+}
+
+void init_actuators(void)
+{ // After init_GPIO, the pins are already outputs
+    for (int i = 0; i < NUM_BAYS; i++)
+    {
+        struct act_map *map = &act_maps[i];
+        memset(map, 0, sizeof(*map));
+        for (int w = 0; w < ACT_WORDS; w++)
+        {
+            for (int out = 0; out < NUM_ACT_OUTS; out++)
+            {
+                if (!(w & BIT(out)))
+                    continue;
+                gpio_num_t pin = out_gpio(bays[i].cfg, out);
+                map->pins[w][pin / 32] |= BIT(pin % 32);
+            }
+        }
+    }
+}
+
+static inline void IRAM_ATTR write_outputs(const struct act_map *map, uint32_t mask, uint32_t bits)
+{ // Write-1-to-set/clear registers, nothing is read back so no lock is needed. Clears go first, the L9958 is off in between
+    const uint32_t *set = map->pins[mask & bits];
+    const uint32_t *clr = map->pins[mask & ~bits];
+    if (clr[0])
+        GPIO.out_w1tc = clr[0];
+    if (clr[1])
+        GPIO.out1_w1tc.val = clr[1];
+    if (set[0])
+        GPIO.out_w1ts = set[0];
+    if (set[1])
+        GPIO.out1_w1ts.val = set[1];
+}
+
+void act_apply(struct bay *bay, const struct act_cmd *cmd)
+{ // Duty registers are staged first so the new PWM latches with the outputs instead of a cycle before them
+    const struct bay_config *cfg = bay->cfg;
+    if (cmd->motor_duty != ACT_DUTY_KEEP)
+        ESP_ERROR_CHECK(ledc_set_duty(LEDC_MODE, cfg->motor_channel, calc_bits_from_duty(cmd->motor_duty)));
+    if (cmd->solenoid_duty != ACT_DUTY_KEEP)
+        ESP_ERROR_CHECK(ledc_set_duty(LEDC_MODE, cfg->solenoid_channel, cmd->solenoid_duty * 1023 / 100));
+
+    uint32_t mask = cmd->mask & (ACT_WORDS - 1);
+    if (mask)
+    {
+        write_outputs(&act_maps[bay->index], mask, cmd->bits);
+        TRACE_BAY(bay->index, TR_ACT_WORD, mask, cmd->bits & mask);
+    }
+
+    if (cmd->motor_duty != ACT_DUTY_KEEP)
+        ESP_ERROR_CHECK(ledc_update_duty(LEDC_MODE, cfg->motor_channel));
+    if (cmd->solenoid_duty != ACT_DUTY_KEEP)
+        ESP_ERROR_CHECK(ledc_update_duty(LEDC_MODE, cfg->solenoid_channel));
+}
+
+void IRAM_ATTR act_apply_from_isr(struct bay *bay, uint32_t mask, uint32_t bits)
+{ // Outputs only, the LEDC driver is not ISR safe
+    write_outputs(&act_maps[bay->index], mask & (ACT_WORDS - 1), bits);
+}
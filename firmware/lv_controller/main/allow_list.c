@@ -0,0 +1,337 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <ctype.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_partition.h"
+#include "esp_bit_defs.h"
+
+#include "allow_list.h"
+
+struct allow_list
+{
+    const esp_partition_t *part; // NULL if the partition table has none, every tag is allowed
+    esp_partition_mmap_handle_t map;
+    const struct allow_rec *slots; // Mapped, reads go through the flash cache
+    uint32_t nslots;
+    bool foreign; // Header not blank and not ours, every tag is refused until 'allow clear'
+    uint32_t live;
+    uint32_t dead;
+    SemaphoreHandle_t lock;
+    // Lookups since boot
+    uint32_t lookups;
+    uint32_t filtered; // Turned away by the Bloom filter alone
+    uint32_t probes;   // Slots read from flash by lookups
+    uint32_t reads;    // Slots read from flash by anything
+    uint64_t sum_us;
+    uint32_t max_us;
+};
+
+/* GLOBALS */
+static const char *TAG = "allow_list";
+static struct allow_list allow_ctx;
+static uint32_t bloom[ALLOW_BLOOM_BITS / 32];
+
+static uint32_t uid_hash(const uint8_t *uid, uint8_t len)
+{ // FNV-1a over the length and the UID
+    uint32_t h = 2166136261u;
+    h = (h ^ len) * 16777619u;
+    for (int i = 0; i < len; i++)
+        h = (h ^ uid[i]) * 16777619u;
+    return h;
+}
+
+static uint32_t bloom_step(uint32_t h)
+{ // Second hash for double hashing, odd so it never sticks on one bit
+    h ^= h >> 16;
+    h *= 0x85EBCA6B;
+    h ^= h >> 13;
+    return h | 1;
+}
+
+static void bloom_set(uint32_t h)
+{
+    uint32_t step = bloom_step(h);
+    for (int i = 0; i < ALLOW_BLOOM_HASHES; i++, h += step)
+        bloom[(h % ALLOW_BLOOM_BITS) / 32] |= BIT(h % 32);
+}
+
+static bool bloom_test(uint32_t h)
+{
+    uint32_t step = bloom_step(h);
+    for (int i = 0; i < ALLOW_BLOOM_HASHES; i++, h += step)
+    {
+        if (!(bloom[(h % ALLOW_BLOOM_BITS) / 32] & BIT(h % 32)))
+            return false;
+    }
+    return true;
+}
+
+static int find(const uint8_t *uid, uint8_t len, uint32_t h, uint32_t *empty)
+{ // Slot holding the UID or -1, empty is where it would go. Caller holds the lock
+    struct allow_list *a = &allow_ctx;
+    uint32_t i = h % a->nslots;
+    for (uint32_t n = 0; n < a->nslots; n++, i = i + 1 < a->nslots ? i + 1 : 0)
+    {
+        const struct allow_rec *r = &a->slots[i];
+        a->reads++;
+        if (r->state == ALLOW_EMPTY)
+        {
+            *empty = i;
+            return -1;
+        }
+        if (r->state == ALLOW_LIVE && r->hash == h && r->len == len && !memcmp(r->uid, uid, len))
+            return i;
+    }
+    *empty = a->nslots; // Full of deleted slots
+    return -1;
+}
+
+static size_t slot_offset(uint32_t i)
+{
+    return ALLOW_HEADER_SIZE + i * sizeof(struct allow_rec);
+}
+
+static esp_err_t format(void)
+{
+    struct allow_list *a = &allow_ctx;
+    esp_err_t err = esp_partition_erase_range(a->part, 0, a->part->size);
+    struct allow_header hdr = {
+        .magic = ALLOW_MAGIC,
+        .version = ALLOW_VERSION,
+        .rec_size = sizeof(struct allow_rec),
+        .slots = a->nslots,
+    };
+    if (err == ESP_OK)
+        err = esp_partition_write(a->part, 0, &hdr, sizeof(hdr));
+    a->live = 0;
+    a->dead = 0;
+    a->foreign = err != ESP_OK;
+    memset(bloom, 0, sizeof(bloom));
+    return err;
+}
+
+void init_allow_list(void)
+{ // Maps the partition and fills the Bloom filter from it, formats it only if it was never used
+    struct allow_list *a = &allow_ctx;
+    a->lock = xSemaphoreCreateMutex();
+    a->part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t)ALLOW_PARTITION_SUBTYPE, ALLOW_PARTITION);
+    if (a->part == NULL)
+    {
+        ESP_LOGW(TAG, "No '%s' partition, any tag can claim a bay", ALLOW_PARTITION);
+        return;
+    }
+    const void *ptr;
+    esp_err_t err = esp_partition_mmap(a->part, 0, a->part->size, ESP_PARTITION_MMAP_DATA, &ptr, &a->map);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Allow-list mmap failed: %s, any tag can claim a bay", esp_err_to_name(err));
+        a->part = NULL;
+        return;
+    }
+    a->slots = (const struct allow_rec *)((const uint8_t *)ptr + ALLOW_HEADER_SIZE);
+    a->nslots = (a->part->size - ALLOW_HEADER_SIZE) / sizeof(struct allow_rec);
+
+    const struct allow_header *hdr = ptr;
+    if (hdr->magic != ALLOW_MAGIC || hdr->version != ALLOW_VERSION || hdr->rec_size != sizeof(struct allow_rec) ||
+        hdr->slots != a->nslots)
+    {
+        if (hdr->magic != 0xFFFFFFFF)
+        { // Corrupt, or written by another firmware version. The UIDs may still be there, only an operator wipes them
+            ESP_LOGE(TAG, "Allow-list header not recognised (magic %08x version %u), no tag can claim a bay until 'allow clear'",
+                     (unsigned)hdr->magic, (unsigned)hdr->version);
+            a->foreign = true;
+            return;
+        }
+        ESP_LOGW(TAG, "Formatting the allow-list, it is empty until tags are added");
+        if ((err = format()) != ESP_OK)
+            ESP_LOGE(TAG, "Allow-list format failed: %s", esp_err_to_name(err));
+        return;
+    }
+    for (uint32_t i = 0; i < a->nslots; i++)
+    {
+        const struct allow_rec *r = &a->slots[i];
+        if (r->state == ALLOW_LIVE)
+        {
+            a->live++;
+            bloom_set(r->hash);
+        }
+        else if (r->state != ALLOW_EMPTY)
+        {
+            a->dead++;
+        }
+    }
+    ESP_LOGI(TAG, "Allow-list: %u tags, %u deleted, %u slots", (unsigned)a->live, (unsigned)a->dead, (unsigned)a->nslots);
+}
+
+bool allow_check(const uint8_t *uid, uint8_t len)
+{ // NFC tasks, on every tap at a vacant bay
+    struct allow_list *a = &allow_ctx;
+    if (a->part == NULL)
+        return true;
+    if (a->foreign)
+        return false;
+    int64_t start = esp_timer_get_time();
+    uint32_t h = uid_hash(uid, len);
+    uint32_t empty;
+    xSemaphoreTake(a->lock, portMAX_DELAY);
+    bool ok = false;
+    if (!bloom_test(h))
+        a->filtered++;
+    else
+    {
+        uint32_t reads = a->reads;
+        ok = find(uid, len, h, &empty) >= 0;
+        a->probes += a->reads - reads;
+    }
+    uint32_t us = esp_timer_get_time() - start;
+    a->lookups++;
+    a->sum_us += us;
+    if (us > a->max_us)
+        a->max_us = us;
+    xSemaphoreGive(a->lock);
+    return ok;
+}
+
+esp_err_t allow_add(const uint8_t *uid, uint8_t len)
+{
+    struct allow_list *a = &allow_ctx;
+    if (a->part == NULL)
+        return ESP_ERR_NOT_SUPPORTED;
+    if (a->foreign)
+        return ESP_ERR_INVALID_STATE;
+    if (len == 0 || len > BAY_UID_LEN)
+        return ESP_ERR_INVALID_ARG;
+    uint32_t h = uid_hash(uid, len);
+    uint32_t empty;
+    esp_err_t err = ESP_OK;
+    xSemaphoreTake(a->lock, portMAX_DELAY);
+    bool known = find(uid, len, h, &empty) >= 0;
+    if (!known && ((a->live + a->dead + 1) * 100 > a->nslots * ALLOW_MAX_LOAD || empty >= a->nslots))
+        err = ESP_ERR_NO_MEM; // 'allow clear' and push the list again to reclaim deleted slots
+    else if (!known)
+    {
+        struct allow_rec rec = {.state = ALLOW_LIVE, .len = len, .hash = h};
+        memset(rec.uid, 0xFF, sizeof(rec.uid));
+        memcpy(rec.uid, uid, len);
+        err = esp_partition_write(a->part, slot_offset(empty), &rec, sizeof(rec));
+        if (err == ESP_OK)
+        {
+            a->live++;
+            bloom_set(h);
+        }
+    }
+    xSemaphoreGive(a->lock);
+    return err;
+}
+
+esp_err_t allow_del(const uint8_t *uid, uint8_t len)
+{ // The slot stays used, its bits in the Bloom filter until the next boot
+    struct allow_list *a = &allow_ctx;
+    if (a->part == NULL)
+        return ESP_ERR_NOT_SUPPORTED;
+    if (a->foreign)
+        return ESP_ERR_INVALID_STATE;
+    uint32_t h = uid_hash(uid, len);
+    uint32_t empty;
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    xSemaphoreTake(a->lock, portMAX_DELAY);
+    int i = find(uid, len, h, &empty);
+    if (i >= 0)
+    {
+        uint8_t dead = ALLOW_DEAD;
+        err = esp_partition_write(a->part, slot_offset(i), &dead, sizeof(dead));
+        if (err == ESP_OK)
+        {
+            a->live--;
+            a->dead++;
+        }
+    }
+    xSemaphoreGive(a->lock);
+    return err;
+}
+
+static int parse_uid(const char *hex, uint8_t *uid)
+{ // As pn532_nfcid prints it, e.g. 04A23B5C618011. Length or -1
+    int len = 0;
+    while (hex[0] && hex[1] && len < BAY_UID_LEN)
+    {
+        if (!isxdigit((int)hex[0]) || !isxdigit((int)hex[1]))
+            return -1;
+        char byte[3] = {hex[0], hex[1], 0};
+        uid[len++] = strtol(byte, NULL, 16);
+        hex += 2;
+    }
+    return *hex || !len ? -1 : len;
+}
+
+int allow_comm(int argc, char **argv)
+{
+    struct allow_list *a = &allow_ctx;
+    if (argc >= 2 && !strcmp(argv[1], "clear"))
+    {
+        if (a->part == NULL)
+        {
+            printf("No allow-list partition\n");
+            return 1;
+        }
+        xSemaphoreTake(a->lock, portMAX_DELAY);
+        esp_err_t err = format();
+        xSemaphoreGive(a->lock);
+        printf("Allow-list cleared: %s\n", esp_err_to_name(err));
+        return err != ESP_OK;
+    }
+    if (argc >= 3 && (!strcmp(argv[1], "add") || !strcmp(argv[1], "del") || !strcmp(argv[1], "check")))
+    { // Several UIDs per line, so a list can be pushed in batches
+        int failed = 0;
+        for (int i = 2; i < argc; i++)
+        {
+            uint8_t uid[BAY_UID_LEN];
+            int len = parse_uid(argv[i], uid);
+            if (len < 0)
+            {
+                printf("%s: not a UID\n", argv[i]);
+                failed++;
+                continue;
+            }
+            esp_err_t err = ESP_OK;
+            if (!strcmp(argv[1], "check"))
+                printf("%s: %s\n", argv[i], allow_check(uid, len) ? "allowed" : "not allowed");
+            else if (!strcmp(argv[1], "add"))
+                err = allow_add(uid, len);
+            else
+                err = allow_del(uid, len);
+            if (err != ESP_OK)
+            {
+                printf("%s: %s\n", argv[i], esp_err_to_name(err));
+                failed++;
+            }
+        }
+        return failed != 0;
+    }
+    if (a->part == NULL)
+    {
+        printf("No allow-list partition, any tag can claim a bay\n");
+        return 0;
+    }
+    if (a->foreign)
+    {
+        printf("Allow-list header not recognised, no tag can claim a bay. 'allow clear' formats it\n");
+        return 1;
+    }
+    uint32_t set = 0;
+    for (int i = 0; i < ALLOW_BLOOM_BITS / 32; i++)
+        set += __builtin_popcount(bloom[i]);
+    printf("Allow-list: %u tags, %u deleted, %u slots (%u%% used), Bloom filter %u%% set\n", (unsigned)a->live,
+           (unsigned)a->dead, (unsigned)a->nslots, (unsigned)((a->live + a->dead) * 100 / a->nslots),
+           (unsigned)((uint64_t)set * 100 / ALLOW_BLOOM_BITS));
+    printf("%u lookups, %u stopped by the filter, %u flash slots read, mean %u us, max %u us\n", (unsigned)a->lookups,
+           (unsigned)a->filtered, (unsigned)a->probes, a->lookups ? (unsigned)(a->sum_us / a->lookups) : 0,
+           (unsigned)a->max_us);
+    return 0;
+}
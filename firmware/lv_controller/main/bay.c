@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_attr.h"
+#include "esp_log.h"
+
+#include "bay.h"
+#include "commands.h"
+#include "limit_switches.h"
+#include "ring_light.h"
+#include "solenoid.h"
+
+_Static_assert(NUM_BAYS >= 1 && NUM_BAYS <= MAX_BAYS, "NUM_BAYS out of range");
+
+/* BAY WIRING */
+// DRAM, the limit switch ISR reads the pins while flash writes have the cache off
+static const DRAM_ATTR struct bay_config bay_configs[MAX_BAYS] = {
+    {
+        .en_gpio = EN_GPIO,
+        .di_gpio = DI_GPIO,
+        .pwm_gpio = PWM_GPIO,
+        .dir_gpio = DIR_GPIO,
+        .motor_channel = LEDC_CHANNEL_0,
+        .lim_gpio = {LIM1_GPIO, LIM2_GPIO, LIM3_GPIO, LIM4_GPIO},
+        .lim_debounce_ms = {LIM_DEBOUNCE_END_MS, LIM_DEBOUNCE_END_MS, LIM_DEBOUNCE_END_MS, LIM_DEBOUNCE_DOOR_MS},
+        .solenoid_gpio = SOLENOID_GPIO,
+        .solenoid_channel = SOLENOID_LEDC_CHANNEL,
+        .ring_light_gpio = RING_LIGHT_GPIO,
+        .nfc_uart = 0,
+        .nfc_tx = 43,
+        .nfc_rx = 44,
+        .l9958_cs = 5,
+    },
+    {
+        // Second bay on the expansion header
+        .en_gpio = GPIO_NUM_8,
+        .di_gpio = GPIO_NUM_9,
+        .pwm_gpio = GPIO_NUM_10,
+        .dir_gpio = GPIO_NUM_11,
+        .motor_channel = LEDC_CHANNEL_2,
+        .lim_gpio = {GPIO_NUM_33, GPIO_NUM_34, GPIO_NUM_35, GPIO_NUM_36},
+        .lim_debounce_ms = {LIM_DEBOUNCE_END_MS, LIM_DEBOUNCE_END_MS, LIM_DEBOUNCE_END_MS, LIM_DEBOUNCE_DOOR_MS},
+        .solenoid_gpio = GPIO_NUM_40,
+        .solenoid_channel = LEDC_CHANNEL_3,
+        .ring_light_gpio = GPIO_NUM_39,
+        .nfc_uart = 1,
+        .nfc_tx = 41,
+        .nfc_rx = 42,
+        .l9958_cs = 21,
+    },
+};
+
+/* GLOBALS */
+static const char *TAG = "bay";
+struct bay bays[NUM_BAYS];
+
+void init_bays(void)
+{
+    for (int i = 0; i < NUM_BAYS; i++)
+    {
+        struct bay *bay = &bays[i];
+        memset(bay, 0, sizeof(*bay));
+        bay->index = i;
+        bay->cfg = &bay_configs[i];
+        bay->reflex_sw = -1;
+        atomic_init(&bay->lim_levels, LIM_ALL_BITS);
+        for (int sw = 0; sw < BAY_NUM_LIM; sw++)
+            bay->lim_state[sw] = 1;
+    }
+    ESP_LOGI(TAG, "%d bay(s) configured", NUM_BAYS);
+}
+
+struct bay *get_bay(int index)
+{
+    if (index < 0 || index >= NUM_BAYS)
+        return NULL;
+    return &bays[index];
+}
+
+struct bay *bay_from_arg(int argc, char **argv, int i)
+{ // Optional bay index at argv[i] for console commands, bay 0 if it is missing
+    if (argc <= i)
+        return &bays[0];
+    struct bay *bay = get_bay(atoi(argv[i]));
+    if (bay == NULL)
+    {
+        printf("Invalid bay: %s\n", argv[i]);
+        ESP_LOGE(TAG, "Invalid bay: %s", argv[i]);
+    }
+    return bay;
+}
@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "nvs.h"
+
+#include "bay.h"
+#include "bay_journal.h"
+
+struct bay_journal
+{
+    struct bay_journal_rec pending; // Snapshot from the last commit, guarded by lock
+    struct bay_journal_rec written; // Last record in NVS
+    bool dirty;
+    bool loaded; // A valid record was found at boot
+    uint32_t commits;
+    uint32_t writes;
+};
+
+/* GLOBALS */
+static const char *TAG = "bay_journal";
+static struct bay_journal journal_ctx[NUM_BAYS];
+static portMUX_TYPE journal_lock = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t journal_task_handle = NULL;
+
+static void nvs_key(int bay, char *key, size_t len)
+{
+    snprintf(key, len, "%s%d", BAY_JOURNAL_NVS_KEY, bay);
+}
+
+static bool same_contents(const struct bay_journal_rec *a, const struct bay_journal_rec *b)
+{ // Everything but the sequence number
+    return a->version == b->version && a->state == b->state && a->nfc_state == b->nfc_state &&
+           a->uid_len == b->uid_len && !memcmp(a->uid, b->uid, a->uid_len);
+}
+
+static void write_rec(int bay, struct bay_journal_rec *rec)
+{
+    nvs_handle_t h;
+    char key[16];
+    nvs_key(bay, key, sizeof(key));
+    if (nvs_open(BAY_JOURNAL_NVS_NAMESPACE, NVS_READWRITE, &h) != ESP_OK)
+        return;
+    if (nvs_set_blob(h, key, rec, sizeof(*rec)) == ESP_OK && nvs_commit(h) == ESP_OK)
+        journal_ctx[bay].writes++;
+    else
+        ESP_LOGE(TAG, "Bay %d: journal write failed", bay);
+    nvs_close(h);
+}
+
+static bool read_rec(int bay, struct bay_journal_rec *rec)
+{
+    nvs_handle_t h;
+    char key[16];
+    nvs_key(bay, key, sizeof(key));
+    if (nvs_open(BAY_JOURNAL_NVS_NAMESPACE, NVS_READONLY, &h) != ESP_OK)
+        return false;
+    size_t len = sizeof(*rec);
+    esp_err_t err = nvs_get_blob(h, key, rec, &len);
+    nvs_close(h);
+    // Missing, or from an older layout
+    return err == ESP_OK && len == sizeof(*rec) && rec->version == BAY_JOURNAL_VERSION && rec->uid_len <= BAY_UID_LEN;
+}
+
+static void journal_task(void *params)
+{ // Only task that writes the journal, so NVS sees one small write per burst of commits
+    while (true)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        vTaskDelay(pdMS_TO_TICKS(BAY_JOURNAL_BATCH_MS));
+        for (int i = 0; i < NUM_BAYS; i++)
+        {
+            struct bay_journal *j = &journal_ctx[i];
+            struct bay_journal_rec rec;
+            portENTER_CRITICAL(&journal_lock);
+            bool dirty = j->dirty;
+            rec = j->pending;
+            j->dirty = false;
+            portEXIT_CRITICAL(&journal_lock);
+            if (!dirty || same_contents(&rec, &j->written))
+                continue; // A chain of transitions can land back where the last write left it
+            rec.seq = j->written.seq + 1;
+            write_rec(i, &rec);
+            j->written = rec;
+        }
+    }
+}
+
+void init_bay_journal(void)
+{
+    for (int i = 0; i < NUM_BAYS; i++)
+    {
+        struct bay_journal *j = &journal_ctx[i];
+        memset(j, 0, sizeof(*j));
+        j->loaded = read_rec(i, &j->written);
+        if (!j->loaded)
+            memset(&j->written, 0, sizeof(j->written));
+        else
+            ESP_LOGI(TAG, "Bay %d: journal #%u, state %d, uid length %d", i, (unsigned)j->written.seq,
+                     j->written.state, j->written.uid_len);
+    }
+    xTaskCreate(journal_task, "bay_journal", 3072, NULL, 3, &journal_task_handle);
+}
+
+bool bay_journal_restore(struct bay *bay, int num_states, int num_nfc_states)
+{ // Load the last committed record into the bay, false and the bay untouched if there is nothing valid to resume
+    struct bay_journal *j = &journal_ctx[bay->index];
+    if (!j->loaded)
+        return false;
+    if (j->written.state < 0 || j->written.state >= num_states)
+    {
+        ESP_LOGW(TAG, "Bay %d: journal state %d out of range, starting vacant", bay->index, j->written.state);
+        return false;
+    }
+    if (j->written.nfc_state < 0 || j->written.nfc_state >= num_nfc_states)
+    { // Every tap would be ignored from here on
+        ESP_LOGW(TAG, "Bay %d: journal NFC state %d out of range, starting vacant", bay->index, j->written.nfc_state);
+        return false;
+    }
+    bay->state = j->written.state;
+    bay->nfc_next_state = j->written.nfc_state;
+    bay->uid_len = j->written.uid_len;
+    memcpy(bay->uid, j->written.uid, j->written.uid_len);
+    j->pending = j->written;
+    return true;
+}
+
+void bay_journal_commit(struct bay *bay)
+{ // Snapshot the bay as it is now, the write happens on the journal task
+    struct bay_journal *j = &journal_ctx[bay->index];
+    portENTER_CRITICAL(&journal_lock);
+    j->pending.version = BAY_JOURNAL_VERSION;
+    j->pending.state = bay->state;
+    j->pending.nfc_state = bay->nfc_next_state;
+    j->pending.uid_len = bay->uid_len;
+    memset(j->pending.uid, 0, sizeof(j->pending.uid));
+    memcpy(j->pending.uid, bay->uid, bay->uid_len);
+    j->dirty = true;
+    j->commits++;
+    portEXIT_CRITICAL(&journal_lock);
+    if (journal_task_handle)
+        xTaskNotifyGive(journal_task_handle);
+}
+
+int journal_comm(int argc, char **argv)
+{
+    if (argc >= 2 && !strcmp(argv[1], "clear"))
+    {
+        struct bay *bay = bay_from_arg(argc, argv, 2);
+        if (bay == NULL)
+            return 0;
+        nvs_handle_t h;
+        char key[16];
+        nvs_key(bay->index, key, sizeof(key));
+        if (nvs_open(BAY_JOURNAL_NVS_NAMESPACE, NVS_READWRITE, &h) == ESP_OK)
+        {
+            nvs_erase_key(h, key);
+            nvs_commit(h);
+            nvs_close(h);
+        }
+        memset(&journal_ctx[bay->index].written, 0, sizeof(journal_ctx[bay->index].written));
+        printf("Bay %d journal cleared, next commit starts it again\n", bay->index);
+        return 0;
+    }
+    for (int i = 0; i < NUM_BAYS; i++)
+    {
+        const struct bay_journal *j = &journal_ctx[i];
+        printf("Bay %d journal #%u: state %d, nfc state %d, uid", i, (unsigned)j->written.seq, j->written.state,
+               j->written.nfc_state);
+        for (int b = 0; b < j->written.uid_len; b++)
+            printf(" %d", j->written.uid[b]);
+        printf("\nBay %d commits: %u, NVS writes: %u\n", i, (unsigned)j->commits, (unsigned)j->writes);
+    }
+    return 0;
+}
@@ -6,10 +6,14 @@
 #include "esp_log.h"
 #include <driver/gpio.h>
 
+#include "bay.h"
+#include "actuator.h"
 #include "commands.h"
+#include "cycle.h"
 #include "solenoid.h"
 #include "state_machine.h"
 #include "motor.h"
+#include "trace.h"
 
 static const char *TAG = "commands";
 
@@ -21,9 +25,8 @@ int calc_bits_from_duty(int duty)
         printf("Error setting duty cycle. Duty value invalid: %d\n", duty);
         ESP_LOGE(TAG, "Error setting duty cycle. Duty value invalid: %d\n", duty);
     }
-    printf("Setting duty to: %d%%\n", duty);
-    // ESP_LOGI(TAG, "Setting duty to: %d%%\n", duty);
     int calc_duty = (int)((pow(2, 10) - 1) * (duty / 100.0));
+    TRACE(TR_PWM_DUTY, duty, calc_duty);
     // printf("Duty bits: %d\n", calc_duty);
     // ESP_LOGI(TAG, "Duty bits: %d\n", calc_duty);
     return calc_duty; // 10 bit res
@@ -32,50 +35,55 @@ int calc_bits_from_duty(int duty)
 /* Commands */
 int lock_solenoid_comm(int argc, char **argv)
 {
-    // Set level low (0) to lock
-    ESP_ERROR_CHECK(gpio_set_level(SOLENOID_GPIO, 0));
-    printf("Set solenoid level low to lock\n");
+    struct bay *bay = bay_from_arg(argc, argv, 1);
+    if (bay)
+        lock_solenoid(bay);
     return 0;
 }
 
 int unlock_solenoid_comm(int argc, char **argv)
 {
-    // Set level high (1) to unlock
-    ESP_ERROR_CHECK(gpio_set_level(SOLENOID_GPIO, 1));
-    printf("Set solenoid level high to unlock\n");
+    // Peak-and-hold, relocks on its own after SOLENOID_RELOCK_MS
+    struct bay *bay = bay_from_arg(argc, argv, 1);
+    if (bay)
+        unlock_solenoid(bay);
     return 0;
 }
 
 int set_pwm(int argc, char **argv)
 {
-    // Expecting 2 arguments for this function
-    if (argc != 2)
+    // Expecting 2 arguments for this function, plus an optional bay
+    if (argc != 2 && argc != 3)
     {
         printf("Incorrect number of arguments %d\n", argc);
         ESP_LOGE(TAG, "Incorrect number of arguments %d\n", argc);
         return 0;
     }
+    struct bay *bay = bay_from_arg(argc, argv, 2);
+    if (bay == NULL)
+        return 0;
     char *duty_str = argv[1]; // 1st index is command, second is arg
     int duty = atoi(duty_str);
 
-    // Set duty
-    ESP_ERROR_CHECK(ledc_set_duty(LEDC_MODE, LEDC_CHANNEL, calc_bits_from_duty(duty))); // Set duty to XX%. ((2 ** 10) - 1) * XX% = # bits
-    // Update duty to apply the new value
-    ESP_ERROR_CHECK(ledc_update_duty(LEDC_MODE, LEDC_CHANNEL));
-    // ESP_ERROR_CHECK(gpio_set_level(PWM_GPIO, 1));
-    // printf("Set motor PWM to 1\n");
+    // Set duty to XX%. ((2 ** 10) - 1) * XX% = # bits, latched straight away
+    struct act_cmd cmd = ACT_CMD(0, 0);
+    cmd.motor_duty = duty;
+    act_apply(bay, &cmd);
     return 0;
 }
 
 int set_mtr_dir(int argc, char **argv)
 {
-    // Expecting 2 arguments for this function
-    if (argc != 2)
+    // Expecting 2 arguments for this function, plus an optional bay
+    if (argc != 2 && argc != 3)
     {
         printf("Incorrect number of arguments: %d\n", argc);
         ESP_LOGE(TAG, "Incorrect number of arguments: %d\n", argc);
         return 0;
     }
+    struct bay *bay = bay_from_arg(argc, argv, 2);
+    if (bay == NULL)
+        return 0;
     char *arg_str = argv[1]; // 1st index is command, second is arg
     int arg = atoi(arg_str);
 
@@ -86,86 +94,119 @@ int set_mtr_dir(int argc, char **argv)
         return 0;
     }
 
-    if (arg)
-    {
-        ESP_ERROR_CHECK(gpio_set_level(DIR_GPIO, 1));
-        printf("Set motor direction to Forward (1)\n");
-    }
-    else
-    {
-        ESP_ERROR_CHECK(gpio_set_level(DIR_GPIO, 0));
-        printf("Set motor direction to Reverse (0)\n");
-    }
+    struct act_cmd cmd = ACT_CMD(ACT_DIR_BIT, arg ? ACT_DIR_BIT : 0);
+    act_apply(bay, &cmd);
+    printf("Set motor direction to %s (%d)\n", arg ? "Forward" : "Reverse", arg);
 
     return 0;
 }
 
 int enable_motor_output(int argc, char **argv)
 {
+    struct bay *bay = bay_from_arg(argc, argv, 1);
+    if (bay == NULL)
+        return 0;
     // Set EN high and DI low to enable output
-    ESP_ERROR_CHECK(gpio_set_level(EN_GPIO, 1));
-    ESP_ERROR_CHECK(gpio_set_level(DI_GPIO, 0));
+    struct act_cmd cmd = ACT_CMD(ACT_EN_BIT | ACT_DI_BIT, ACT_EN_BIT);
+    act_apply(bay, &cmd);
     printf("Enabling motor output...\n");
     return 0;
 }
 
 int disable_motor_output(int argc, char **argv)
 {
+    struct bay *bay = bay_from_arg(argc, argv, 1);
+    if (bay == NULL)
+        return 0;
     // Set EN low and DI high to disable output
-    ESP_ERROR_CHECK(gpio_set_level(EN_GPIO, 0));
-    ESP_ERROR_CHECK(gpio_set_level(DI_GPIO, 1));
+    struct act_cmd cmd = ACT_CMD(ACT_EN_BIT | ACT_DI_BIT, ACT_DI_BIT);
+    act_apply(bay, &cmd);
     printf("Disabling motor output...\n");
     return 0;
 }
 
 int sled_out_comm(int argc, char **argv)
 {
-    sled_out();
+    struct bay *bay = bay_from_arg(argc, argv, 1);
+    if (bay)
+        sled_out(bay);
     return 0;
 }
 
 int sled_in_comm(int argc, char **argv)
 {
-    sled_in();
+    struct bay *bay = bay_from_arg(argc, argv, 1);
+    if (bay)
+        sled_in(bay);
     return 0;
 }
 
 int stop_sled_comm(int argc, char **argv)
 {
-    stop_sled();
+    struct bay *bay = bay_from_arg(argc, argv, 1);
+    if (bay)
+        stop_sled(bay);
     return 0;
 }
 
 int to_unlockedem_comm(int argc, char **argv)
 {
-    return to_unlockedem();
+    struct bay *bay = bay_from_arg(argc, argv, 1);
+    if (bay == NULL)
+        return SM_ERR_STATE;
+    return to_unlockedem(bay);
 }
 
 int to_loading_comm(int argc, char **argv)
 {
-    return to_loading();
+    struct bay *bay = bay_from_arg(argc, argv, 1);
+    if (bay == NULL)
+        return SM_ERR_STATE;
+    return to_loading(bay);
 }
 int to_closed_comm(int argc, char **argv)
 {
-    return to_closed();
+    struct bay *bay = bay_from_arg(argc, argv, 1);
+    if (bay == NULL)
+        return SM_ERR_STATE;
+    return to_closed(bay);
 }
 int to_compvision_comm(int argc, char **argv)
 {
-    return to_compvision();
+    struct bay *bay = bay_from_arg(argc, argv, 1);
+    if (bay == NULL)
+        return SM_ERR_STATE;
+    return to_compvision(bay);
 }
 int to_charging_comm(int argc, char **argv)
 {
-    return to_charging();
+    struct bay *bay = bay_from_arg(argc, argv, 1);
+    if (bay == NULL)
+        return SM_ERR_STATE;
+    if (cycle_active(bay))
+        return cycle_post_gate(bay, CG_CHARGER_ON); // Sent once CV is done and the charger is on
+    return to_charging(bay);
 }
 int to_unlocked_comm(int argc, char **argv)
 {
-    return to_unlocked();
+    struct bay *bay = bay_from_arg(argc, argv, 1);
+    if (bay == NULL)
+        return SM_ERR_STATE;
+    if (cycle_active(bay))
+        return cycle_post_gate(bay, CG_CHARGER_CLEAR); // Sent once the charger is off and the gantry parked
+    return to_unlocked(bay);
 }
 int to_unloading_comm(int argc, char **argv)
 {
-    return to_unloading();
+    struct bay *bay = bay_from_arg(argc, argv, 1);
+    if (bay == NULL)
+        return SM_ERR_STATE;
+    return to_unloading(bay);
 }
 int to_empty_comm(int argc, char **argv)
 {
-    return to_empty();
+    struct bay *bay = bay_from_arg(argc, argv, 1);
+    if (bay == NULL)
+        return SM_ERR_STATE;
+    return to_empty(bay);
 }
\ No newline at end of file
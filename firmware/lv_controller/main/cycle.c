@@ -0,0 +1,322 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "bay.h"
+#include "bay_journal.h"
+#include "cycle.h"
+#include "nfc_module.h"
+#include "state_machine.h"
+
+enum cycle_op
+{
+    CYC_END = 0, // Back to the top for the next customer
+    CYC_GATE,    // Block until an external event
+    CYC_RUN,     // Run a transition and wait for it to finish
+    CYC_BANNER,  // Print a console banner for the BBB
+    CYC_RELEASE, // Forget the owner's tag
+};
+
+struct cycle_step
+{
+    enum cycle_op op;
+    int arg;              // enum cycle_gate or enum transitions
+    const char *banner;   // CYC_BANNER
+    bool release_on_fail; // CYC_RUN, give the bay up if the transition fails rather than retry on a tap
+};
+
+#define GATE(g) {.op = CYC_GATE, .arg = (g)}
+#define RUN(t) {.op = CYC_RUN, .arg = (t)}
+#define RUN_OR_RELEASE(t) {.op = CYC_RUN, .arg = (t), .release_on_fail = true}
+#define BANNER(b) {.op = CYC_BANNER, .banner = (b)}
+#define RELEASE() {.op = CYC_RELEASE}
+
+// Gate and control bits share the bay's cycle event group
+#define CYCLE_GATE_BITS (BIT(NUM_CYCLE_GATES) - 1)
+#define CYCLE_DONE_BIT BIT6  // Requested transition finished
+#define CYCLE_STOP_BIT BIT7  // 'cycle off', leave the current gate
+#define CYCLE_START_BIT BIT8 // 'cycle on'
+
+/* CYCLE SCRIPT */
+// One customer, drop off to pick up. Only taps and BBB gates block, everything else runs back to back
+static const struct cycle_step cycle_script[] = {
+    GATE(CG_TAP),                 // Owner claims the bay
+    RUN_OR_RELEASE(T_UNLOCKEDEM), // Door open
+    GATE(CG_TAP),                 // Owner clear of the door, the sled comes out at them
+    RUN(T_LOADING),
+    GATE(CG_TAP),                 // Bike on the sled
+    RUN(T_CLOSED),
+    RUN(T_COMPVISION),
+    GATE(CG_CHARGER_ON),
+    RUN(T_CHARGING),
+    GATE(CG_TAP),                 // Owner back for the bike
+    BANNER("WaitForBBBFin_state"),
+    GATE(CG_CHARGER_CLEAR),
+    RUN(T_UNLOCKED),
+    GATE(CG_TAP),                 // Owner clear of the door, the sled comes out at them
+    RUN(T_UNLOADING),
+    GATE(CG_TAP),                 // Bike off the sled
+    RUN(T_EMPTY),
+    RELEASE(),
+    {.op = CYC_END},
+};
+
+static const char *gate_names[NUM_CYCLE_GATES] = {
+    [CG_TAP] = "tap",
+    [CG_CHARGER_ON] = "charger_on",
+    [CG_CHARGER_CLEAR] = "charger_clear",
+};
+
+struct cycle
+{
+    EventGroupHandle_t events;
+    volatile bool active;
+    volatile int step;
+    volatile int waiting; // Gate the script is blocked on, -1 for none
+    int result;           // Of the last requested transition
+    int64_t start_us;     // When the current customer claimed the bay
+    uint32_t cycles;
+};
+
+/* GLOBALS */
+static const char *TAG = "cycle";
+static struct cycle cycle_ctx[NUM_BAYS];
+
+static void cycle_transition_done(struct bay *bay, enum transitions t, int result, void *arg)
+{ // Bay's state machine task
+    bay->cycle->result = result;
+    xEventGroupSetBits(bay->cycle->events, CYCLE_DONE_BIT);
+}
+
+static int resume_step(struct bay *bay)
+{ // Just past the last RUN before the first transition allowed from the bay's state
+    int start = 0;
+    for (int i = 0; cycle_script[i].op != CYC_END; i++)
+    {
+        if (cycle_script[i].op != CYC_RUN)
+            continue;
+        if (sm_transition_allowed(bay, cycle_script[i].arg))
+            return start;
+        start = i + 1;
+    }
+    return 0;
+}
+
+static bool wait_gate(struct bay *bay, enum cycle_gate g)
+{ // false if the script was switched off while waiting
+    struct cycle *c = bay->cycle;
+    if (g == CG_TAP)
+        xEventGroupClearBits(c->events, BIT(CG_TAP)); // A tap during the last step is not an answer to this one
+    c->waiting = g;
+    EventBits_t bits = xEventGroupWaitBits(c->events, BIT(g) | CYCLE_STOP_BIT, pdFALSE, pdFALSE, portMAX_DELAY);
+    c->waiting = -1;
+    xEventGroupClearBits(c->events, BIT(g) | CYCLE_STOP_BIT);
+    return !(bits & CYCLE_STOP_BIT);
+}
+
+static int run_transition(struct bay *bay, enum transitions t)
+{
+    struct cycle *c = bay->cycle;
+    xEventGroupClearBits(c->events, CYCLE_DONE_BIT);
+    int ret = sm_request(bay, t, 0, cycle_transition_done, NULL);
+    if (ret)
+        return ret;
+    xEventGroupWaitBits(c->events, CYCLE_DONE_BIT, pdTRUE, pdFALSE, portMAX_DELAY);
+    return c->result;
+}
+
+static void release_bay(struct bay *bay)
+{
+    delete_tag(bay);
+    bay_journal_commit(bay);
+}
+
+static void cycle_task(void *params)
+{ // One per bay, walks the script and blocks only on gates and the engine
+    struct bay *bay = params;
+    struct cycle *c = bay->cycle;
+    c->step = resume_step(bay);
+    while (true)
+    {
+        if (!c->active)
+        {
+            xEventGroupWaitBits(c->events, CYCLE_START_BIT, pdTRUE, pdFALSE, portMAX_DELAY);
+            c->step = resume_step(bay);
+            ESP_LOGI(TAG, "Bay %d: cycle script resuming at step %d", bay->index, c->step);
+            continue;
+        }
+
+        const struct cycle_step *st = &cycle_script[c->step];
+        if (c->step == 0)
+            xEventGroupClearBits(c->events, CYCLE_GATE_BITS); // Nothing from the last customer carries over
+        switch (st->op)
+        {
+        case CYC_END:
+            c->cycles++;
+            ESP_LOGI(TAG, "Bay %d: cycle done in %lld ms", bay->index, (esp_timer_get_time() - c->start_us) / 1000);
+            c->step = 0;
+            break;
+        case CYC_GATE:
+            if (!wait_gate(bay, st->arg))
+                break; // Switched off, the step is picked again from the state on 'cycle on'
+            if (c->step == 0)
+                c->start_us = esp_timer_get_time();
+            c->step++;
+            break;
+        case CYC_RUN:
+        {
+            int ret = run_transition(bay, st->arg);
+            if (!ret)
+            {
+                c->step++;
+                break;
+            }
+            ESP_LOGE(TAG, "ERROR: Bay %d %s failed (%d)...", bay->index, sm_transition_name(st->arg), ret);
+            if (st->release_on_fail)
+            {
+                release_bay(bay); // Bay was never claimed, free it for the next tap
+                c->step = 0;
+                break;
+            }
+            // Actuators are safe and the state did not move, the owner retries with a tap
+            wait_gate(bay, CG_TAP);
+            break;
+        }
+        case CYC_BANNER:
+            sm_print_banner(bay, st->banner);
+            c->step++;
+            break;
+        case CYC_RELEASE:
+            release_bay(bay);
+            c->step++;
+            break;
+        default:
+            c->step++;
+            break;
+        }
+    }
+}
+
+void init_cycle(void)
+{ // After init_state_machine, the script picks up from whatever state the journal restored
+    for (int i = 0; i < NUM_BAYS; i++)
+    {
+        struct bay *bay = &bays[i];
+        struct cycle *c = &cycle_ctx[i];
+        c->events = xEventGroupCreate();
+        c->active = CYCLE_AUTO_DEFAULT;
+        c->waiting = -1;
+        bay->cycle = c;
+        xTaskCreate(cycle_task, "cycle", 3072, bay, 9, NULL);
+    }
+}
+
+bool cycle_active(struct bay *bay)
+{
+    return bay->cycle && bay->cycle->active;
+}
+
+bool cycle_tap(struct bay *bay, uint8_t uid[], uint8_t uidLength)
+{ // NFC task, false if the script is off and the NFC sequence should handle the tap
+    struct cycle *c = bay->cycle;
+    if (!cycle_active(bay))
+        return false;
+    if (c->waiting != CG_TAP)
+    {
+        ESP_LOGI(TAG, "INFO: Transition in progress, ignoring tag...");
+        return true;
+    }
+    if (bay->uid_len == 0)
+    {
+        if (new_tag(bay, uid, uidLength))
+            return true; // Not allowed to claim the bay
+    }
+    else if (check_tag(bay, uid, uidLength))
+    {
+        ESP_LOGI(TAG, "INFO: Detected unsaved tag...");
+        return true;
+    }
+    bay->tap_us = esp_timer_get_time();
+    xEventGroupSetBits(c->events, BIT(CG_TAP));
+    return true;
+}
+
+int cycle_post_gate(struct bay *bay, enum cycle_gate g)
+{ // Latched until the script reaches the gate, so the BBB can answer early
+    if (g < 0 || g >= NUM_CYCLE_GATES || !cycle_active(bay))
+        return SM_ERR_STATE;
+    xEventGroupSetBits(bay->cycle->events, BIT(g));
+    return SM_OK;
+}
+
+bool cycle_gate_posted(struct bay *bay, enum cycle_gate g)
+{ // Answered early and still latched, the script has not reached the gate yet
+    return cycle_active(bay) && (xEventGroupGetBits(bay->cycle->events) & BIT(g));
+}
+
+static const char *step_name(const struct cycle_step *st)
+{
+    switch (st->op)
+    {
+    case CYC_GATE:
+        return gate_names[st->arg];
+    case CYC_RUN:
+        return sm_transition_name(st->arg);
+    case CYC_BANNER:
+        return st->banner;
+    case CYC_RELEASE:
+        return "release";
+    default:
+        return "end";
+    }
+}
+
+int cycle_comm(int argc, char **argv)
+{
+    if (argc >= 2 && (!strcmp(argv[1], "on") || !strcmp(argv[1], "off")))
+    {
+        struct bay *bay = bay_from_arg(argc, argv, 2);
+        if (bay == NULL)
+            return 0;
+        struct cycle *c = bay->cycle;
+        bool on = !strcmp(argv[1], "on");
+        if (on == c->active)
+            return 0;
+        c->active = on;
+        xEventGroupSetBits(c->events, on ? CYCLE_START_BIT : CYCLE_STOP_BIT);
+        printf("Bay %d cycle script %s\n", bay->index, on ? "on" : "off, taps drive the NFC sequence");
+        return 0;
+    }
+    for (int i = 0; i < NUM_BAYS; i++)
+    {
+        const struct cycle *c = bays[i].cycle;
+        printf("Bay %d cycle script %s, step %d (%s), %u cycles\n", i, c->active ? "on" : "off", c->step,
+               step_name(&cycle_script[c->step]), (unsigned)c->cycles);
+    }
+    return 0;
+}
+
+int gate_comm(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        printf("Usage: gate <charger_on|charger_clear> [bay]\n");
+        return 1;
+    }
+    struct bay *bay = bay_from_arg(argc, argv, 2);
+    if (bay == NULL)
+        return 1;
+    for (int g = CG_CHARGER_ON; g < NUM_CYCLE_GATES; g++) // Taps only come from the reader
+    {
+        if (!strcmp(argv[1], gate_names[g]))
+            return cycle_post_gate(bay, g);
+    }
+    printf("Unknown gate: %s\n", argv[1]);
+    return 1;
+}
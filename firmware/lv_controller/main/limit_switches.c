@@ -1,72 +1,305 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "freertos/queue.h"
+#include "freertos/event_groups.h"
 #include "driver/gpio.h"
+#include "hal/gpio_ll.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "nvs.h"
+#include "soc/soc_caps.h"
+#if SOC_GPIO_SUPPORT_PIN_GLITCH_FILTER
+#include "driver/gpio_filter.h"
+#endif
 
+#include "bay.h"
 #include "limit_switches.h"
+#include "motor.h"
+#include "sled_estimator.h"
+#include "trace.h"
+
+struct lim_debounce
+{
+    atomic_uint edge_us;    // Low 32 bits of the esp_timer time of the last edge, let through or not
+    uint32_t window_us;
+    atomic_uint bounces;    // Edges dropped by the debounce, lifetime
+    atomic_uint actuations; // Debounced presses, lifetime
+};
+
+// NVS record, one per bay
+struct lim_wear
+{
+    uint32_t actuations[BAY_NUM_LIM];
+    uint32_t bounces[BAY_NUM_LIM];
+};
 
 /* GLOBALS */
-int state = 0;
-QueueHandle_t interuptQueue;
+static const char *TAG = "limit_switches";
+static TaskHandle_t lim_switch_task_handle = NULL;
+
+static struct lim_debounce lim_db[NUM_BAYS][BAY_NUM_LIM];
+static atomic_uint lim_settling[NUM_BAYS]; // Switches that bounced, re-read once they have been quiet for a window
+static struct lim_wear wear_saved[NUM_BAYS];
+
+// Single producer (GPIO ISR) / single consumer (lim_switch_read) ring shared by every bay, no locks
+static struct lim_switch_event evt_ring[LIM_EVT_RING_LEN];
+static atomic_uint evt_head = 0; // Only written by the ISR
+static atomic_uint evt_tail = 0; // Only written by the consumer task
+static atomic_uint evt_dropped = 0;
+
+// ISR argument packs the bay and the switch within it
+#define LIM_ISR_ARG(bay, sw) ((void *)(intptr_t)((bay) * BAY_NUM_LIM + (sw)))
+
+static void wear_key(int bay, char *key, size_t len)
+{
+    snprintf(key, len, "%s%d", LIM_WEAR_NVS_KEY, bay);
+}
+
+static void load_wear(int bay)
+{
+    struct lim_wear *w = &wear_saved[bay];
+    nvs_handle_t h;
+    char key[16];
+    wear_key(bay, key, sizeof(key));
+    memset(w, 0, sizeof(*w));
+    if (nvs_open(LIM_WEAR_NVS_NAMESPACE, NVS_READONLY, &h) != ESP_OK)
+        return;
+    size_t len = sizeof(*w);
+    if (nvs_get_blob(h, key, w, &len) != ESP_OK || len != sizeof(*w))
+        memset(w, 0, sizeof(*w));
+    nvs_close(h);
+    for (int sw = 0; sw < BAY_NUM_LIM; sw++)
+    {
+        atomic_store(&lim_db[bay][sw].actuations, w->actuations[sw]);
+        atomic_store(&lim_db[bay][sw].bounces, w->bounces[sw]);
+    }
+}
+
+static void save_wear(int bay)
+{
+    struct lim_wear w;
+    nvs_handle_t h;
+    char key[16];
+    for (int sw = 0; sw < BAY_NUM_LIM; sw++)
+    {
+        w.actuations[sw] = atomic_load(&lim_db[bay][sw].actuations);
+        w.bounces[sw] = atomic_load(&lim_db[bay][sw].bounces);
+    }
+    if (!memcmp(&w, &wear_saved[bay], sizeof(w)))
+        return;
+    wear_key(bay, key, sizeof(key));
+    if (nvs_open(LIM_WEAR_NVS_NAMESPACE, NVS_READWRITE, &h) != ESP_OK)
+        return;
+    if (nvs_set_blob(h, key, &w, sizeof(w)) == ESP_OK && nvs_commit(h) == ESP_OK)
+        wear_saved[bay] = w;
+    nvs_close(h);
+}
 
-int LIM1_state = 1;
-int LIM2_state = 1;
-int LIM3_state = 1; // normally low (i.e. sled is in)
-int LIM4_state = 1; // normally low (i.e. door is closed)
+static void wear_task(void *params)
+{ // Keeps NVS writes off the switch task, a reboot loses at most one period of counts
+    while (true)
+    {
+        vTaskDelay(pdMS_TO_TICKS(LIM_WEAR_SAVE_PERIOD_MS));
+        for (int i = 0; i < NUM_BAYS; i++)
+            save_wear(i);
+    }
+}
+
+static void enable_glitch_filter(gpio_num_t pin)
+{ // Drops pulses of a few APB cycles (EMI on the switch leads) before they reach the ISR, bounce is left to the window
+#if SOC_GPIO_SUPPORT_PIN_GLITCH_FILTER
+    gpio_glitch_filter_handle_t filter;
+    gpio_pin_glitch_filter_config_t cfg = {
+        .clk_src = GLITCH_FILTER_CLK_SRC_DEFAULT,
+        .gpio_num = pin,
+    };
+    if (gpio_new_pin_glitch_filter(&cfg, &filter) != ESP_OK || gpio_glitch_filter_enable(filter) != ESP_OK)
+        ESP_LOGW(TAG, "No glitch filter on GPIO %d", pin);
+#endif
+}
 
 void init_limit_switches(void)
 {
-    interuptQueue = xQueueCreate(10, sizeof(int));
-    xTaskCreate(lim_switch_read, "lim_switch_read", 2048, NULL, 1, NULL);
+    xTaskCreate(lim_switch_read, "lim_switch_read", 2048, NULL, 12, &lim_switch_task_handle);
+    xTaskCreate(wear_task, "lim_wear", 2048, NULL, 2, NULL);
 
-    gpio_install_isr_service(0);
-    gpio_isr_handler_add(LIM1_GPIO, gpio_interrupt_handler, (void *)LIM1_GPIO);
-    gpio_isr_handler_add(LIM2_GPIO, gpio_interrupt_handler, (void *)LIM2_GPIO);
-    gpio_isr_handler_add(LIM3_GPIO, gpio_interrupt_handler, (void *)LIM3_GPIO);
-    gpio_isr_handler_add(LIM4_GPIO, gpio_interrupt_handler, (void *)LIM4_GPIO);
+    gpio_install_isr_service(ESP_INTR_FLAG_IRAM); // The reflex stop must not wait out a flash write
+    for (int i = 0; i < NUM_BAYS; i++)
+    {
+        struct bay *bay = &bays[i];
+        bay->lim_events = xEventGroupCreate();
+        load_wear(i);
+        for (int sw = 0; sw < BAY_NUM_LIM; sw++)
+        {
+            lim_db[i][sw].window_us = bay->cfg->lim_debounce_ms[sw] * 1000U;
+            enable_glitch_filter(bay->cfg->lim_gpio[sw]);
+        }
+
+        // Seed the snapshot before edges start arriving
+        uint32_t levels = 0;
+        for (int sw = 0; sw < BAY_NUM_LIM; sw++)
+        {
+            if (gpio_get_level(bay->cfg->lim_gpio[sw]))
+                levels |= BIT(sw);
+        }
+        atomic_store(&bay->lim_levels, levels);
+
+        for (int sw = 0; sw < BAY_NUM_LIM; sw++)
+            gpio_isr_handler_add(bay->cfg->lim_gpio[sw], gpio_interrupt_handler, LIM_ISR_ARG(i, sw));
+    }
 }
 
 static void IRAM_ATTR gpio_interrupt_handler(void *args)
 {
-    int pinNumber = (int)args;
-    xQueueSendFromISR(interuptQueue, &pinNumber, NULL);
+    int arg = (intptr_t)args;
+    struct bay *bay = &bays[arg / BAY_NUM_LIM];
+    int sw = arg % BAY_NUM_LIM;
+    int pinNumber = bay->cfg->lim_gpio[sw];
+    int level = gpio_ll_get_level(&GPIO, pinNumber);
+    // Cut the sled motor before anything else if this is the end stop it is driving into, bounce or not
+    bool reflex = sled_reflex_from_isr(bay, sw, level);
+    int64_t now = esp_timer_get_time();
+
+    struct lim_debounce *db = &lim_db[bay->index][sw];
+    bool same = level == !!(atomic_load_explicit(&bay->lim_levels, memory_order_relaxed) & BIT(sw));
+    uint32_t quiet_us = (uint32_t)now - atomic_load_explicit(&db->edge_us, memory_order_relaxed);
+    atomic_store_explicit(&db->edge_us, (uint32_t)now, memory_order_relaxed);
+    if (!reflex && (same || quiet_us < db->window_us))
+    { // Bounce, or the tail of one, count it and have the task re-read the pin once it has been quiet a window
+        atomic_fetch_add_explicit(&db->bounces, 1, memory_order_relaxed);
+        if (atomic_fetch_or(&lim_settling[bay->index], BIT(sw)) & BIT(sw))
+            return; // Task already knows
+        BaseType_t woken = pdFALSE;
+        vTaskNotifyGiveFromISR(lim_switch_task_handle, &woken);
+        portYIELD_FROM_ISR(woken);
+        return;
+    }
+    TRACE_BAY(bay->index, reflex ? TR_LIM_REFLEX : TR_LIM_EDGE, pinNumber, level);
+
+    if (level)
+        atomic_fetch_or(&bay->lim_levels, BIT(sw));
+    else
+        atomic_fetch_and(&bay->lim_levels, ~BIT(sw));
+
+    unsigned head = atomic_load_explicit(&evt_head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&evt_tail, memory_order_acquire);
+    if (head - tail < LIM_EVT_RING_LEN)
+    {
+        struct lim_switch_event *e = &evt_ring[head & (LIM_EVT_RING_LEN - 1)];
+        e->time_us = now;
+        e->pin = pinNumber;
+        e->bay = bay->index;
+        e->sw = sw;
+        e->level = level;
+        e->reflex = reflex;
+        atomic_store_explicit(&evt_head, head + 1, memory_order_release);
+    }
+    else
+    {
+        atomic_fetch_add(&evt_dropped, 1); // Snapshot is still correct, only history is lost
+    }
+
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(lim_switch_task_handle, &woken);
+    portYIELD_FROM_ISR(woken);
 }
 
-void lim_switch_read(void *params)
+static void handle_edge(const struct lim_switch_event *e, EventBits_t changed[])
 {
-    int pinNumber, temp_count = 0;
-    int count1 = 1;
-    int count2 = 1;
-    int count3 = 1;
-    int count4 = 1;
-    while (true)
+    struct bay *bay = &bays[e->bay];
+    if (!e->level && bay->lim_state[e->sw])
+        atomic_fetch_add_explicit(&lim_db[e->bay][e->sw].actuations, 1, memory_order_relaxed);
+    bay->lim_state[e->sw] = e->level;
+    if (e->reflex)
     {
-        if (xQueueReceive(interuptQueue, &pinNumber, portMAX_DELAY))
+        ESP_LOGI(TAG, "Bay %d: reflex stop on GPIO %d", e->bay, e->pin);
+        sled_estimator_arrived(bay, e->sw, e->time_us);
+    }
+    bay->lim_last_edge_us[e->sw] = e->time_us;
+    changed[e->bay] |= BIT(e->sw);
+    // printf("GPIO %d changed %lld us ago. The state is %d\n", e->pin, esp_timer_get_time() - e->time_us, e->level);
+}
+
+static TickType_t settle_switches(EventBits_t changed[])
+{ // Re-read switches that bounced once they have been quiet for a window, a level that moved is a late edge.
+  // Returns ticks until the next one is due, portMAX_DELAY if nothing is settling
+    TickType_t next = portMAX_DELAY;
+    int64_t now = esp_timer_get_time();
+    for (int i = 0; i < NUM_BAYS; i++)
+    {
+        uint32_t settling = atomic_load(&lim_settling[i]);
+        for (int sw = 0; sw < BAY_NUM_LIM; sw++)
         {
-            if (pinNumber == LIM1_GPIO)
-            {
-                temp_count = count1++;
-                LIM1_state = gpio_get_level(pinNumber);
-            }
-            else if (pinNumber == LIM2_GPIO)
+            if (!(settling & BIT(sw)))
+                continue;
+            struct lim_debounce *db = &lim_db[i][sw];
+            uint32_t elapsed = (uint32_t)now - atomic_load(&db->edge_us);
+            if (elapsed < db->window_us)
             {
-                temp_count = count2++;
-                LIM2_state = gpio_get_level(pinNumber);
+                TickType_t ticks = pdMS_TO_TICKS((db->window_us - elapsed + 999) / 1000) + 1;
+                if (ticks < next)
+                    next = ticks;
+                continue;
             }
-            else if (pinNumber == LIM3_GPIO)
-            {
-                temp_count = count3++;
-                LIM3_state = gpio_get_level(pinNumber);
-            }
-            else if (pinNumber == LIM4_GPIO)
-            {
-                temp_count = count4++;
-                LIM4_state = gpio_get_level(pinNumber);
-            }
-            // printf("GPIO %d was pressed %d times. The state is %d\n", pinNumber, temp_count, gpio_get_level(pinNumber));
-            vTaskDelay(pdMS_TO_TICKS(100)); // 100 ms sleep for other tasks
+            // Clear before the read so a bounce after it schedules another one
+            atomic_fetch_and(&lim_settling[i], ~BIT(sw));
+            struct bay *bay = &bays[i];
+            int level = gpio_get_level(bay->cfg->lim_gpio[sw]);
+            if (level == !!(atomic_load(&bay->lim_levels) & BIT(sw)))
+                continue;
+            atomic_store(&db->edge_us, (uint32_t)now);
+            if (level)
+                atomic_fetch_or(&bay->lim_levels, BIT(sw));
+            else
+                atomic_fetch_and(&bay->lim_levels, ~BIT(sw));
+            TRACE_BAY(i, TR_LIM_EDGE, bay->cfg->lim_gpio[sw], level);
+            struct lim_switch_event e = {
+                .time_us = now,
+                .pin = bay->cfg->lim_gpio[sw],
+                .bay = i,
+                .sw = sw,
+                .level = level,
+            };
+            handle_edge(&e, changed);
+        }
+    }
+    return next;
+}
+
+void lim_switch_read(void *params)
+{
+    TickType_t wait = portMAX_DELAY;
+    while (true)
+    {
+        ulTaskNotifyTake(pdTRUE, wait);
+
+        EventBits_t changed[NUM_BAYS] = {0};
+        unsigned tail = atomic_load_explicit(&evt_tail, memory_order_relaxed);
+        unsigned head = atomic_load_explicit(&evt_head, memory_order_acquire);
+        while (tail != head)
+        {
+            struct lim_switch_event e = evt_ring[tail & (LIM_EVT_RING_LEN - 1)];
+            tail++;
+            atomic_store_explicit(&evt_tail, tail, memory_order_release);
+            handle_edge(&e, changed);
+        }
+        wait = settle_switches(changed);
+
+        unsigned dropped = atomic_exchange(&evt_dropped, 0);
+        if (dropped)
+            ESP_LOGW(TAG, "Dropped %u switch events", dropped);
+
+        // Wake anything waiting on these switches (state machine guards)
+        for (int i = 0; i < NUM_BAYS; i++)
+        {
+            if (changed[i])
+                xEventGroupSetBits(bays[i].lim_events, changed[i]);
         }
     }
 }
@@ -75,4 +308,108 @@ int get_lim_switch_curr_value(int pinNumber)
 {
 
     return gpio_get_level(pinNumber);
-}
\ No newline at end of file
+}
+
+uint32_t get_lim_switch_levels(struct bay *bay)
+{
+    return atomic_load(&bay->lim_levels);
+}
+
+int64_t get_lim_switch_last_edge_us(struct bay *bay, int sw)
+{
+    return bay->lim_last_edge_us[sw];
+}
+
+static bool switches_at_level(struct bay *bay, uint32_t mask, int level)
+{
+    uint32_t levels = atomic_load(&bay->lim_levels);
+    return level ? (levels & mask) == mask : (levels & mask) == 0;
+}
+
+static void resync_levels(struct bay *bay, uint32_t mask)
+{ // Re-sample the pins in case an edge was lost, switches still bouncing are left to the debounce
+    uint32_t settling = atomic_load(&lim_settling[bay->index]);
+    for (int sw = 0; sw < BAY_NUM_LIM; sw++)
+    {
+        if (!(mask & BIT(sw)) || (settling & BIT(sw)))
+            continue;
+        if (gpio_get_level(bay->cfg->lim_gpio[sw]))
+            atomic_fetch_or(&bay->lim_levels, BIT(sw));
+        else
+            atomic_fetch_and(&bay->lim_levels, ~BIT(sw));
+    }
+}
+
+int wait_for_switch(struct bay *bay, uint32_t mask, int level, int timeout_ms)
+{ // Block until every switch in mask reads level, 0 on success, -1 on timeout or -2 if aborted
+    int64_t deadline = esp_timer_get_time() + timeout_ms * 1000LL;
+    EventBits_t abort = mask & LIM_SLED_BITS ? LIM_ABORT_BIT : 0; // Door waits don't care about the motor
+    while (true)
+    {
+        // Clear before sampling so an edge between the read and the wait still wakes us
+        xEventGroupClearBits(bay->lim_events, mask);
+        if (switches_at_level(bay, mask, level))
+            return 0;
+        int64_t remaining_ms = (deadline - esp_timer_get_time()) / 1000;
+        if (remaining_ms <= 0)
+            return -1;
+        if (remaining_ms > LIM_RECHECK_MS)
+            remaining_ms = LIM_RECHECK_MS;
+        EventBits_t bits = xEventGroupWaitBits(bay->lim_events, mask | abort, pdTRUE, pdFALSE, pdMS_TO_TICKS(remaining_ms) + 1);
+        if (bits & abort)
+            return -2;
+        if (!(bits & mask))
+            resync_levels(bay, mask);
+    }
+}
+
+void abort_switch_waits(struct bay *bay)
+{ // Latched, a fault before the wait starts still fails it
+    xEventGroupSetBits(bay->lim_events, LIM_ABORT_BIT);
+}
+
+void arm_switch_waits(struct bay *bay)
+{ // Motor starting, a fault from an earlier move or while idle has nothing to do with this one
+    xEventGroupClearBits(bay->lim_events, LIM_ABORT_BIT);
+}
+
+int lim_comm(int argc, char **argv)
+{
+    if (argc >= 2 && !strcmp(argv[1], "reset"))
+    { // After a switch is replaced
+        int sw = argc >= 3 ? atoi(argv[2]) - 1 : -1;
+        if (sw < 0 || sw >= BAY_NUM_LIM)
+        {
+            printf("Usage: lim reset <1-%d> [bay]\n", BAY_NUM_LIM);
+            return 1;
+        }
+        struct bay *bay = bay_from_arg(argc, argv, 3);
+        if (bay == NULL)
+            return 1;
+        atomic_store(&lim_db[bay->index][sw].actuations, 0);
+        atomic_store(&lim_db[bay->index][sw].bounces, 0);
+        printf("Bay %d LIM%d wear counters cleared\n", bay->index, sw + 1);
+        return 0;
+    }
+    struct bay *only = NULL; // All bays unless one is named
+    if (argc >= 2 && (only = bay_from_arg(argc, argv, 1)) == NULL)
+        return 1;
+    for (int i = 0; i < NUM_BAYS; i++)
+    {
+        if (only && only->index != i)
+            continue;
+        uint32_t levels = get_lim_switch_levels(&bays[i]);
+        printf("Bay %d\n%-6s %6s %9s %10s %10s %9s %8s\n", i, "", "level", "window ms", "presses", "bounces",
+               "bounce/p", "life %");
+        for (int sw = 0; sw < BAY_NUM_LIM; sw++)
+        {
+            const struct lim_debounce *db = &lim_db[i][sw];
+            uint32_t presses = atomic_load(&db->actuations);
+            uint32_t bounces = atomic_load(&db->bounces);
+            printf("LIM%d   %6d %9u %10u %10u %9.2f %8.2f\n", sw + 1, (levels & BIT(sw)) ? 1 : 0,
+                   (unsigned)(db->window_us / 1000), (unsigned)presses, (unsigned)bounces,
+                   presses ? (double)bounces / presses : 0.0, 100.0 * presses / LIM_RATED_ACTUATIONS);
+        }
+    }
+    return 0;
+}
@@ -23,61 +23,56 @@
 #include "cmd_system.h"
 
 #include "lv_controller.h"
+#include "bay.h"
+#include "actuator.h"
 #include "commands.h"
 #include "nfc_module.h"
 #include "ring_light.h"
 #include "limit_switches.h"
 #include "state_machine.h"
+#include "motion_profile.h"
+#include "motor_monitor.h"
+#include "solenoid.h"
+#include "sled_estimator.h"
+#include "bay_journal.h"
+#include "cycle.h"
+#include "stats.h"
+#include "allow_list.h"
+#include "trace.h"
 
 /* MACROS */
 #define SENDER_HOST SPI2_HOST
 #define PIN_NUM_MISO 12
 #define PIN_NUM_MOSI 7
-#define PIN_NUM_CLK 6
-#define PIN_NUM_CS 5
+#define PIN_NUM_CLK 6 // Each bay's L9958 CS is in its bay config
 
 /* GLOBALS */
 static const char *TAG = "main";
-TaskHandle_t nfc_module_task_handle = NULL;
-TaskHandle_t state_machine_task_handle = NULL;
 
 /* INITS */
-static void init_GPIO(void)
+static void init_GPIO(struct bay *bay)
 {
-    // Set solenoid output
-    gpio_set_direction(GPIO_NUM_38, GPIO_MODE_OUTPUT);
-
-    // Set limit switch inputs
-    gpio_set_direction(LIM1_GPIO, GPIO_MODE_INPUT); // LIM1
-    gpio_pulldown_dis(LIM1_GPIO);
-    gpio_pullup_en(LIM1_GPIO);
-    gpio_set_intr_type(LIM1_GPIO, GPIO_INTR_NEGEDGE);
-
-    gpio_set_direction(LIM2_GPIO, GPIO_MODE_INPUT); // LIM2
-    gpio_pulldown_dis(LIM2_GPIO);
-    gpio_pullup_en(LIM2_GPIO);
-    gpio_set_intr_type(LIM2_GPIO, GPIO_INTR_NEGEDGE);
-
-    gpio_set_direction(LIM3_GPIO, GPIO_MODE_INPUT); // LIM3
-    gpio_pulldown_dis(LIM3_GPIO);
-    gpio_pullup_en(LIM3_GPIO);
-    gpio_set_intr_type(LIM3_GPIO, GPIO_INTR_NEGEDGE);
-
-    gpio_set_direction(LIM4_GPIO, GPIO_MODE_INPUT); // LIM4
-    gpio_pulldown_dis(LIM4_GPIO);
-    gpio_pullup_en(LIM4_GPIO);
-    gpio_set_intr_type(LIM4_GPIO, GPIO_INTR_NEGEDGE);
+    const struct bay_config *cfg = bay->cfg;
+
+    // Set limit switch inputs, both edges so the level snapshot tracks presses and releases
+    for (int sw = 0; sw < BAY_NUM_LIM; sw++)
+    {
+        gpio_set_direction(cfg->lim_gpio[sw], GPIO_MODE_INPUT); // LIM1-4
+        gpio_pulldown_dis(cfg->lim_gpio[sw]);
+        gpio_pullup_en(cfg->lim_gpio[sw]);
+        gpio_set_intr_type(cfg->lim_gpio[sw], GPIO_INTR_ANYEDGE);
+    }
 
     // Set sled control outputs
-    gpio_set_direction(GPIO_NUM_1, GPIO_MODE_OUTPUT); // EN
-    gpio_set_direction(GPIO_NUM_2, GPIO_MODE_OUTPUT); // DI
-    gpio_set_direction(GPIO_NUM_3, GPIO_MODE_OUTPUT); // PWM
-    gpio_set_direction(GPIO_NUM_4, GPIO_MODE_OUTPUT); // DIR
+    gpio_set_direction(cfg->en_gpio, GPIO_MODE_OUTPUT);  // EN
+    gpio_set_direction(cfg->di_gpio, GPIO_MODE_OUTPUT);  // DI
+    gpio_set_direction(cfg->pwm_gpio, GPIO_MODE_OUTPUT); // PWM
+    gpio_set_direction(cfg->dir_gpio, GPIO_MODE_OUTPUT); // DIR
 }
 
 static void ledc_init(void)
 {
-    // Prepare and then apply the LEDC PWM timer configuration
+    // Prepare and then apply the LEDC PWM timer configuration, shared by every bay's motor
     ledc_timer_config_t ledc_timer = {
         .speed_mode = LEDC_MODE,
         .timer_num = LEDC_TIMER_0,
@@ -87,15 +82,18 @@ static void ledc_init(void)
     ESP_ERROR_CHECK(ledc_timer_config(&ledc_timer));
 
     // Prepare and then apply the LEDC PWM channel configuration
-    ledc_channel_config_t ledc_channel = {
-        .speed_mode = LEDC_MODE,
-        .channel = LEDC_CHANNEL_0,
-        .timer_sel = LEDC_TIMER_0,
-        .intr_type = LEDC_INTR_DISABLE,
-        .gpio_num = LEDC_GPIO,
-        .duty = 0, // Set duty to 0%
-        .hpoint = 0};
-    ESP_ERROR_CHECK(ledc_channel_config(&ledc_channel));
+    for (int i = 0; i < NUM_BAYS; i++)
+    {
+        ledc_channel_config_t ledc_channel = {
+            .speed_mode = LEDC_MODE,
+            .channel = bays[i].cfg->motor_channel,
+            .timer_sel = LEDC_TIMER_0,
+            .intr_type = LEDC_INTR_DISABLE,
+            .gpio_num = bays[i].cfg->pwm_gpio,
+            .duty = 0, // Set duty to 0%
+            .hpoint = 0};
+        ESP_ERROR_CHECK(ledc_channel_config(&ledc_channel));
+    }
 }
 
 static void initialize_nvs(void)
@@ -154,7 +152,7 @@ static void register_commands(void)
     esp_console_cmd_t lock_solenoid_cmd = {
         .command = "lock_solenoid",
         .help = "Sets solenoid bolt to locked state",
-        .hint = NULL,
+        .hint = "[bay]",
         .func = lock_solenoid_comm,
         .argtable = NULL,
     };
@@ -168,7 +166,7 @@ static void register_commands(void)
     esp_console_cmd_t unlock_solenoid_cmd = {
         .command = "unlock_solenoid",
         .help = "Sets solenoid bolt to unlocked state",
-        .hint = NULL,
+        .hint = "[bay]",
         .func = unlock_solenoid_comm,
         .argtable = NULL,
     };
@@ -180,9 +178,11 @@ static void register_commands(void)
 
     /* Set Motor PWM */
     struct arg_int *duty;
+    struct arg_int *pwm_bay;
     struct arg_end *end_pwm;
     void *set_pwm_argtable[] = {
-        duty = arg_intn(NULL, NULL, "<duty>", 1, 2, "duty-cycle"),
+        duty = arg_intn(NULL, NULL, "<duty>", 1, 1, "duty-cycle"),
+        pwm_bay = arg_int0(NULL, NULL, "<bay>", "bay, 0 if omitted"),
         end_pwm = arg_end(10),
     };
 
@@ -199,11 +199,166 @@ static void register_commands(void)
         printf("Error resgistering 'set_pwn' command\n");
     }
 
+    /* Set Sled Motion Profile */
+    esp_console_cmd_t set_profile_cmd = {
+        .command = "set_profile",
+        .help = "Show or set the sled trapezoid: <accel_ms> <cruise_duty> <cruise_ms> <decel_ms> <approach_duty>",
+        .hint = NULL,
+        .func = set_profile_comm,
+        .argtable = NULL,
+    };
+    ret = esp_console_cmd_register(&set_profile_cmd);
+    if (ret != ESP_OK)
+    {
+        printf("Error resgistering 'set_profile' command\n");
+    }
+
+    /* Event Trace */
+    esp_console_cmd_t trace_cmd = {
+        .command = "trace",
+        .help = "Trace status, 'trace dump' prints the ring for tools/trace_decode.py, 'trace stream on|off', 'trace clear'",
+        .hint = NULL,
+        .func = trace_comm,
+        .argtable = NULL,
+    };
+    ret = esp_console_cmd_register(&trace_cmd);
+    if (ret != ESP_OK)
+    {
+        printf("Error resgistering 'trace' command\n");
+    }
+
+    /* Sled Position Estimator */
+    esp_console_cmd_t sled_est_cmd = {
+        .command = "sled_est",
+        .help = "Print every bay's estimated sled position and learned travel times, 'sled_est reset [bay]' to forget them",
+        .hint = NULL,
+        .func = sled_est_comm,
+        .argtable = NULL,
+    };
+    ret = esp_console_cmd_register(&sled_est_cmd);
+    if (ret != ESP_OK)
+    {
+        printf("Error resgistering 'sled_est' command\n");
+    }
+
+    /* Bay State Journal */
+    esp_console_cmd_t journal_cmd = {
+        .command = "journal",
+        .help = "Print every bay's last journaled state and write counts, 'journal clear [bay]' to forget it",
+        .hint = NULL,
+        .func = journal_comm,
+        .argtable = NULL,
+    };
+    ret = esp_console_cmd_register(&journal_cmd);
+    if (ret != ESP_OK)
+    {
+        printf("Error resgistering 'journal' command\n");
+    }
+
+    /* Cycle Script */
+    esp_console_cmd_t cycle_cmd = {
+        .command = "cycle",
+        .help = "Print every bay's cycle script step, 'cycle on|off [bay]' to run it or hand taps back to the NFC sequence",
+        .hint = NULL,
+        .func = cycle_comm,
+        .argtable = NULL,
+    };
+    ret = esp_console_cmd_register(&cycle_cmd);
+    if (ret != ESP_OK)
+    {
+        printf("Error resgistering 'cycle' command\n");
+    }
+
+    esp_console_cmd_t gate_cmd = {
+        .command = "gate",
+        .help = "Release a cycle script gate: charger_on or charger_clear",
+        .hint = "<gate> [bay]",
+        .func = gate_comm,
+        .argtable = NULL,
+    };
+    ret = esp_console_cmd_register(&gate_cmd);
+    if (ret != ESP_OK)
+    {
+        printf("Error resgistering 'gate' command\n");
+    }
+
+    /* Latency Histograms */
+    esp_console_cmd_t stats_cmd = {
+        .command = "stats",
+        .help = "Print every bay's latency histograms (p50/p90/p99/max), 'stats reset [bay]' to clear them",
+        .hint = "[reset] [bay]",
+        .func = stats_comm,
+        .argtable = NULL,
+    };
+    ret = esp_console_cmd_register(&stats_cmd);
+    if (ret != ESP_OK)
+    {
+        printf("Error resgistering 'stats' command\n");
+    }
+
+    /* Limit Switch Wear */
+    esp_console_cmd_t lim_cmd = {
+        .command = "lim",
+        .help = "Print every bay's switch levels, debounce windows and wear counters, 'lim reset <1-4> [bay]' after replacing a switch",
+        .hint = "[reset <1-4>] [bay]",
+        .func = lim_comm,
+        .argtable = NULL,
+    };
+    ret = esp_console_cmd_register(&lim_cmd);
+    if (ret != ESP_OK)
+    {
+        printf("Error resgistering 'lim' command\n");
+    }
+
+    /* Tag Allow-List */
+    esp_console_cmd_t allow_cmd = {
+        .command = "allow",
+        .help = "Print the tag allow-list, or 'allow add|del|check <uid hex>...' and 'allow clear' to change it",
+        .hint = "[add|del|check <uid>...|clear]",
+        .func = allow_comm,
+        .argtable = NULL,
+    };
+    ret = esp_console_cmd_register(&allow_cmd);
+    if (ret != ESP_OK)
+    {
+        printf("Error resgistering 'allow' command\n");
+    }
+
+    /* NFC Reader Link */
+    esp_console_cmd_t nfc_cmd = {
+        .command = "nfc",
+        .help = "Print each bay's PN532 UART rate and command round trip times at every rate it has used",
+        .hint = "[bay]",
+        .func = nfc_comm,
+        .argtable = NULL,
+    };
+    ret = esp_console_cmd_register(&nfc_cmd);
+    if (ret != ESP_OK)
+    {
+        printf("Error resgistering 'nfc' command\n");
+    }
+
+    /* Motor Driver Diagnostics */
+    esp_console_cmd_t motor_diag_cmd = {
+        .command = "motor_diag",
+        .help = "Print each bay's L9958 diagnostic register and sled fault counts",
+        .hint = NULL,
+        .func = motor_diag_comm,
+        .argtable = NULL,
+    };
+    ret = esp_console_cmd_register(&motor_diag_cmd);
+    if (ret != ESP_OK)
+    {
+        printf("Error resgistering 'motor_diag' command\n");
+    }
+
     /* Set Motor DIR */
     struct arg_int *dir;
+    struct arg_int *dir_bay;
     struct arg_end *end_dir;
     void *set_dir_argtable[] = {
         dir = arg_intn(NULL, NULL, "<dir>", 1, 1, "direction of motor"),
+        dir_bay = arg_int0(NULL, NULL, "<bay>", "bay, 0 if omitted"),
         end_dir = arg_end(10),
     };
 
@@ -224,7 +379,7 @@ static void register_commands(void)
     esp_console_cmd_t en_mtr_output_cmd = {
         .command = "en_mtr_output",
         .help = "Enables the motor output",
-        .hint = NULL,
+        .hint = "[bay]",
         .func = enable_motor_output,
         .argtable = NULL,
     };
@@ -238,7 +393,7 @@ static void register_commands(void)
     esp_console_cmd_t dis_mtr_output_cmd = {
         .command = "dis_mtr_output",
         .help = "Disables the motor output",
-        .hint = NULL,
+        .hint = "[bay]",
         .func = disable_motor_output,
         .argtable = NULL,
     };
@@ -252,7 +407,7 @@ static void register_commands(void)
     esp_console_cmd_t rainbow_chase_start_cmd = {
         .command = "rainbow_chase_start",
         .help = "Start rRainbow chase on ring light",
-        .hint = NULL,
+        .hint = "[bay]",
         .func = rainbow_chase_start_comm,
         .argtable = NULL,
     };
@@ -266,7 +421,7 @@ static void register_commands(void)
     esp_console_cmd_t rainbow_chase_stop_cmd = {
         .command = "rainbow_chase_stop",
         .help = "Stop rainbow chase on ring light",
-        .hint = NULL,
+        .hint = "[bay]",
         .func = rainbow_chase_stop_comm,
         .argtable = NULL,
     };
@@ -280,7 +435,7 @@ static void register_commands(void)
     esp_console_cmd_t white_leds_cmd = {
         .command = "white_leds",
         .help = NULL,
-        .hint = NULL,
+        .hint = "[bay]",
         .func = set_white_leds,
         .argtable = NULL,
     };
@@ -294,7 +449,7 @@ static void register_commands(void)
     esp_console_cmd_t leds_off_cmd = {
         .command = "leds_off",
         .help = NULL,
-        .hint = NULL,
+        .hint = "[bay]",
         .func = leds_off_comm,
         .argtable = NULL,
     };
@@ -308,7 +463,7 @@ static void register_commands(void)
     esp_console_cmd_t sled_out_cmd = {
         .command = "sled_out",
         .help = NULL,
-        .hint = NULL,
+        .hint = "[bay]",
         .func = sled_out_comm,
         .argtable = NULL,
     };
@@ -322,7 +477,7 @@ static void register_commands(void)
     esp_console_cmd_t sled_in_cmd = {
         .command = "sled_in",
         .help = NULL,
-        .hint = NULL,
+        .hint = "[bay]",
         .func = sled_in_comm,
         .argtable = NULL,
     };
@@ -336,7 +491,7 @@ static void register_commands(void)
     esp_console_cmd_t stop_sled_cmd = {
         .command = "stop_sled",
         .help = NULL,
-        .hint = NULL,
+        .hint = "[bay]",
         .func = stop_sled_comm,
         .argtable = NULL,
     };
@@ -350,7 +505,7 @@ static void register_commands(void)
     esp_console_cmd_t heartbeat_start_cmd = {
         .command = "heartbeat_start",
         .help = NULL,
-        .hint = NULL,
+        .hint = "[bay]",
         .func = heartbeat_start_comm,
         .argtable = NULL,
     };
@@ -364,7 +519,7 @@ static void register_commands(void)
     esp_console_cmd_t heartbeat_stop_cmd = {
         .command = "heartbeat_stop",
         .help = NULL,
-        .hint = NULL,
+        .hint = "[bay]",
         .func = heartbeat_stop_comm,
         .argtable = NULL,
     };
@@ -379,7 +534,7 @@ static void register_commands(void)
     esp_console_cmd_t to_unlockedem_cmd = {
         .command = "to_unlockedem",
         .help = NULL,
-        .hint = NULL,
+        .hint = "[bay]",
         .func = to_unlockedem_comm,
         .argtable = NULL,
     };
@@ -393,7 +548,7 @@ static void register_commands(void)
     esp_console_cmd_t to_loading_cmd = {
         .command = "to_loading",
         .help = NULL,
-        .hint = NULL,
+        .hint = "[bay]",
         .func = to_loading_comm,
         .argtable = NULL,
     };
@@ -407,7 +562,7 @@ static void register_commands(void)
     esp_console_cmd_t to_closed_cmd = {
         .command = "to_closed",
         .help = NULL,
-        .hint = NULL,
+        .hint = "[bay]",
         .func = to_closed_comm,
         .argtable = NULL,
     };
@@ -421,7 +576,7 @@ static void register_commands(void)
     esp_console_cmd_t to_compvision_cmd = {
         .command = "to_compvision",
         .help = NULL,
-        .hint = NULL,
+        .hint = "[bay]",
         .func = to_compvision_comm,
         .argtable = NULL,
     };
@@ -435,7 +590,7 @@ static void register_commands(void)
     esp_console_cmd_t to_charging_cmd = {
         .command = "to_charging",
         .help = NULL,
-        .hint = NULL,
+        .hint = "[bay]",
         .func = to_charging_comm,
         .argtable = NULL,
     };
@@ -449,7 +604,7 @@ static void register_commands(void)
     esp_console_cmd_t to_unlocked_cmd = {
         .command = "to_unlocked",
         .help = NULL,
-        .hint = NULL,
+        .hint = "[bay]",
         .func = to_unlocked_comm,
         .argtable = NULL,
     };
@@ -463,7 +618,7 @@ static void register_commands(void)
     esp_console_cmd_t to_unloading_cmd = {
         .command = "to_unloading",
         .help = NULL,
-        .hint = NULL,
+        .hint = "[bay]",
         .func = to_unloading_comm,
         .argtable = NULL,
     };
@@ -477,7 +632,7 @@ static void register_commands(void)
     esp_console_cmd_t to_empty_cmd = {
         .command = "to_empty",
         .help = NULL,
-        .hint = NULL,
+        .hint = "[bay]",
         .func = to_empty_comm,
         .argtable = NULL,
     };
@@ -492,8 +647,16 @@ void app_main(void)
 {
     ESP_LOGI(TAG, "LV Controller Starting");
 
+    /* Event tracing, records are kept in RAM until dumped */
+    init_trace();
+
+    /* Bay contexts, everything below is set up for every bay */
+    init_bays();
+
     /* GPIO Init */
-    init_GPIO();
+    for (int i = 0; i < NUM_BAYS; i++)
+        init_GPIO(&bays[i]);
+    init_actuators();
 
     /* Ring Light Init */
     init_ring_light();
@@ -501,11 +664,23 @@ void app_main(void)
     /* PWM Init */
     gpio_set_direction(GPIO_NUM_17, GPIO_MODE_OUTPUT); // for debug PWM LED only
     ledc_init();
+    init_motion_profile();
+    init_solenoid(); // Solenoid outputs are driven by their own LEDC channels
 
     /* USB CONSOLE */
     initialize_nvs();
     initialize_console();
 
+    /* Sled position estimator, learned travel times live in NVS */
+    init_sled_estimator();
+
+    /* Bay state journal, replayed by the state machine when it starts */
+    init_bay_journal();
+    init_stats();
+
+    /* Tags allowed to claim a bay, mapped from its own flash partition */
+    init_allow_list();
+
     /* Register commands */
     esp_console_register_help_command();
     register_system_common();
@@ -513,15 +688,23 @@ void app_main(void)
     register_nvs();
     register_commands();
 
-    /* L9958 Motor Driver SPI bus setup */ // TODO
+    /* L9958 Motor Driver SPI bus setup */
     esp_err_t err;
-    spi_device_handle_t spi;
     spi_bus_config_t buscfg = {
         .miso_io_num = PIN_NUM_MISO,
         .mosi_io_num = PIN_NUM_MOSI,
         .sclk_io_num = PIN_NUM_CLK,
         .quadwp_io_num = -1,
         .quadhd_io_num = -1};
+    err = spi_bus_initialize(SENDER_HOST, &buscfg, SPI_DMA_CH_AUTO);
+    if (err == ESP_OK)
+    {
+        init_motor_monitor(SENDER_HOST);
+    }
+    else
+    {
+        ESP_LOGE(TAG, "L9958 SPI bus init failed: %s", esp_err_to_name(err));
+    }
 
     /* Prompt to be printed before each line.
      * This can be customized, made dynamic, etc.
@@ -552,16 +735,21 @@ void app_main(void)
     }
 
     /* Turn LEDs off on startup */
-    leds_off_comm(0, NULL);
-
-    /* NFC Module Task */
-    xTaskCreate(read_single_nfc_tag, "read_single_nfc_tag", 4096, NULL, 10, &nfc_module_task_handle);
+    for (int i = 0; i < NUM_BAYS; i++)
+        leds_off(&bays[i]);
 
     /* Limit Switches Task */
     init_limit_switches();
 
     /* State Machine Task */
-    // xTaskCreate(state_machine, "state_machine", 4096, NULL, 10, &state_machine_task_handle);
+    init_state_machine();
+
+    /* Cycle Script Tasks, one per bay */
+    init_cycle();
+
+    /* NFC Module Tasks, one reader per bay */
+    for (int i = 0; i < NUM_BAYS; i++)
+        xTaskCreate(read_single_nfc_tag, "read_single_nfc_tag", 4096, &bays[i], 10, NULL);
 
     /* Main loop */
     while (true)
@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "driver/ledc.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+#include "bay.h"
+#include "motion_profile.h"
+#include "commands.h"
+#include "sled_estimator.h"
+#include "trace.h"
+
+static const char *TAG = "motion_profile";
+
+static struct motion_profile profile = {
+    .accel_ms = PROFILE_ACCEL_MS,
+    .cruise_duty = PROFILE_CRUISE_DUTY,
+    .cruise_ms = PROFILE_CRUISE_MS,
+    .decel_ms = PROFILE_DECEL_MS,
+    .approach_duty = PROFILE_APPROACH_DUTY,
+};
+
+static void fade_to(struct bay *bay, int duty, int ms)
+{ // Hand the ramp to the LEDC fade hardware, returns immediately
+    ledc_channel_t channel = bay->cfg->motor_channel;
+    ledc_fade_stop(LEDC_MODE, channel);
+    if (ms <= 0)
+    {
+        ESP_ERROR_CHECK(ledc_set_duty(LEDC_MODE, channel, calc_bits_from_duty(duty)));
+        ESP_ERROR_CHECK(ledc_update_duty(LEDC_MODE, channel));
+        return;
+    }
+    ESP_ERROR_CHECK(ledc_set_fade_with_time(LEDC_MODE, channel, calc_bits_from_duty(duty), ms));
+    ESP_ERROR_CHECK(ledc_fade_start(LEDC_MODE, channel, LEDC_FADE_NO_WAIT));
+}
+
+static void approach_timer_cb(void *arg)
+{
+    motion_profile_approach(arg);
+}
+
+void init_motion_profile(void)
+{
+    ESP_ERROR_CHECK(ledc_fade_func_install(0));
+    for (int i = 0; i < NUM_BAYS; i++)
+    {
+        esp_timer_create_args_t args = {
+            .callback = approach_timer_cb,
+            .arg = &bays[i],
+            .name = "approach",
+        };
+        ESP_ERROR_CHECK(esp_timer_create(&args, &bays[i].approach_timer));
+    }
+}
+
+void motion_profile_start(struct bay *bay)
+{ // Motor output must be enabled by the caller, duty starts from 0
+    esp_timer_stop(bay->approach_timer);
+    fade_to(bay, 0, 0);
+    fade_to(bay, profile.cruise_duty, profile.accel_ms);
+    if (profile.cruise_ms > 0)
+        esp_timer_start_once(bay->approach_timer, (profile.accel_ms + profile.cruise_ms) * 1000ULL);
+}
+
+void motion_profile_approach(struct bay *bay)
+{ // Slow to creep speed for the end of travel
+    esp_timer_stop(bay->approach_timer);
+    TRACE_BAY(bay->index, TR_APPROACH, profile.approach_duty, sled_estimator_position(bay));
+    fade_to(bay, profile.approach_duty, profile.decel_ms);
+}
+
+void motion_profile_stop(struct bay *bay)
+{
+    esp_timer_stop(bay->approach_timer);
+    fade_to(bay, 0, 0);
+}
+
+void set_motion_profile(const struct motion_profile *p)
+{
+    profile = *p;
+}
+
+void get_motion_profile(struct motion_profile *p)
+{
+    *p = profile;
+}
+
+int set_profile_comm(int argc, char **argv)
+{
+    // Expecting accel_ms cruise_duty cruise_ms decel_ms approach_duty
+    if (argc != 6)
+    {
+        printf("Profile: accel %d ms, cruise %d%% for %d ms, decel %d ms, approach %d%%\n",
+               profile.accel_ms, profile.cruise_duty, profile.cruise_ms, profile.decel_ms, profile.approach_duty);
+        return 0;
+    }
+    struct motion_profile p = {
+        .accel_ms = atoi(argv[1]),
+        .cruise_duty = atoi(argv[2]),
+        .cruise_ms = atoi(argv[3]),
+        .decel_ms = atoi(argv[4]),
+        .approach_duty = atoi(argv[5]),
+    };
+    if (p.cruise_duty < 0 || p.cruise_duty > 100 || p.approach_duty < 0 || p.approach_duty > 100 ||
+        p.accel_ms < 0 || p.cruise_ms < 0 || p.decel_ms < 0)
+    {
+        printf("Invalid profile\n");
+        ESP_LOGE(TAG, "Invalid profile");
+        return 0;
+    }
+    set_motion_profile(&p);
+    return 0;
+}
@@ -1,49 +1,81 @@
+#include "esp_attr.h"
 
-
+#include "bay.h"
+#include "actuator.h"
 #include "motor.h"
 #include "commands.h"
+#include "limit_switches.h"
+#include "motion_profile.h"
+#include "sled_estimator.h"
+#include "trace.h"
+
+static void arm_reflex(struct bay *bay, int sw)
+{ // The limit switch ISR cuts the motor when this switch closes
+    bay->reflex_sw = sw;
+    // If the switch is already closed there will be no edge, fire now
+    if (!(get_lim_switch_levels(bay) & BIT(sw)))
+        sled_reflex_from_isr(bay, sw, 0);
+}
+
+bool IRAM_ATTR sled_reflex_from_isr(struct bay *bay, int sw, int level)
+{ // Called first thing in the limit switch ISR, register writes only
+    if (sw != bay->reflex_sw || level)
+        return false;
+    // EN low and DI high in the same write to disable output
+    act_apply_from_isr(bay, ACT_EN_BIT | ACT_DI_BIT, ACT_DI_BIT);
+    bay->reflex_sw = -1;
+    bay->reflex_count++;
+    bay->sled_moving = false;
+    return true;
+}
+
+uint32_t get_sled_reflex_count(struct bay *bay)
+{
+    return bay->reflex_count;
+}
+
+bool is_sled_moving(struct bay *bay)
+{
+    return bay->sled_moving;
+}
 
-#define MTR_FWD 1
-#define MTR_REV 0
-#define STD_DUTY_CYCLE 100
+static const struct act_cmd motor_out = ACT_CMD(ACT_MOTOR_BITS, ACT_MOTOR_OUT);
+static const struct act_cmd motor_in = ACT_CMD(ACT_MOTOR_BITS, ACT_MOTOR_IN);
+static const struct act_cmd motor_off = ACT_CMD(ACT_MOTOR_BITS, ACT_MOTOR_OFF);
 
-void sled_out(void)
+void sled_out(struct bay *bay)
 {
-    // Set motor direction
-    ESP_ERROR_CHECK(gpio_set_level(DIR_GPIO, MTR_FWD));
-    printf("Set motor direction to Forward (1)\n");
-
-    // Set duty cycle for PWM
-    ESP_ERROR_CHECK(ledc_set_duty(LEDC_MODE, LEDC_CHANNEL, calc_bits_from_duty(STD_DUTY_CYCLE)));
-    // Update duty to apply the new value
-    ESP_ERROR_CHECK(ledc_update_duty(LEDC_MODE, LEDC_CHANNEL));
-
-    // Set EN high and DI low to enable output
-    ESP_ERROR_CHECK(gpio_set_level(EN_GPIO, 1));
-    ESP_ERROR_CHECK(gpio_set_level(DI_GPIO, 0));
-    printf("Enabling motor output...\n");
+    TRACE_BAY(bay->index, TR_SLED_OUT, 0, 0);
+    arm_switch_waits(bay);
+    // Direction, EN high and DI low together, duty ramps up from 0
+    act_apply(bay, &motor_out);
+    bay->sled_moving = true;
+    sled_estimator_start(bay, SLED_DIR_OUT);
+    motion_profile_start(bay);
+    // Stop at SLED OUT (LIM1)
+    arm_reflex(bay, LIM1);
 }
 
-void sled_in(void)
+void sled_in(struct bay *bay)
 {
-    ESP_ERROR_CHECK(gpio_set_level(DIR_GPIO, MTR_REV));
-    printf("Set motor direction to Reverse (0)\n");
-
-    // Set duty cycle for PWM
-    ESP_ERROR_CHECK(ledc_set_duty(LEDC_MODE, LEDC_CHANNEL, calc_bits_from_duty(STD_DUTY_CYCLE)));
-    // Update duty to apply the new value
-    ESP_ERROR_CHECK(ledc_update_duty(LEDC_MODE, LEDC_CHANNEL));
-
-    // Set EN high and DI low to enable output
-    ESP_ERROR_CHECK(gpio_set_level(EN_GPIO, 1));
-    ESP_ERROR_CHECK(gpio_set_level(DI_GPIO, 0));
-    printf("Enabling motor output...\n");
+    TRACE_BAY(bay->index, TR_SLED_IN, 0, 0);
+    arm_switch_waits(bay);
+    // Direction, EN high and DI low together, duty ramps up from 0
+    act_apply(bay, &motor_in);
+    bay->sled_moving = true;
+    sled_estimator_start(bay, SLED_DIR_IN);
+    motion_profile_start(bay);
+    // Stop at SLED IN (LIM3)
+    arm_reflex(bay, LIM3);
 }
 
-void stop_sled(void)
+void stop_sled(struct bay *bay)
 {
-    // Set EN low and DI high to disable output
-    ESP_ERROR_CHECK(gpio_set_level(EN_GPIO, 0));
-    ESP_ERROR_CHECK(gpio_set_level(DI_GPIO, 1));
-    printf("Disabling motor output...\n");
+    bay->reflex_sw = -1;
+    bay->sled_moving = false;
+    // EN low and DI high to disable output
+    act_apply(bay, &motor_off);
+    motion_profile_stop(bay);
+    sled_estimator_stop(bay);
+    TRACE_BAY(bay->index, TR_SLED_STOP, 0, 0);
 }
@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "bay.h"
+#include "motor_monitor.h"
+#include "motor.h"
+#include "limit_switches.h"
+#include "l9958.h"
+#include "trace.h"
+
+struct motor_monitor
+{
+    l9958_t *l9958;
+    volatile int last_diag;
+    uint32_t stall_count;
+    uint32_t open_load_count;
+    uint32_t overcurrent_count;
+    uint32_t thermal_count;
+    uint32_t floating_count; // Diag words that read all ones, skipped
+};
+
+/* GLOBALS */
+static const char *TAG = "motor_monitor";
+static struct motor_monitor mon_ctx[NUM_BAYS];
+
+void init_motor_monitor(spi_host_device_t host)
+{ // Every bay's L9958 shares the bus, each on its own CS
+    for (int i = 0; i < NUM_BAYS; i++)
+    {
+        struct bay *bay = &bays[i];
+        if (bay->cfg->l9958_cs < 0)
+            continue;
+        struct motor_monitor *mon = &mon_ctx[i];
+        mon->l9958 = l9958_init(host, bay->cfg->l9958_cs, L9958_CFG_DEFAULT);
+        if (mon->l9958 == NULL)
+        {
+            ESP_LOGE(TAG, "Bay %d L9958 NOT Initialized, motor monitoring disabled...", i);
+            continue;
+        }
+        ESP_LOGI(TAG, "Bay %d L9958 Initialized", i);
+        bay->mon = mon;
+        xTaskCreate(motor_monitor, "motor_monitor", 2048, bay, 11, NULL);
+    }
+}
+
+static void motor_fault(struct bay *bay, const char *what, uint32_t *count, int diag)
+{
+    // Stop first, then fail whatever transition is waiting on an end switch
+    stop_sled(bay);
+    abort_switch_waits(bay);
+    (*count)++;
+    TRACE_BAY(bay->index, TR_MOTOR_FAULT, diag, 0);
+    ESP_LOGE(TAG, "Bay %d sled %s, motor stopped (diag 0x%04X)", bay->index, what, diag);
+    l9958_clear_diag(bay->mon->l9958);
+}
+
+void motor_monitor(void *params)
+{
+    struct bay *bay = params;
+    struct motor_monitor *mon = bay->mon;
+    int64_t ilim_since = 0;
+    int64_t open_load_since = 0;
+    bool floating = false;
+    while (true)
+    {
+        bool moving = is_sled_moving(bay);
+        vTaskDelay(pdMS_TO_TICKS(moving ? MONITOR_MOVING_PERIOD_MS : MONITOR_IDLE_PERIOD_MS));
+
+        int diag = l9958_read_diag(mon->l9958);
+        if (diag < 0)
+        {
+            ESP_LOGE(TAG, "Bay %d diag read fail %s", bay->index, esp_err_to_name(-diag));
+            continue;
+        }
+        if (diag == L9958_DIAG_FLOATING)
+        { // Every fault bit set at once is MISO floating, not a fault. The end switches still stop the sled
+            mon->floating_count++;
+            if (!floating)
+                ESP_LOGE(TAG, "Bay %d diag reads 0x%04X, ignoring it until the L9958 answers again", bay->index, diag);
+            floating = true;
+            continue;
+        }
+        if (floating)
+            ESP_LOGW(TAG, "Bay %d diag answering again after %u floating reads", bay->index, (unsigned)mon->floating_count);
+        floating = false;
+        mon->last_diag = diag;
+        int64_t now = esp_timer_get_time();
+
+        if (diag & L9958_DIAG_OC)
+        {
+            motor_fault(bay, "overcurrent", &mon->overcurrent_count, diag);
+            continue;
+        }
+        if (diag & L9958_DIAG_TSD)
+        {
+            motor_fault(bay, "thermal shutdown", &mon->thermal_count, diag);
+            continue;
+        }
+        if (!is_sled_moving(bay))
+        {
+            ilim_since = 0;
+            open_load_since = 0;
+            continue;
+        }
+
+        // ILIM is normal for a moment at start up, only a sustained limit is a jam
+        if (!(diag & L9958_DIAG_ILIM))
+            ilim_since = 0;
+        else if (!ilim_since)
+            ilim_since = now;
+        else if (now - ilim_since >= MONITOR_STALL_MS * 1000LL)
+        {
+            ilim_since = 0;
+            motor_fault(bay, "stalled", &mon->stall_count, diag);
+            continue;
+        }
+
+        if (!(diag & L9958_DIAG_OL_ON))
+            open_load_since = 0;
+        else if (!open_load_since)
+            open_load_since = now;
+        else if (now - open_load_since >= MONITOR_OPEN_LOAD_MS * 1000LL)
+        {
+            open_load_since = 0;
+            motor_fault(bay, "open load", &mon->open_load_count, diag);
+        }
+    }
+}
+
+int motor_diag_comm(int argc, char **argv)
+{
+    for (int i = 0; i < NUM_BAYS; i++)
+    {
+        struct motor_monitor *mon = bays[i].mon;
+        if (mon == NULL)
+        {
+            printf("Bay %d L9958 not initialized\n", i);
+            continue;
+        }
+        printf("Bay %d L9958 diag: 0x%04X\n", i, mon->last_diag);
+        printf("Faults: stall %u, open load %u, overcurrent %u, thermal %u, floating reads %u\n",
+               mon->stall_count, mon->open_load_count, mon->overcurrent_count, mon->thermal_count,
+               (unsigned)mon->floating_count);
+    }
+    return 0;
+}
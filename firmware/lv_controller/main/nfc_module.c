@@ -1,9 +1,18 @@
+#include <stdio.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 
+#include "allow_list.h"
+#include "bay.h"
+#include "bay_journal.h"
+#include "cycle.h"
 #include "nfc_module.h"
 #include "state_machine.h"
 #include "pn532.h"
@@ -17,43 +26,264 @@ enum nfc_states
     WaitForBBBFin,
     Unlock,
     Unload,
-    Empty
+    Empty,
+    NUM_NFC_STATES
 };
+_Static_assert(NUM_NFC_STATES == NFC_NUM_STATES, "NFC_NUM_STATES out of date");
 
+enum nfc_poll
+{
+    POLL_LOWPOWER, // InListPassiveTarget, the PN532 powered down between polls
+    POLL_AUTO,     // InAutoPoll, the PN532 polls by itself
+    POLL_LIST,     // InListPassiveTarget with the PN532 left on
+};
+
+enum nfc_rate
+{ // Slowest last, backing off moves one down
+    RATE_FAST,   // Someone is at the bay and a tap is due
+    RATE_NORMAL, // Vacant, the next customer may walk up any time
+    RATE_SLOW,   // Bike inside, the owner is away
+    RATE_IDLE,   // Bike inside and nothing has happened for NFC_IDLE_MS
+    NUM_NFC_RATES,
+};
+
+struct nfc_profile
+{
+    const char *name;
+    uint32_t interval_ms;    // Between polls, the PN532 powered down in between
+    uint8_t passive_retries; // MxRtyPassiveActivation, field retries within one InListPassiveTarget
+    uint8_t retry_timeout;   // fRetryTimeout for exchanges with a tag, 100 us * 2^(n-1)
+};
+
+struct nfc_sched
+{
+    enum nfc_rate rate; // Profile the reader is set up for
+    enum nfc_rate base; // From the bay's state alone, before backing off
+    int64_t changed_us; // When base last changed
+    int64_t tap_us;     // Last tag detected, allowed or not
+    int64_t since_us;   // When rate was applied
+    uint64_t rate_us[NUM_NFC_RATES];
+    uint32_t changes;
+};
+
+struct nfc_io
+{ // The reader task's own command for polling and presence checks, it never holds the reader while it waits
+    pn532_cmd_t cmd;
+    uint8_t rx[64]; // InAutoPoll target data or the presence check's answer
+};
+
+/* GLOBALS */
 static const char *TAG = "nfc_module";
-pn532_t *nfc_reader = NULL;
-static enum nfc_states next_state = Vacant;
-static uint8_t curr_uid[100] = {'\0'};
-static uint8_t curr_uidLength = 0;
+static const struct nfc_profile nfc_profiles[NUM_NFC_RATES] = {
+    [RATE_FAST] = {"fast", 50, 0x02, 0x0A},
+    [RATE_NORMAL] = {"normal", 150, 0x01, 0x0A}, // What pn532_init sets up
+    [RATE_SLOW] = {"slow", 300, 0x00, 0x08},
+    [RATE_IDLE] = {"idle", 600, 0x00, 0x08},
+};
+static struct nfc_sched nfc_sched_ctx[NUM_BAYS];
+static struct nfc_io nfc_io_ctx[NUM_BAYS];
 
-int init_nfc_reader(void)
+int init_nfc_reader(struct bay *bay)
 {
-    nfc_reader = pn532_init(0, 43, 44, 0); // passing UART0, tx=43, rx=44, 0 for output bits rn
+    const struct bay_config *cfg = bay->cfg;
+    bay->nfc_reader = pn532_init(cfg->nfc_uart, cfg->nfc_tx, cfg->nfc_rx, 0); // 0 for output bits rn
 
     // 5 retries before giving up
     int count = 0;
     int MAX_NUM_RETRIES = 5;
-    while (nfc_reader == NULL)
+    while (bay->nfc_reader == NULL)
     {
-        nfc_reader = pn532_init(0, 43, 44, 0);
+        bay->nfc_reader = pn532_init(cfg->nfc_uart, cfg->nfc_tx, cfg->nfc_rx, 0);
         count++;
         if (count > MAX_NUM_RETRIES)
         {
             break;
         }
     }
-    if (nfc_reader != NULL)
+    if (bay->nfc_reader != NULL)
     {
-        ESP_LOGI(TAG, "NFC Module Initialized");
+        ESP_LOGI(TAG, "Bay %d NFC Module Initialized", bay->index);
         return 1;
     }
-    ESP_LOGE(TAG, "NFC Module NOT Initialized...");
+    ESP_LOGE(TAG, "Bay %d NFC Module NOT Initialized...", bay->index);
     return 0;
 }
 
-void read_single_nfc_tag(void *)
-{
-    int ret = init_nfc_reader();
+static enum nfc_rate nfc_pick_rate(struct bay *bay)
+{ // Fast while a tap is expected, slow while the bike is in. After NFC_IDLE_MS with nothing happening fast drops to normal and slow to idle, normal stays
+    struct nfc_sched *s = &nfc_sched_ctx[bay->index];
+    int64_t now = esp_timer_get_time();
+    enum nfc_rate rate;
+    if (s->tap_us && now - s->tap_us < NFC_ACTIVE_MS * 1000LL)
+        rate = RATE_FAST; // Just tapped, the next step or a retry after a refusal is close behind
+    else if (sm_transition_allowed(bay, T_LOADING) || sm_transition_allowed(bay, T_CLOSED) ||
+             sm_transition_allowed(bay, T_UNLOADING) || sm_transition_allowed(bay, T_EMPTY))
+        rate = RATE_FAST; // Door open, the owner is at the bay
+    else if (cycle_gate_posted(bay, CG_CHARGER_CLEAR))
+        rate = RATE_FAST; // Charge over, the owner's pickup tap is next
+    else if (sm_transition_allowed(bay, T_UNLOCKEDEM))
+        rate = RATE_NORMAL;
+    else
+        rate = RATE_SLOW; // Closed, comp. vision or charging
+    if (rate != s->base)
+    {
+        s->base = rate;
+        s->changed_us = now;
+    }
+    int64_t last = s->tap_us > s->changed_us ? s->tap_us : s->changed_us;
+    if (rate != RATE_NORMAL && now - last > NFC_IDLE_MS * 1000LL)
+        rate++; // Door left open to normal, a long charge to idle
+    return rate;
+}
+
+static const struct nfc_profile *nfc_schedule(struct bay *bay)
+{ // Reader task with the reader free, sets the RF timeouts for the rate the bay is at now
+    struct nfc_sched *s = &nfc_sched_ctx[bay->index];
+    enum nfc_rate rate = nfc_pick_rate(bay);
+    if (rate == s->rate)
+        return &nfc_profiles[rate];
+    const struct nfc_profile *pr = &nfc_profiles[rate];
+    uint8_t retries[] = {0xFF, 0x01, pr->passive_retries}; // MxRtyATR and MxRtyPSL as pn532_init leaves them
+    uint8_t timings[] = {0x00, 0x0B, pr->retry_timeout};   // RFU and fATR_RES_Timeout as pn532_init leaves them
+    int res = pn532_RFConfiguration(bay->nfc_reader, 0x05, sizeof(retries), retries);
+    if (!res)
+        res = pn532_RFConfiguration(bay->nfc_reader, 0x02, sizeof(timings), timings);
+    if (res < 0)
+    { // Tried again on the next poll
+        ESP_LOGW(TAG, "Bay %d: RFConfiguration failed (%s)", bay->index, pn532_err_to_name(-res));
+        return &nfc_profiles[s->rate];
+    }
+    int64_t now = esp_timer_get_time();
+    s->rate_us[s->rate] += now - s->since_us;
+    s->since_us = now;
+    s->rate = rate;
+    s->changes++;
+    ESP_LOGI(TAG, "Bay %d: polling %s, every %u ms", bay->index, pr->name, (unsigned)pr->interval_ms);
+    return pr;
+}
+
+static int wait_for_tag(struct bay *bay, uint8_t *uid, uint8_t *uidLength, enum nfc_poll *poll)
+{ // Falls back a mode each time one keeps failing, the reader stays in the last that worked
+    pn532_t *reader = bay->nfc_reader;
+    int errors = 0;
+    while (*poll == POLL_LOWPOWER)
+    { // Field on for one InListPassiveTarget, then the chip sleeps until the next wakes it
+        const struct nfc_profile *pr = nfc_schedule(bay);
+        int res = pn532_Cards_and_return_data(reader, uid, uidLength);
+        if (res > 0)
+            return res; // Left awake, the presence tracker needs it until the tag is gone
+        if (!res)
+            res = pn532_PowerDown(reader, 0);
+        if (res < 0)
+        {
+            ESP_LOGW(TAG, "Bay %d: low power poll failed (%s)", bay->index, pn532_err_to_name(-res));
+            if (++errors >= NFC_LOWPOWER_MAX_ERRORS)
+            {
+                ESP_LOGW(TAG, "Bay %d: leaving the reader powered, polling with InAutoPoll", bay->index);
+                *poll = POLL_AUTO;
+                break;
+            }
+        }
+        else
+            errors = 0;
+        vTaskDelay(pdMS_TO_TICKS(pr->interval_ms));
+    }
+
+    errors = 0;
+    pn532_cmd_t *c = &nfc_io_ctx[bay->index].cmd;
+    while (*poll == POLL_AUTO)
+    { // Chip polls the field itself, the task sleeps until the driver has its response
+        const struct nfc_profile *pr = nfc_schedule(bay);
+        int period = pr->interval_ms / 150; // InAutoPoll counts in 150 ms
+        int res = pn532_InAutoPoll_Submit(reader, c, period < 1 ? 1 : period);
+        if (res >= 0)
+            res = pn532_wait(c, NFC_AUTOPOLL_WAIT_MS);
+        while (res == -PN532_ERR_CMDPENDING)
+        {
+            if (nfc_pick_rate(bay) == nfc_sched_ctx[bay->index].rate)
+            {
+                res = pn532_wait(c, NFC_AUTOPOLL_WAIT_MS);
+                continue;
+            }
+            pn532_cancel(reader, c); // Start again at the new rate, unless a tag beat it
+            res = pn532_wait(c, portMAX_DELAY);
+            if (res < 0)
+                res = -PN532_ERR_ABORTED;
+        }
+        if (res >= 0)
+            res = pn532_InAutoPoll_Result(reader, c, uid, uidLength);
+        if (res > 0)
+            return res;
+        if (res == -PN532_ERR_ABORTED)
+            continue; // Another command needed the reader, poll again
+        ESP_LOGW(TAG, "Bay %d: InAutoPoll failed (%s)", bay->index, pn532_err_to_name(-res));
+        if (++errors >= NFC_AUTOPOLL_MAX_ERRORS)
+        {
+            ESP_LOGW(TAG, "Bay %d: polling with InListPassiveTarget instead", bay->index);
+            *poll = POLL_LIST;
+        }
+    }
+
+    while (true)
+    {
+        const struct nfc_profile *pr = nfc_schedule(bay);
+        int res = pn532_Cards_and_return_data(reader, uid, uidLength);
+        if (res > 0)
+            return res;
+        vTaskDelay(pdMS_TO_TICKS(pr->interval_ms));
+    }
+}
+
+static bool wait_for_removal(struct bay *bay, const uint8_t *uid, uint8_t uidLength)
+{ // Presence tracker, the tag that was just detected stays one tap until it leaves the field. False if it lost track
+    pn532_t *reader = bay->nfc_reader;
+    pn532_cmd_t *c = &nfc_io_ctx[bay->index].cmd;
+    int64_t arrived_us = esp_timer_get_time();
+    int misses = 0;
+    int errors = 0;
+    while (misses < NFC_REMOVED_MISSES && errors < NFC_PRESENCE_MAX_ERRORS)
+    {
+        vTaskDelay(pdMS_TO_TICKS(NFC_PRESENCE_MS));
+        int res = pn532_Present_Submit(reader, c); // Presence check for DESFire, InListPassiveTarget for the rest
+        if (res >= 0)
+            res = pn532_wait(c, portMAX_DELAY); // The driver times it out
+        if (res >= 0)
+            res = pn532_Present_Result(reader, c);
+        if (res < 0)
+        {
+            errors++;
+            continue;
+        }
+        errors = 0;
+        const uint8_t *id = pn532_nfcid(reader, NULL);
+        if (res > 0 && id[0] == uidLength && !memcmp(id + 1, uid, uidLength))
+            misses = 0;
+        else
+            misses++; // Empty field, or a different tag which is a new arrival once this one counts as gone
+    }
+    if (errors)
+    {
+        ESP_LOGW(TAG, "Bay %d: lost track of the tag (%s), re-arming", bay->index, pn532_err_to_name(pn532_lasterr(reader)));
+        return false;
+    }
+    ESP_LOGI(TAG, "Bay %d: tag removed after %lld ms", bay->index, (esp_timer_get_time() - arrived_us) / 1000);
+    return true;
+}
+
+void read_single_nfc_tag(void *params)
+{ // One reader task per bay
+    struct bay *bay = params;
+    enum nfc_poll poll = POLL_LOWPOWER;
+    struct nfc_sched *s = &nfc_sched_ctx[bay->index];
+    struct nfc_io *io = &nfc_io_ctx[bay->index];
+    io->cmd.done = xSemaphoreCreateBinary();
+    io->cmd.rx2 = io->rx;
+    io->cmd.max2 = sizeof(io->rx);
+    uint8_t held[16]; // Tag the tracker lost track of, it may still be on the reader
+    uint8_t held_len = 0;
+    int ret = init_nfc_reader(bay) && io->cmd.done;
+    s->rate = s->base = RATE_NORMAL;
+    s->since_us = s->changed_us = esp_timer_get_time();
     if (ret)
     {
         printf("Searching for tags...\n");
@@ -63,18 +293,21 @@ void read_single_nfc_tag(void *)
     {
         uint8_t uid[100] = {};
         uint8_t uidLength;
-        if (nfc_reader == NULL)
+        if (bay->nfc_reader == NULL)
         {
             printf("NFC Reader is NULL");
         }
 
-        int res = pn532_Cards_and_return_data(nfc_reader, &uid[0], &uidLength);
-        while (res <= 0)
-        {
-            res = pn532_Cards_and_return_data(nfc_reader, &uid[0], &uidLength);
-            // usleep(2000000);
-            vTaskDelay(pdMS_TO_TICKS(500));
+        wait_for_tag(bay, &uid[0], &uidLength, &poll);
+        if (held_len && uidLength == held_len && !memcmp(uid, held, held_len))
+        { // Still the same tag, not a tap until a clean check has seen it gone
+            ESP_LOGW(TAG, "Bay %d: held tag seen again, ignored", bay->index);
+            if (wait_for_removal(bay, uid, uidLength))
+                held_len = 0;
+            continue;
         }
+        held_len = 0;
+        s->tap_us = esp_timer_get_time();
 
         char uid_str[16 * 4];
         int index = 0;
@@ -83,75 +316,116 @@ void read_single_nfc_tag(void *)
             index += sprintf(&uid_str[index], "%d ", uid[i]);
         }
         printf("Detected NFC Tag with uid: %s\n", uid_str);
-        ESP_LOGI(TAG, "Detected NFC Tag with uid: %s", uid_str);
-        nfc_state_machine(uid, uidLength);
-        vTaskDelay(pdMS_TO_TICKS(5000)); // delay 5s to ensure states are properly handled
+        ESP_LOGI(TAG, "Bay %d: detected NFC Tag with uid: %s", bay->index, uid_str);
+        if (!cycle_tap(bay, uid, uidLength)) // The cycle script owns taps while it runs
+            nfc_state_machine(bay, uid, uidLength);
+        if (!wait_for_removal(bay, uid, uidLength) && uidLength <= sizeof(held)) // Held tag is not a second tap, the next one is
+        {
+            memcpy(held, uid, uidLength);
+            held_len = uidLength;
+        }
     }
     vTaskDelete(NULL); // if module wasn't initialized, delete this task
 }
 
-void nfc_state_machine(uint8_t uid[], uint8_t uidLength)
+static void nfc_transition_done(struct bay *bay, enum transitions t, int result, void *arg)
+{ // Runs on the bay's state machine task when a transition requested by a tap finishes
+    enum nfc_states target = (enum nfc_states)(intptr_t)arg;
+    if (result)
+    {
+        ESP_LOGE(TAG, "ERROR: Bay %d %s failed (%d)...", bay->index, sm_transition_name(t), result);
+        if (t == T_UNLOCKEDEM)
+        {
+            delete_tag(bay); // Bay was never claimed, free it for the next tap
+            bay_journal_commit(bay);
+        }
+        bay->nfc_pending = false;
+        return;
+    }
+    if (t == T_CLOSED)
+    {
+        // "Close" NFC module state skipped, go straight to CV
+        // send msg to BBB that bike is now in and door is closed/locked
+        if (sm_request(bay, T_COMPVISION, 0, nfc_transition_done, arg) == SM_OK)
+            return;
+        ESP_LOGE(TAG, "ERROR: Could not transistion to comp. vision state...");
+        bay->nfc_pending = false;
+        return;
+    }
+    if (t == T_EMPTY)
+        delete_tag(bay);
+    bay->nfc_next_state = target;
+    bay_journal_commit(bay); // Lands in the same write as the state machine's commit
+    bay->nfc_pending = false;
+}
+
+static int nfc_request_transition(struct bay *bay, enum transitions t, enum nfc_states target)
+{ // Queue a transition, the bay's next state is only advanced once it completes
+    bay->nfc_pending = true;
+    bay->tap_us = esp_timer_get_time();
+    int ret = sm_request(bay, t, 0, nfc_transition_done, (void *)(intptr_t)target);
+    if (ret)
+        bay->nfc_pending = false;
+    return ret;
+}
+
+void nfc_state_machine(struct bay *bay, uint8_t uid[], uint8_t uidLength)
 {
     int ret = 0;
-    switch (next_state)
+    if (bay->nfc_pending)
+    {
+        ESP_LOGI(TAG, "INFO: Transition in progress, ignoring tag...");
+        return;
+    }
+    switch ((enum nfc_states)bay->nfc_next_state)
     {
     case Vacant:
-        ret = new_tag(uid, uidLength);
+        ret = new_tag(bay, uid, uidLength);
         if (ret)
         {
             ESP_LOGE(TAG, "ERROR: Could not register new tag...");
             break;
         }
-        ret = to_unlockedem();
+        ret = nfc_request_transition(bay, T_UNLOCKEDEM, UnlockEm);
         if (ret)
         {
             ESP_LOGE(TAG, "ERROR: Could not transistion to unlocked (empty) state...");
+            delete_tag(bay);
             break;
         }
-        next_state = UnlockEm;
         break;
     case UnlockEm:
-        ret = check_tag(uid, uidLength);
+        ret = check_tag(bay, uid, uidLength);
         if (ret)
         {
             ESP_LOGI(TAG, "INFO: Detected unsaved tag...");
             break;
         }
-        ret = to_loading();
+        ret = nfc_request_transition(bay, T_LOADING, Load);
         if (ret)
         {
             ESP_LOGE(TAG, "ERROR: Could not transistion to loading state...");
             break;
         }
-        next_state = Load;
         break;
     case Load:
-        ret = check_tag(uid, uidLength);
+        ret = check_tag(bay, uid, uidLength);
         if (ret)
         {
             ESP_LOGI(TAG, "INFO: Detected unsaved tag...");
             break;
         }
-        ret = to_closed();
+        // to_compvision is chained once to_closed completes
+        ret = nfc_request_transition(bay, T_CLOSED, WaitForBBBFin);
         if (ret)
         {
             ESP_LOGE(TAG, "ERROR: Could not transistion to closed state...");
             break;
         }
-        // "Close" NFC module state skipped for
-
-        ret = to_compvision(); // send msg to BBB that bike is now in and door is closed/locked
-        if (ret)
-        {
-            ESP_LOGE(TAG, "ERROR: Could not transistion to comp. vision state...");
-            break;
-        }
         // Transition to charging state happens from BBB automatically, no need for NFC input
-
-        next_state = WaitForBBBFin;
         break;
         // case Close:
-        //     ret = check_tag(uid, uidLength);
+        //     ret = check_tag(bay, uid, uidLength);
         //     if (ret)
         //     {
         //         ESP_LOGI(TAG, "INFO: Detected unsaved tag...");
@@ -168,17 +442,18 @@ void nfc_state_machine(uint8_t uid[], uint8_t uidLength)
         // next_state = Unlock;
         // break;
     case WaitForBBBFin:
-        ret = check_tag(uid, uidLength);
+        ret = check_tag(bay, uid, uidLength);
         if (ret)
         {
             ESP_LOGI(TAG, "INFO: Detected unsaved tag...");
             break;
         }
-        printf("WaitForBBBFin_state\n");
-        next_state = Unload;
+        sm_print_banner(bay, "WaitForBBBFin_state");
+        bay->nfc_next_state = Unload;
+        bay_journal_commit(bay);
         break;
     // case Unlock:
-    //     ret = check_tag(uid, uidLength);
+    //     ret = check_tag(bay, uid, uidLength);
     //     if (ret)
     //     {
     //         ESP_LOGI(TAG, "INFO: Detected unsaved tag...");
@@ -193,73 +468,123 @@ void nfc_state_machine(uint8_t uid[], uint8_t uidLength)
     //     next_state = Unload;
     //     break;
     case Unload:
-        ret = check_tag(uid, uidLength);
+        ret = check_tag(bay, uid, uidLength);
         if (ret)
         {
             ESP_LOGI(TAG, "INFO: Detected unsaved tag...");
             break;
         }
-        ret = to_unloading();
+        ret = nfc_request_transition(bay, T_UNLOADING, Empty);
         if (ret)
         {
             ESP_LOGE(TAG, "ERROR: Could not transistion to unloaded state...");
             break;
         }
-        next_state = Empty;
         break;
     case Empty:
-        ret = check_tag(uid, uidLength);
+        ret = check_tag(bay, uid, uidLength);
         if (ret)
         {
             ESP_LOGI(TAG, "INFO: Detected unsaved tag...");
             break;
         }
-        ret = to_empty();
+        ret = nfc_request_transition(bay, T_EMPTY, Vacant);
         if (ret)
         {
             ESP_LOGE(TAG, "ERROR: Could not transistion to empty state...");
             break;
         }
-        delete_tag();
-        next_state = Vacant;
         break;
     default:
         break;
     }
 }
 
-int new_tag(uint8_t uid[], uint8_t uidLength)
+int new_tag(struct bay *bay, uint8_t uid[], uint8_t uidLength)
 {
-    if (curr_uid[0] == '\0')
+    if (bay->uid_len == 0)
     {
+        if (!allow_check(uid, uidLength))
+        {
+            ESP_LOGW(TAG, "Bay %d: tag is not on the allow-list", bay->index);
+            return 1;
+        }
         // No uid is set currently, so set the uid detected
+        if (uidLength > BAY_UID_LEN)
+            uidLength = BAY_UID_LEN;
         for (int i = 0; i < uidLength; i++)
         {
-            curr_uid[i] = uid[i];
+            bay->uid[i] = uid[i];
         }
-        curr_uidLength = uidLength;
+        bay->uid_len = uidLength;
         return 0;
     }
     return 1;
 }
 
-int check_tag(uint8_t uid[], uint8_t uidLength)
+int check_tag(struct bay *bay, uint8_t uid[], uint8_t uidLength)
 {
-    if (curr_uidLength == uidLength)
+    if (bay->uid_len == uidLength)
     {
         // Compare uids for further processing
         for (int i = 0; i < uidLength; i++)
         {
-            if (curr_uid[i] != uid[i])
-                return 0; // not matching id, return false
+            if (bay->uid[i] != uid[i])
+                return 1; // not the owner's tag
         }
         return 0; // id matched! obv don't need to update
     }
     return 1;
 }
 
-void delete_tag(void)
+void delete_tag(struct bay *bay)
 {
-    memset(curr_uid, '\0', sizeof(curr_uid)); // reset uid
-    curr_uidLength = 0;                       // reset uid length
-}
\ No newline at end of file
+    memset(bay->uid, '\0', sizeof(bay->uid)); // reset uid
+    bay->uid_len = 0;                          // reset uid length
+}
+
+int nfc_comm(int argc, char **argv)
+{ // Reader link rate, round trip times and UART load at each rate it has run at, powered down time and poll rates
+    struct bay *only = NULL; // All bays unless one is named
+    if (argc >= 2 && (only = bay_from_arg(argc, argv, 1)) == NULL)
+        return 1;
+    for (int i = 0; i < NUM_BAYS; i++)
+    {
+        if (only && only->index != i)
+            continue;
+        pn532_t *reader = bays[i].nfc_reader;
+        if (reader == NULL)
+        {
+            printf("Bay %d: no reader\n", i);
+            continue;
+        }
+        pn532_link_t link[8];
+        int n = pn532_link(reader, link, sizeof(link) / sizeof(*link));
+        printf("Bay %d: PN532 at %u baud\n%8s %8s %10s %10s %8s %10s %10s\n", i, (unsigned)pn532_baud(reader), "baud",
+               "commands", "mean us", "max us", "errors", "tx bytes", "rx bytes");
+        uint64_t wire_us = 0; // 10 bits a byte
+        for (int r = 0; r < n; r++)
+        {
+            printf("%8u %8u %10u %10u %8u %10llu %10llu\n", (unsigned)link[r].baud, (unsigned)link[r].count,
+                   link[r].count ? (unsigned)(link[r].sum_us / link[r].count) : 0, (unsigned)link[r].max_us,
+                   (unsigned)link[r].errors, (unsigned long long)link[r].tx_bytes, (unsigned long long)link[r].rx_bytes);
+            wire_us += (link[r].tx_bytes + link[r].rx_bytes) * 10000000ULL / link[r].baud;
+        }
+        int64_t now = esp_timer_get_time();
+        uint32_t wakes;
+        uint64_t asleep_us = pn532_asleep_us(reader, &wakes);
+        unsigned busy = wire_us * 10000 / now; // Hundredths of a percent
+        printf("UART busy %u.%02u%% of uptime, powered down %u%%, woken %u times\n", busy / 100, busy % 100,
+               (unsigned)(asleep_us * 100 / now), (unsigned)wakes);
+        const struct nfc_sched *s = &nfc_sched_ctx[i];
+        printf("Polling %s every %u ms, %u changes, time at", nfc_profiles[s->rate].name,
+               (unsigned)nfc_profiles[s->rate].interval_ms, (unsigned)s->changes);
+        for (int r = 0; r < NUM_NFC_RATES; r++)
+        {
+            uint64_t us = s->rate_us[r] + (r == s->rate ? now - s->since_us : 0);
+            printf(" %s %u%%", nfc_profiles[r].name, (unsigned)(us * 100 / now));
+        }
+        printf("\n");
+    }
+    return 0;
+}
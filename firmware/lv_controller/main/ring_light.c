@@ -1,21 +1,27 @@
 #include <stdint.h>
 #include <string.h>
+#include "bay.h"
 #include "ring_light.h"
 #include "led_strip_encoder.h"
+#include "trace.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "driver/rmt_tx.h"
 #include "esp_log.h"
 
-static const char *TAG = "ring_light";
+struct ring_light
+{
+    uint8_t led_strip_pixels[NUM_LEDS * 3];
+    rmt_channel_handle_t led_chan;
+    rmt_encoder_handle_t led_encoder;
+    TaskHandle_t rainbow_chase_task_handle;
+    TaskHandle_t heartbeat_task_handle;
+    bool go_rainbow_chase;
+    bool go_heartbeat;
+};
 
-static uint8_t led_strip_pixels[NUM_LEDS * 3];
-static rmt_channel_handle_t led_chan = NULL;
-static rmt_encoder_handle_t led_encoder = NULL;
-static TaskHandle_t rainbow_chase_task_handle = NULL;
-static TaskHandle_t heartbeat_task_handle = NULL;
-static bool go_rainbow_chase = false;
-static bool go_heartbeat = false;
+static const char *TAG = "ring_light";
+static struct ring_light ring_ctx[NUM_BAYS];
 
 static void led_strip_hsv2rgb(uint32_t h, uint32_t s, uint32_t v, uint32_t *r, uint32_t *g, uint32_t *b)
 {
@@ -66,150 +72,166 @@ static void led_strip_hsv2rgb(uint32_t h, uint32_t s, uint32_t v, uint32_t *r, u
 
 void init_ring_light(void)
 {
-    ESP_LOGI(TAG, "Create RMT TX channel");
-    printf("Create RMT TX channel");
-
-    rmt_tx_channel_config_t tx_chan_config = {
-        .clk_src = RMT_CLK_SRC_DEFAULT, // select source clock
-        .gpio_num = RMT_LED_STRIP_GPIO_NUM,
-        .mem_block_symbols = 64, // increase the block size can make the LED less flickering
-        .resolution_hz = RMT_LED_STRIP_RESOLUTION_HZ,
-        .trans_queue_depth = 4, // set the number of transactions that can be pending in the background
-    };
-    ESP_ERROR_CHECK(rmt_new_tx_channel(&tx_chan_config, &led_chan));
+    for (int i = 0; i < NUM_BAYS; i++)
+    {
+        struct bay *bay = &bays[i];
+        struct ring_light *ring = &ring_ctx[i];
+        bay->ring = ring;
+
+        ESP_LOGI(TAG, "Create RMT TX channel");
+        printf("Create RMT TX channel");
+
+        rmt_tx_channel_config_t tx_chan_config = {
+            .clk_src = RMT_CLK_SRC_DEFAULT, // select source clock
+            .gpio_num = bay->cfg->ring_light_gpio,
+            .mem_block_symbols = 64, // increase the block size can make the LED less flickering
+            .resolution_hz = RMT_LED_STRIP_RESOLUTION_HZ,
+            .trans_queue_depth = 4, // set the number of transactions that can be pending in the background
+        };
+        ESP_ERROR_CHECK(rmt_new_tx_channel(&tx_chan_config, &ring->led_chan));
+
+        ESP_LOGI(TAG, "Install led strip encoder");
+        printf("Install led strip encoder");
+        led_strip_encoder_config_t encoder_config = {
+            .resolution = RMT_LED_STRIP_RESOLUTION_HZ,
+        };
+        ESP_ERROR_CHECK(rmt_new_led_strip_encoder(&encoder_config, &ring->led_encoder));
+
+        ESP_LOGI(TAG, "Enable RMT TX channel");
+        printf("Enable RMT TX channel");
+        ESP_ERROR_CHECK(rmt_enable(ring->led_chan));
+    }
+}
 
-    ESP_LOGI(TAG, "Install led strip encoder");
-    printf("Install led strip encoder");
-    led_strip_encoder_config_t encoder_config = {
-        .resolution = RMT_LED_STRIP_RESOLUTION_HZ,
+static void flush_leds(struct ring_light *ring)
+{
+    rmt_transmit_config_t tx_config = {
+        .loop_count = 0, // no transfer loop
     };
-    ESP_ERROR_CHECK(rmt_new_led_strip_encoder(&encoder_config, &led_encoder));
+    ESP_ERROR_CHECK(rmt_transmit(ring->led_chan, ring->led_encoder, ring->led_strip_pixels, sizeof(ring->led_strip_pixels), &tx_config));
+}
 
-    ESP_LOGI(TAG, "Enable RMT TX channel");
-    printf("Enable RMT TX channel");
-    ESP_ERROR_CHECK(rmt_enable(led_chan));
+static void fill_leds(struct ring_light *ring, uint32_t h, uint32_t s, uint32_t v)
+{
+    uint32_t red = 0;
+    uint32_t green = 0;
+    uint32_t blue = 0;
+    led_strip_hsv2rgb(h, s, v, &red, &green, &blue);
+    for (int j = 0; j < NUM_LEDS; j++)
+    {
+        ring->led_strip_pixels[j * 3 + 0] = green;
+        ring->led_strip_pixels[j * 3 + 1] = blue;
+        ring->led_strip_pixels[j * 3 + 2] = red;
+    }
 }
 
-void rainbow_chase_start(void)
+void rainbow_chase_start(struct bay *bay)
 {
-    if (go_rainbow_chase)
+    if (bay->ring->go_rainbow_chase)
     {
         // chase already started, do nothing
-        ESP_LOGI(TAG, "Rainbow chase already started");
-        printf("Rainbow chase already started");
+        ESP_LOGD(TAG, "Rainbow chase already started");
     }
-    go_rainbow_chase = true;
-    xTaskCreate(rainbow_chase_inf, "rainbow_chase_inf", 8192, NULL, 1, &rainbow_chase_task_handle);
+    bay->ring->go_rainbow_chase = true;
+    xTaskCreate(rainbow_chase_inf, "rainbow_chase_inf", 8192, bay, 1, &bay->ring->rainbow_chase_task_handle);
 }
 
 int rainbow_chase_start_comm(int argc, char **argv)
 {
-    rainbow_chase_start();
+    struct bay *bay = bay_from_arg(argc, argv, 1);
+    if (bay)
+        rainbow_chase_start(bay);
     return 0;
 }
 
-void rainbow_chase_stop(void)
+void rainbow_chase_stop(struct bay *bay)
 {
-    go_rainbow_chase = false;
+    bay->ring->go_rainbow_chase = false;
 }
 
 int rainbow_chase_stop_comm(int argc, char **argv)
 {
-    rainbow_chase_stop();
+    struct bay *bay = bay_from_arg(argc, argv, 1);
+    if (bay)
+        rainbow_chase_stop(bay);
     return 0;
 }
 
-void rainbow_chase_inf(void *)
+void rainbow_chase_inf(void *params)
 {
+    struct bay *bay = params;
+    struct ring_light *ring = bay->ring;
     uint32_t red = 0;
     uint32_t green = 0;
     uint32_t blue = 0;
     uint16_t hue = 0;
     uint16_t start_rgb = 0;
 
-    ESP_LOGI(TAG, "Start LED rainbow chase");
-    printf("Start LED rainbow chase");
-    rmt_transmit_config_t tx_config = {
-        .loop_count = 0, // no transfer loop
-    };
-    while (go_rainbow_chase)
+    TRACE_BAY(bay->index, TR_LED_MODE, 2, 0);
+    while (ring->go_rainbow_chase)
     {
         for (int j = 0; j < NUM_LEDS; j++)
         {
             // Build RGB pixels
             hue = j * 360 / NUM_LEDS + start_rgb;
             led_strip_hsv2rgb(hue, 100, 20, &red, &green, &blue);
-            led_strip_pixels[j * 3 + 0] = green;
-            led_strip_pixels[j * 3 + 1] = blue;
-            led_strip_pixels[j * 3 + 2] = red;
+            ring->led_strip_pixels[j * 3 + 0] = green;
+            ring->led_strip_pixels[j * 3 + 1] = blue;
+            ring->led_strip_pixels[j * 3 + 2] = red;
         }
         // Flush RGB values to LEDs
-        ESP_ERROR_CHECK(rmt_transmit(led_chan, led_encoder, led_strip_pixels, sizeof(led_strip_pixels), &tx_config));
+        flush_leds(ring);
         vTaskDelay(pdMS_TO_TICKS(LED_CHASE_SPEED_MS));
 
-        memset(led_strip_pixels, 0, sizeof(led_strip_pixels));
-        ESP_ERROR_CHECK(rmt_transmit(led_chan, led_encoder, led_strip_pixels, sizeof(led_strip_pixels), &tx_config));
+        memset(ring->led_strip_pixels, 0, sizeof(ring->led_strip_pixels));
+        flush_leds(ring);
         start_rgb += 20;
     }
     vTaskDelete(NULL);
 }
 
-void white_leds(void)
+void white_leds(struct bay *bay)
 {
-    uint32_t red = 0;
-    uint32_t green = 0;
-    uint32_t blue = 0;
-    rmt_transmit_config_t tx_config = {
-        .loop_count = 0, // no transfer loop
-    };
-    ESP_LOGI(TAG, "Setting LEDs to white\n");
-    printf("Setting LEDs to white\n");
-    for (int j = 0; j < NUM_LEDS; j++)
-    {
-        // Build RGB pixels
-        led_strip_hsv2rgb(255, 0, 20, &red, &green, &blue);
-        led_strip_pixels[j * 3 + 0] = green;
-        led_strip_pixels[j * 3 + 1] = blue;
-        led_strip_pixels[j * 3 + 2] = red;
-    }
+    TRACE_BAY(bay->index, TR_LED_MODE, 1, 0);
+    // Build RGB pixels
+    fill_leds(bay->ring, 255, 0, 20);
     // Flush RGB values to LEDs
-    ESP_ERROR_CHECK(rmt_transmit(led_chan, led_encoder, led_strip_pixels, sizeof(led_strip_pixels), &tx_config));
+    flush_leds(bay->ring);
     vTaskDelay(pdMS_TO_TICKS(LED_CHASE_SPEED_MS));
 
     // memset(led_strip_pixels, 255, sizeof(led_strip_pixels));
     // Flush RGB values to LEDs
-    ESP_ERROR_CHECK(rmt_transmit(led_chan, led_encoder, led_strip_pixels, sizeof(led_strip_pixels), &tx_config));
+    flush_leds(bay->ring);
 }
 
 int set_white_leds(int argc, char **argv)
 {
-    white_leds();
+    struct bay *bay = bay_from_arg(argc, argv, 1);
+    if (bay)
+        white_leds(bay);
     return 0;
 }
 
-void leds_off(void)
+void leds_off(struct bay *bay)
 {
-    rmt_transmit_config_t tx_config = {
-        .loop_count = 0, // no transfer loop
-    };
-    ESP_LOGI(TAG, "Turning LEDs off");
-    printf("Turning LEDs off");
-    memset(led_strip_pixels, 0, sizeof(led_strip_pixels));
+    TRACE_BAY(bay->index, TR_LED_MODE, 0, 0);
+    memset(bay->ring->led_strip_pixels, 0, sizeof(bay->ring->led_strip_pixels));
     // Flush RGB values to LEDs
-    ESP_ERROR_CHECK(rmt_transmit(led_chan, led_encoder, led_strip_pixels, sizeof(led_strip_pixels), &tx_config));
+    flush_leds(bay->ring);
 }
 
 int leds_off_comm(int argc, char **argv)
 {
-    leds_off();
+    struct bay *bay = bay_from_arg(argc, argv, 1);
+    if (bay)
+        leds_off(bay);
     return 0;
 }
 
-void heartbeat_leds(void)
+void heartbeat_leds(void *params)
 {
-    uint32_t red = 0;
-    uint32_t green = 0;
-    uint32_t blue = 0;
+    struct bay *bay = params;
+    struct ring_light *ring = bay->ring;
     // hardcode hue for blue
     uint16_t hue = 40;
     uint16_t val = 0;
@@ -217,81 +239,68 @@ void heartbeat_leds(void)
     uint16_t MAX_VAL = 20;
     uint16_t NUM_INCREMENTS = 20;
 
-    ESP_LOGI(TAG, "Starting heartbeat...");
-    printf("Starting heartbeat...");
-    rmt_transmit_config_t tx_config = {
-        .loop_count = 0, // no transfer loop
-    };
-    while (go_heartbeat)
+    TRACE_BAY(bay->index, TR_LED_MODE, 3, 0);
+    while (ring->go_heartbeat)
     {
         for (int i = 2; i < NUM_INCREMENTS; i++)
         {
             val = i * MAX_VAL / NUM_INCREMENTS;
-            for (int j = 0; j < NUM_LEDS; j++)
-            {
-                // Build RGB pixels from val (intensity)
-                led_strip_hsv2rgb(hue, 100, val, &red, &green, &blue);
-                led_strip_pixels[j * 3 + 0] = green;
-                led_strip_pixels[j * 3 + 1] = blue;
-                led_strip_pixels[j * 3 + 2] = red;
-            }
+            // Build RGB pixels from val (intensity)
+            fill_leds(ring, hue, 100, val);
             // Flush RGB values to LEDs
-            ESP_ERROR_CHECK(rmt_transmit(led_chan, led_encoder, led_strip_pixels, sizeof(led_strip_pixels), &tx_config));
+            flush_leds(ring);
             vTaskDelay(pdMS_TO_TICKS(LED_HEARTBEAT_SPEED_MS));
 
-            if (!go_heartbeat)
+            if (!ring->go_heartbeat)
                 break;
         }
 
         for (int i = NUM_INCREMENTS - 1; i >= 2; i--)
         {
             val = i * MAX_VAL / NUM_INCREMENTS;
-            for (int j = 0; j < NUM_LEDS; j++)
-            {
-                // Build RGB pixels from val (intensity)
-                led_strip_hsv2rgb(hue, 100, val, &red, &green, &blue);
-                led_strip_pixels[j * 3 + 0] = green;
-                led_strip_pixels[j * 3 + 1] = blue;
-                led_strip_pixels[j * 3 + 2] = red;
-            }
+            // Build RGB pixels from val (intensity)
+            fill_leds(ring, hue, 100, val);
             // Flush RGB values to LEDs
-            ESP_ERROR_CHECK(rmt_transmit(led_chan, led_encoder, led_strip_pixels, sizeof(led_strip_pixels), &tx_config));
+            flush_leds(ring);
             vTaskDelay(pdMS_TO_TICKS(LED_HEARTBEAT_SPEED_MS));
 
-            if (!go_heartbeat)
+            if (!ring->go_heartbeat)
                 break;
         }
     }
-    memset(led_strip_pixels, 0, sizeof(led_strip_pixels));
-    ESP_ERROR_CHECK(rmt_transmit(led_chan, led_encoder, led_strip_pixels, sizeof(led_strip_pixels), &tx_config));
+    memset(ring->led_strip_pixels, 0, sizeof(ring->led_strip_pixels));
+    flush_leds(ring);
     vTaskDelete(NULL);
 }
 
-void heartbeat_start(void)
+void heartbeat_start(struct bay *bay)
 {
-    if (go_heartbeat)
+    if (bay->ring->go_heartbeat)
     {
         // heartbeat already started, do nothing
-        ESP_LOGI(TAG, "Heartbeat already started");
-        printf("Heartbeat already started");
+        ESP_LOGD(TAG, "Heartbeat already started");
     }
-    go_heartbeat = true;
-    xTaskCreate(heartbeat_leds, "heartbeat_leds", 8192, NULL, 1, &heartbeat_task_handle);
+    bay->ring->go_heartbeat = true;
+    xTaskCreate(heartbeat_leds, "heartbeat_leds", 8192, bay, 1, &bay->ring->heartbeat_task_handle);
 }
 
 int heartbeat_start_comm(int argc, char **argv)
 {
-    heartbeat_start();
+    struct bay *bay = bay_from_arg(argc, argv, 1);
+    if (bay)
+        heartbeat_start(bay);
     return 0;
 }
 
-void heartbeat_stop(void)
+void heartbeat_stop(struct bay *bay)
 {
-    go_heartbeat = false;
+    bay->ring->go_heartbeat = false;
 }
 
 int heartbeat_stop_comm(int argc, char **argv)
 {
-    heartbeat_stop();
+    struct bay *bay = bay_from_arg(argc, argv, 1);
+    if (bay)
+        heartbeat_stop(bay);
     return 0;
 }
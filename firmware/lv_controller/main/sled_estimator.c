@@ -0,0 +1,301 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/ledc.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "nvs.h"
+
+#include "bay.h"
+#include "sled_estimator.h"
+#include "motion_profile.h"
+#include "limit_switches.h"
+#include "motor.h"
+#include "commands.h"
+#include "stats.h"
+
+struct sled_est
+{
+    portMUX_TYPE lock;
+    esp_timer_handle_t timer;
+
+    // Learned end to end travel per direction and cruise duty
+    struct sled_travel travel[2][SLED_EST_DUTY_BUCKETS];
+    bool dirty; // Learned since the last NVS write, guarded by lock
+    uint32_t overrun_count;
+
+    // Current move, all guarded by lock
+    struct
+    {
+        bool active;
+        bool from_end;    // Started on an end switch, so the move can be learned
+        bool approaching; // Approach already triggered for this move
+        bool overrun;     // Overrun already flagged for this move
+        int dir;
+        int bucket;
+        int64_t start_us;
+        int64_t last_us;
+        uint32_t duty_ms; // Duty integral so far
+        int start_pos;
+    } move;
+    int position; // Permille from LIM3 (0) to LIM1 (1000), -1 unknown
+};
+
+/* GLOBALS */
+static const char *TAG = "sled_estimator";
+static struct sled_est est_ctx[NUM_BAYS];
+static TaskHandle_t est_task_handle;
+
+static void nvs_key(struct bay *bay, char *key, size_t len)
+{ // Bay 0 keeps the original key so learned times survive the multi-bay update
+    if (bay->index)
+        snprintf(key, len, "%s%d", SLED_EST_NVS_KEY, bay->index);
+    else
+        snprintf(key, len, "%s", SLED_EST_NVS_KEY);
+}
+
+static void save_travel(struct bay *bay)
+{
+    struct sled_est *est = bay->est;
+    struct sled_travel snap[2][SLED_EST_DUTY_BUCKETS];
+    nvs_handle_t h;
+    char key[16];
+
+    portENTER_CRITICAL(&est->lock);
+    memcpy(snap, est->travel, sizeof(snap));
+    est->dirty = false;
+    portEXIT_CRITICAL(&est->lock);
+
+    nvs_key(bay, key, sizeof(key));
+    if (nvs_open(SLED_EST_NVS_NAMESPACE, NVS_READWRITE, &h) != ESP_OK)
+        return;
+    if (nvs_set_blob(h, key, snap, sizeof(snap)) == ESP_OK)
+        nvs_commit(h);
+    nvs_close(h);
+}
+
+static void est_task(void *params)
+{ // Keeps NVS writes off the switch task that reports the arrival
+    while (true)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        for (int i = 0; i < NUM_BAYS; i++)
+        {
+            if (est_ctx[i].dirty)
+                save_travel(&bays[i]);
+        }
+    }
+}
+
+static void load_travel(struct bay *bay)
+{
+    struct sled_est *est = bay->est;
+    nvs_handle_t h;
+    char key[16];
+    nvs_key(bay, key, sizeof(key));
+    memset(est->travel, 0, sizeof(est->travel));
+    if (nvs_open(SLED_EST_NVS_NAMESPACE, NVS_READONLY, &h) != ESP_OK)
+        return;
+    size_t len = sizeof(est->travel);
+    if (nvs_get_blob(h, key, est->travel, &len) != ESP_OK || len != sizeof(est->travel))
+        memset(est->travel, 0, sizeof(est->travel)); // Missing or from an older layout
+    nvs_close(h);
+}
+
+static int end_position(struct bay *bay)
+{ // Position is exact whenever the sled sits on an end switch
+    uint32_t levels = get_lim_switch_levels(bay);
+    if (!(levels & LIM3_BIT))
+        return 0;
+    if (!(levels & LIM1_BIT))
+        return 1000;
+    return -1;
+}
+
+static void est_timer_cb(void *arg)
+{ // Dead reckoning: speed is taken as proportional to the PWM duty
+    struct bay *bay = arg;
+    struct sled_est *est = bay->est;
+    bool approach = false;
+    bool overrun = false;
+    int64_t now = esp_timer_get_time();
+    int duty = ledc_get_duty(LEDC_MODE, bay->cfg->motor_channel) * 100 / 1023;
+
+    portENTER_CRITICAL(&est->lock);
+    if (est->move.active)
+    {
+        est->move.duty_ms += duty * (uint32_t)((now - est->move.last_us) / 1000);
+        est->move.last_us = now;
+        const struct sled_travel *t = &est->travel[est->move.dir][est->move.bucket];
+        if (t->count && est->move.start_pos >= 0)
+        {
+            int moved = (int)((uint64_t)est->move.duty_ms * 1000 / t->duty_ms);
+            int position = est->move.dir == SLED_DIR_OUT ? est->move.start_pos + moved : est->move.start_pos - moved;
+            if (position < 0)
+                position = 0;
+            if (position > 1000)
+                position = 1000;
+            est->position = position;
+            int remaining = est->move.dir == SLED_DIR_OUT ? 1000 - position : position;
+            if (!est->move.approaching && remaining <= SLED_EST_ZONE_PERMILLE)
+                approach = est->move.approaching = true;
+            if (est->move.from_end && !est->move.overrun &&
+                now - est->move.start_us > (int64_t)t->time_ms * 10 * SLED_EST_OVERRUN_PERCENT)
+                overrun = est->move.overrun = true;
+        }
+    }
+    portEXIT_CRITICAL(&est->lock);
+
+    if (approach && is_sled_moving(bay)) // The reflex may have cut the motor already
+        motion_profile_approach(bay);
+    if (overrun)
+    {
+        est->overrun_count++;
+        ESP_LOGW(TAG, "Bay %d: sled move overrunning learned time, check for wear or drag", bay->index);
+    }
+}
+
+void init_sled_estimator(void)
+{
+    for (int i = 0; i < NUM_BAYS; i++)
+    {
+        struct bay *bay = &bays[i];
+        struct sled_est *est = &est_ctx[i];
+        portMUX_INITIALIZE(&est->lock);
+        bay->est = est;
+        load_travel(bay);
+        est->position = end_position(bay);
+        esp_timer_create_args_t args = {
+            .callback = est_timer_cb,
+            .arg = bay,
+            .name = "sled_est",
+        };
+        ESP_ERROR_CHECK(esp_timer_create(&args, &est->timer));
+    }
+    xTaskCreate(est_task, "sled_est", 3072, NULL, 2, &est_task_handle);
+}
+
+void sled_estimator_start(struct bay *bay, int dir)
+{
+    struct sled_est *est = bay->est;
+    struct motion_profile p;
+    get_motion_profile(&p);
+    int64_t now = esp_timer_get_time();
+    int end = end_position(bay);
+
+    portENTER_CRITICAL(&est->lock);
+    memset(&est->move, 0, sizeof(est->move));
+    est->move.active = true;
+    est->move.dir = dir;
+    est->move.bucket = (p.cruise_duty + 5) / 10;
+    est->move.start_us = now;
+    est->move.last_us = now;
+    // Learn only end to end moves that start on the opposite switch
+    est->move.from_end = (dir == SLED_DIR_OUT && end == 0) || (dir == SLED_DIR_IN && end == 1000);
+    est->move.start_pos = end >= 0 ? end : est->position;
+    portEXIT_CRITICAL(&est->lock);
+
+    esp_timer_stop(est->timer);
+    esp_timer_start_periodic(est->timer, SLED_EST_PERIOD_MS * 1000ULL);
+}
+
+void sled_estimator_arrived(struct bay *bay, int sw, int64_t time_us)
+{ // Called with the ISR timestamp of the end switch that stopped the sled
+    struct sled_est *est = bay->est;
+    bool learned = false;
+    uint32_t time_ms = 0;
+    uint32_t expected_ms = 0;
+    int64_t moved_us = -1;
+    int dir = SLED_DIR_OUT;
+
+    portENTER_CRITICAL(&est->lock);
+    if (est->move.active && ((est->move.dir == SLED_DIR_OUT && sw == LIM1) ||
+                             (est->move.dir == SLED_DIR_IN && sw == LIM3)))
+    {
+        est->move.active = false;
+        moved_us = time_us - est->move.start_us;
+        dir = est->move.dir;
+        est->position = est->move.dir == SLED_DIR_OUT ? 1000 : 0;
+        if (est->move.from_end)
+        {
+            struct sled_travel *t = &est->travel[est->move.dir][est->move.bucket];
+            time_ms = (time_us - est->move.start_us) / 1000;
+            expected_ms = t->time_ms;
+            if (!t->count)
+            {
+                t->duty_ms = est->move.duty_ms;
+                t->time_ms = time_ms;
+            }
+            else
+            {
+                // Exponential average, 1/4 weight to the new move
+                t->duty_ms += ((int32_t)est->move.duty_ms - (int32_t)t->duty_ms) / 4;
+                t->time_ms += ((int32_t)time_ms - (int32_t)t->time_ms) / 4;
+            }
+            if (t->count < UINT16_MAX)
+                t->count++;
+            learned = t->duty_ms > 0;
+            est->dirty |= learned;
+        }
+    }
+    portEXIT_CRITICAL(&est->lock);
+
+    if (moved_us >= 0)
+        stats_record(bay, dir == SLED_DIR_OUT ? STAT_SLED_OUT : STAT_SLED_IN, moved_us);
+    esp_timer_stop(est->timer);
+    if (learned)
+    {
+        ESP_LOGI(TAG, "Bay %d: sled travel %u ms (learned %u ms)", bay->index, (unsigned)time_ms, (unsigned)expected_ms);
+        xTaskNotifyGive(est_task_handle);
+    }
+}
+
+void sled_estimator_stop(struct bay *bay)
+{ // Stopped short of a switch, keep the dead reckoned position for the next move
+    struct sled_est *est = bay->est;
+    portENTER_CRITICAL(&est->lock);
+    est->move.active = false;
+    portEXIT_CRITICAL(&est->lock);
+    esp_timer_stop(est->timer);
+}
+
+int sled_estimator_position(struct bay *bay)
+{
+    return bay->est->position;
+}
+
+int sled_est_comm(int argc, char **argv)
+{
+    if (argc >= 2 && !strcmp(argv[1], "reset"))
+    {
+        struct bay *bay = bay_from_arg(argc, argv, 2);
+        if (bay == NULL)
+            return 0;
+        portENTER_CRITICAL(&bay->est->lock);
+        memset(bay->est->travel, 0, sizeof(bay->est->travel));
+        bay->est->dirty = true;
+        portEXIT_CRITICAL(&bay->est->lock);
+        xTaskNotifyGive(est_task_handle);
+        printf("Bay %d sled travel times cleared\n", bay->index);
+        return 0;
+    }
+    for (int i = 0; i < NUM_BAYS; i++)
+    {
+        struct sled_est *est = bays[i].est;
+        printf("Bay %d sled position: %d/1000, overruns: %u\n", i, est->position, (unsigned)est->overrun_count);
+        for (int dir = 0; dir < 2; dir++)
+        {
+            for (int b = 0; b < SLED_EST_DUTY_BUCKETS; b++)
+            {
+                const struct sled_travel *t = &est->travel[dir][b];
+                if (t->count)
+                    printf("%s @ %d%%: %u ms, %u %%ms (%u moves)\n", dir == SLED_DIR_OUT ? "out" : "in",
+                           b * 10, (unsigned)t->time_ms, (unsigned)t->duty_ms, t->count);
+            }
+        }
+    }
+    return 0;
+}
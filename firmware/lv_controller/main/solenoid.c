@@ -1,17 +1,113 @@
+#include <stdbool.h>
+
 #include "esp_log.h"
+#include "esp_timer.h"
 #include <driver/gpio.h>
+#include <driver/ledc.h>
 
+#include "bay.h"
+#include "actuator.h"
 #include "solenoid.h"
+#include "commands.h"
+#include "trace.h"
 
-void lock_solenoid(void)
+struct solenoid
 {
-    // Set level low (0) to lock
-    ESP_ERROR_CHECK(gpio_set_level(SOLENOID_GPIO, 0));
-    printf("Set solenoid level low to lock\n");
+    esp_timer_handle_t hold_timer;
+    esp_timer_handle_t relock_timer;
+    volatile bool unlocked;
+};
+
+/* GLOBALS */
+static const char *TAG = "solenoid";
+static struct solenoid sol_ctx[NUM_BAYS];
+
+static void set_solenoid_duty(struct bay *bay, int duty)
+{ // duty in percent, 10 bit resolution like the motor channel
+    struct act_cmd cmd = ACT_CMD(0, 0);
+    cmd.solenoid_duty = duty;
+    act_apply(bay, &cmd);
 }
 
-void unlock_solenoid(void)
-{ // Set level high (1) to unlock
-    ESP_ERROR_CHECK(gpio_set_level(SOLENOID_GPIO, 1));
-    printf("Set solenoid level high to unlock\n");
-}
\ No newline at end of file
+static void hold_timer_cb(void *arg)
+{ // Bolt is in, drop to hold current to keep the coil cool
+    struct bay *bay = arg;
+    if (bay->sol->unlocked)
+    {
+        set_solenoid_duty(bay, SOLENOID_HOLD_DUTY);
+        TRACE_BAY(bay->index, TR_SOL_HOLD, SOLENOID_HOLD_DUTY, 0);
+    }
+}
+
+static void relock_timer_cb(void *arg)
+{
+    struct bay *bay = arg;
+    ESP_LOGW(TAG, "Bay %d solenoid unlocked for %d ms, relocking", bay->index, SOLENOID_RELOCK_MS);
+    lock_solenoid(bay);
+}
+
+void init_solenoid(void)
+{
+    ledc_timer_config_t solenoid_timer = {
+        .speed_mode = LEDC_MODE,
+        .timer_num = SOLENOID_LEDC_TIMER,
+        .duty_resolution = LEDC_TIMER_10_BIT,
+        .freq_hz = SOLENOID_PWM_FREQ_HZ,
+        .clk_cfg = LEDC_AUTO_CLK};
+    ESP_ERROR_CHECK(ledc_timer_config(&solenoid_timer));
+
+    for (int i = 0; i < NUM_BAYS; i++)
+    {
+        struct bay *bay = &bays[i];
+        bay->sol = &sol_ctx[i];
+
+        ledc_channel_config_t solenoid_channel = {
+            .speed_mode = LEDC_MODE,
+            .channel = bay->cfg->solenoid_channel,
+            .timer_sel = SOLENOID_LEDC_TIMER,
+            .intr_type = LEDC_INTR_DISABLE,
+            .gpio_num = bay->cfg->solenoid_gpio,
+            .duty = 0, // Locked
+            .hpoint = 0};
+        ESP_ERROR_CHECK(ledc_channel_config(&solenoid_channel));
+
+        esp_timer_create_args_t hold_args = {
+            .callback = hold_timer_cb,
+            .arg = bay,
+            .name = "sol_hold",
+        };
+        ESP_ERROR_CHECK(esp_timer_create(&hold_args, &bay->sol->hold_timer));
+        esp_timer_create_args_t relock_args = {
+            .callback = relock_timer_cb,
+            .arg = bay,
+            .name = "sol_relock",
+        };
+        ESP_ERROR_CHECK(esp_timer_create(&relock_args, &bay->sol->relock_timer));
+    }
+}
+
+void lock_solenoid(struct bay *bay)
+{
+    // Set duty to 0 to lock
+    bay->sol->unlocked = false;
+    esp_timer_stop(bay->sol->hold_timer);
+    esp_timer_stop(bay->sol->relock_timer);
+    set_solenoid_duty(bay, 0);
+    TRACE_BAY(bay->index, TR_SOL_LOCK, 0, 0);
+}
+
+void unlock_solenoid(struct bay *bay)
+{ // Full duty to pull in, then hold duty until locked or the relock timeout
+    esp_timer_stop(bay->sol->hold_timer);
+    esp_timer_stop(bay->sol->relock_timer);
+    bay->sol->unlocked = true;
+    set_solenoid_duty(bay, 100);
+    esp_timer_start_once(bay->sol->hold_timer, SOLENOID_PULL_IN_MS * 1000ULL);
+    esp_timer_start_once(bay->sol->relock_timer, SOLENOID_RELOCK_MS * 1000ULL);
+    TRACE_BAY(bay->index, TR_SOL_UNLOCK, 0, 0);
+}
+
+bool is_solenoid_unlocked(struct bay *bay)
+{
+    return bay->sol->unlocked;
+}
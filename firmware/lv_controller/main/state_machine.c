@@ -4,14 +4,24 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
+#include "freertos/event_groups.h"
 #include "driver/gpio.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 
+#include "bay.h"
+#include "bay_journal.h"
 #include "state_machine.h"
 #include "motor.h"
 #include "limit_switches.h"
+#include "nfc_module.h"
 #include "ring_light.h"
 #include "solenoid.h"
+#include "stats.h"
+#include "trace.h"
+
+#define SM_MAX_OPS 8
+#define SM_BIT(s) (1UL << (s))
 
 enum states
 {
@@ -27,197 +37,572 @@ enum states
     BADKEY = -1
 };
 
-static const char *TAG = "state_machine";
-static enum states curr_state = Vacant;
+enum sm_op_type
+{
+    SM_OP_END = 0, // Terminates the op list
+    SM_OP_ACT,     // Run an action
+    SM_OP_WAIT,    // Block until a limit switch reads a given level, mech lane only
+    SM_OP_DELAY,   // Fixed settle time
+};
 
-int to_unlockedem(void)
+// Ops on a lane run in table order, lanes run concurrently
+enum sm_lane
 {
-    // Start a heartbeat on the ring light in prep for loading
-    heartbeat_start();
+    SM_LANE_MECH = 0, // Motor, solenoid and switch waits, run on the engine task
+    SM_LANE_LIGHT,    // Ring light, run on the bay's light worker so it never delays the mechanical path
+    SM_NUM_LANES
+};
 
-    // Unlock door
-    unlock_solenoid();
+typedef void (*sm_action_t)(struct bay *bay);
 
-    // Poll until limit switch is de-pressed for DOOR is OPEN (LIM4)
-    LIM4_state = get_lim_switch_curr_value(LIM4_GPIO);
-    while (!LIM4_state)
-    {
-        LIM4_state = get_lim_switch_curr_value(LIM4_GPIO);
-        vTaskDelay(pdMS_TO_TICKS(100));
-    }
+struct sm_op
+{
+    enum sm_op_type type;
+    sm_action_t action; // SM_OP_ACT
+    int sw;             // SM_OP_WAIT, enum lim_switch
+    int level;          // SM_OP_WAIT
+    int ms;             // SM_OP_DELAY, or default deadline for SM_OP_WAIT
+    uint8_t lane;       // enum sm_lane
+    bool after;         // Every op on the other lane listed above this one finishes first
+    bool join;          // Transition is not done, and its banner not printed, until this op finishes
+};
+
+struct sm_light_item
+{ // One light lane op handed to the light worker
+    const struct sm_op *op;
+    uint32_t seq; // Transition it belongs to
+    int8_t t;
+    int8_t index;
+    bool notify; // Engine is joining on this op
+};
+
+struct sm_transition
+{
+    const char *name;   // Console/log name
+    const char *banner; // Printed when the state is entered, parsed by the BBB
+    uint32_t from;      // Mask of states this transition may start from
+    enum states to;
+    struct sm_op ops[SM_MAX_OPS];
+};
+
+enum sm_sled_pos
+{
+    SLED_IN,
+    SLED_OUT,
+};
+
+// Where each state leaves the bay, used to check and resume a journaled state after a reset
+struct sm_state_info
+{
+    enum sm_sled_pos sled;
+    bool door_shut;    // Door must read closed in this state
+    sm_action_t light; // Ring light pattern running in this state, NULL for off
+};
+
+struct sm_request
+{
+    enum transitions t;
+    int step_deadline_ms; // 0 to use the per-step defaults from the table
+    sm_done_cb_t cb;
+    void *arg;
+};
+
+#define SM_OP_BIT(i) (1U << (i))
+
+#define ACT(fn) {.type = SM_OP_ACT, .action = (fn)}
+#define WAIT(s, l, t) {.type = SM_OP_WAIT, .sw = (s), .level = (l), .ms = (t)}
+#define DELAY(t) {.type = SM_OP_DELAY, .ms = (t)}
+#define LIGHT(fn) {.type = SM_OP_ACT, .action = (fn), .lane = SM_LANE_LIGHT}
+#define LIGHT_AFTER(fn) {.type = SM_OP_ACT, .action = (fn), .lane = SM_LANE_LIGHT, .after = true}
+#define LIGHT_JOIN(fn) {.type = SM_OP_ACT, .action = (fn), .lane = SM_LANE_LIGHT, .join = true}
+#define LIGHT_DELAY(t) {.type = SM_OP_DELAY, .ms = (t), .lane = SM_LANE_LIGHT}
+
+// Limit switches are pulled up, so a pressed switch reads 0
+#define PRESSED 0
+#define RELEASED 1
 
+static void lock_solenoid_after_open(struct bay *bay)
+{
     // Lock solenoid to prevent overheating
-    printf("Locking solenoid...\n");
-    lock_solenoid();
+    lock_solenoid(bay);
+}
 
-    // Set new state
-    printf("UNLOCKEDEM_state\n");
-    curr_state = UnlockedEm;
-    return 0;
+/* TRANSITION TABLE */
+static const struct sm_transition transition_table[NUM_TRANSITIONS] = {
+    [T_UNLOCKEDEM] = {
+        .name = "to_unlockedem",
+        .banner = "UNLOCKEDEM_state",
+        .from = SM_BIT(Vacant) | SM_BIT(Empty),
+        .to = UnlockedEm,
+        .ops = {
+            LIGHT(heartbeat_start),         // Heartbeat on the ring light in prep for loading
+            ACT(unlock_solenoid),           // Unlock door
+            WAIT(LIM4, RELEASED, SM_DOOR_TIMEOUT_MS), // DOOR is OPEN
+            ACT(lock_solenoid_after_open),
+        },
+    },
+    [T_LOADING] = {
+        .name = "to_loading",
+        .banner = "LOADING_state",
+        .from = SM_BIT(UnlockedEm),
+        .to = Loading,
+        .ops = {
+            ACT(sled_out),
+            WAIT(LIM1, PRESSED, SM_SLED_TIMEOUT_MS), // SLED OUT
+            ACT(stop_sled),
+        },
+    },
+    [T_CLOSED] = {
+        .name = "to_closed",
+        .banner = "CLOSED_state",
+        .from = SM_BIT(Loading),
+        .to = Closed,
+        .ops = {
+            ACT(sled_in),
+            WAIT(LIM3, PRESSED, SM_SLED_TIMEOUT_MS), // SLED IN
+            ACT(stop_sled),
+            WAIT(LIM4, PRESSED, SM_DOOR_TIMEOUT_MS), // DOOR CLOSED
+        },
+    },
+    [T_COMPVISION] = {
+        .name = "to_compvision",
+        .banner = "COMPVISION_state",
+        .from = SM_BIT(Closed),
+        .to = CompVision,
+        .ops = {
+            LIGHT(heartbeat_stop),          // Turn off heartbeat from loading
+            LIGHT_DELAY(100),               // Give the ring light some time to settle
+            LIGHT_JOIN(white_leds),         // White LEDs for CV, lit before the BBB sees the banner
+        },
+    },
+    [T_CHARGING] = {
+        .name = "to_charging",
+        .banner = "CHARGING_state",
+        .from = SM_BIT(CompVision),
+        .to = Charging,
+        .ops = {
+            LIGHT(rainbow_chase_start),
+        },
+    },
+    [T_UNLOCKED] = {
+        .name = "to_unlocked",
+        .banner = "UNLOCKED_state",
+        .from = SM_BIT(Charging),
+        .to = Unlocked,
+        .ops = {
+            LIGHT(rainbow_chase_stop),
+            LIGHT(leds_off),
+            LIGHT(heartbeat_start),         // Heartbeat on the ring light for unloading
+            ACT(unlock_solenoid),           // Straight away, the lights catch up on their own lane
+            WAIT(LIM4, RELEASED, SM_DOOR_TIMEOUT_MS), // DOOR is OPEN
+            ACT(lock_solenoid),
+        },
+    },
+    [T_UNLOADING] = {
+        .name = "to_unloading",
+        .banner = "UNLOADING_state",
+        .from = SM_BIT(Unlocked),
+        .to = Unloading,
+        .ops = {
+            ACT(sled_out),
+            WAIT(LIM1, PRESSED, SM_SLED_TIMEOUT_MS), // SLED OUT
+            ACT(stop_sled),
+        },
+    },
+    [T_EMPTY] = {
+        .name = "to_empty",
+        .banner = "EMPTY_state",
+        .from = SM_BIT(Unloading),
+        .to = Empty,
+        .ops = {
+            ACT(sled_in),
+            WAIT(LIM3, PRESSED, SM_SLED_TIMEOUT_MS), // SLED IN
+            ACT(stop_sled),
+            WAIT(LIM4, PRESSED, SM_DOOR_TIMEOUT_MS), // DOOR CLOSED
+            LIGHT_AFTER(heartbeat_stop),    // Turn off heartbeat from unloading once the door is shut
+        },
+    },
+};
+
+/* STATE TABLE */
+static const struct sm_state_info state_info[] = {
+    [UnlockedEm] = {.sled = SLED_IN, .door_shut = false, .light = heartbeat_start},
+    [Loading] = {.sled = SLED_OUT, .door_shut = false, .light = heartbeat_start},
+    [Closed] = {.sled = SLED_IN, .door_shut = true, .light = heartbeat_start},
+    [CompVision] = {.sled = SLED_IN, .door_shut = true, .light = white_leds},
+    [Charging] = {.sled = SLED_IN, .door_shut = true, .light = rainbow_chase_start},
+    [Unlocked] = {.sled = SLED_IN, .door_shut = false, .light = heartbeat_start},
+    [Unloading] = {.sled = SLED_OUT, .door_shut = false, .light = heartbeat_start},
+    [Empty] = {.sled = SLED_IN, .door_shut = true, .light = NULL},
+    [Vacant] = {.sled = SLED_IN, .door_shut = true, .light = NULL},
+};
+
+/* GLOBALS */
+static const char *TAG = "state_machine";
+static sm_observer_t sm_observer = NULL;
+static bool resume_pending[NUM_BAYS];
+
+/* ENGINE */
+static int64_t wait_for_switch_level(struct bay *bay, int sw, int level, int timeout_ms)
+{ // Sleep until the switch reads level, returns time spent waiting in us, -1 on timeout or -2 on a motor fault
+    gpio_num_t pin = bay->cfg->lim_gpio[sw];
+    int64_t start = esp_timer_get_time();
+    TRACE_BAY(bay->index, TR_SM_WAIT, pin, level);
+    int ret = wait_for_switch(bay, BIT(sw), level, timeout_ms);
+    if (ret)
+    {
+        TRACE_BAY(bay->index, TR_SM_WAIT_DONE, pin, ret);
+        return ret;
+    }
+    int64_t now = esp_timer_get_time();
+    TRACE_BAY(bay->index, TR_SM_WAIT_DONE, pin, now - start);
+    return now - start;
 }
 
-int to_loading(void)
-{
-    // Move sled out
-    sled_out();
+static void abort_transition(struct bay *bay, const struct sm_transition *tr)
+{ // Leave the actuators safe, the state is not advanced so the transition can be retried
+    stop_sled(bay);
+    lock_solenoid(bay);
+    ESP_LOGE(TAG, "Bay %d: %s aborted, staying in state %d", bay->index, tr->name, bay->state);
+}
 
-    printf("Waiting for LIM1 (SLED OUT)...\n");
-    // Poll until limit switch is hit for SLED OUT (LIM1), then stop the sled (LIM1)
-    LIM1_state = get_lim_switch_curr_value(LIM1_GPIO);
-    while (LIM1_state)
+static int next_on_lane(const struct sm_transition *tr, int i, int lane)
+{ // First op at or after i on the lane, SM_MAX_OPS when the lane is done
+    for (; i < SM_MAX_OPS && tr->ops[i].type != SM_OP_END; i++)
     {
-        LIM1_state = get_lim_switch_curr_value(LIM1_GPIO);
-        vTaskDelay(pdMS_TO_TICKS(100));
+        if (tr->ops[i].lane == lane)
+            return i;
     }
+    return SM_MAX_OPS;
+}
 
-    printf("Stopping sled...\n");
-    // Stop sled
-    stop_sled();
+static uint32_t op_after(const struct sm_transition *tr, int i)
+{ // SM_OP_BIT mask of the ops that must finish before op i starts
+    uint32_t mask = 0;
+    for (int j = 0; j < i && tr->ops[i].after; j++)
+    {
+        if (tr->ops[j].lane != tr->ops[i].lane)
+            mask |= SM_OP_BIT(j);
+    }
+    return mask;
+}
 
-    // Set new state
-    printf("LOADING_state\n");
-    curr_state = Loading;
-    return 0;
+static uint32_t joined_ops(const struct sm_transition *tr)
+{ // Light ops the engine has to wait for: flagged, or something on the mech lane runs after them
+    uint32_t mask = 0;
+    for (int i = 0; i < SM_MAX_OPS && tr->ops[i].type != SM_OP_END; i++)
+    {
+        if (tr->ops[i].lane == SM_LANE_LIGHT && tr->ops[i].join)
+            mask |= SM_OP_BIT(i);
+        if (tr->ops[i].lane == SM_LANE_MECH)
+            mask |= op_after(tr, i);
+    }
+    return mask;
 }
 
-int to_closed(void)
+static bool join_light(struct bay *bay, uint32_t seq, uint32_t wanted, uint32_t *done)
+{ // Collect finished light ops until everything in wanted is done, false if the light worker is stuck
+    while ((*done & wanted) != wanted)
+    {
+        struct sm_light_item item;
+        if (xQueueReceive(bay->sm_light_done, &item, pdMS_TO_TICKS(SM_LIGHT_JOIN_TIMEOUT_MS)) != pdTRUE)
+            return false;
+        if (item.seq == seq) // Late completions from an aborted transition are dropped
+            *done |= SM_OP_BIT(item.index);
+    }
+    return true;
+}
+
+static int run_transition(struct bay *bay, const struct sm_request *req)
 {
-    // Move sled in
-    printf("Moving sled in...\n");
-    sled_in();
+    static uint32_t seq_ctx[NUM_BAYS];
+    const struct sm_transition *tr = &transition_table[req->t];
 
-    // Poll until limit switch is hit for SLED IN, then stop the sled (LIM3)
-    LIM3_state = get_lim_switch_curr_value(LIM3_GPIO);
-    while (LIM3_state)
+    if (!(tr->from & SM_BIT(bay->state)))
     {
-        LIM3_state = get_lim_switch_curr_value(LIM3_GPIO);
-        vTaskDelay(pdMS_TO_TICKS(100));
+        ESP_LOGE(TAG, "Bay %d: %s not allowed from state %d", bay->index, tr->name, bay->state);
+        return SM_ERR_STATE;
     }
-    printf("Stopping sled...\n");
-    stop_sled();
 
-    // Poll until limit switch is hit for DOOR CLOSED
-    LIM4_state = get_lim_switch_curr_value(LIM4_GPIO);
-    while (LIM4_state)
+    int64_t start = esp_timer_get_time();
+    int64_t waited = 0;
+    if (bay->tap_us)
+    {
+        stats_record(bay, STAT_NFC, start - bay->tap_us);
+        bay->tap_us = 0;
+    }
+    uint32_t seq = ++seq_ctx[bay->index];
+    uint32_t joined = joined_ops(tr);
+    uint32_t done = 0;   // Finished, on either lane
+    uint32_t queued = 0; // Handed to the light worker
+    int mech = next_on_lane(tr, 0, SM_LANE_MECH);
+    int light = next_on_lane(tr, 0, SM_LANE_LIGHT);
+    xQueueReset(bay->sm_light_done);
+    TRACE_BAY(bay->index, TR_SM_START, req->t, bay->state);
+    while (mech < SM_MAX_OPS || light < SM_MAX_OPS)
     {
-        LIM4_state = get_lim_switch_curr_value(LIM4_GPIO);
-        vTaskDelay(pdMS_TO_TICKS(100));
+        // Queue every light op whose cross lane dependencies are met, the worker keeps them in order
+        while (light < SM_MAX_OPS && (op_after(tr, light) & ~(done | queued)) == 0)
+        {
+            struct sm_light_item item = {
+                .op = &tr->ops[light],
+                .seq = seq,
+                .t = req->t,
+                .index = light,
+                .notify = joined & SM_OP_BIT(light),
+            };
+            if (xQueueSend(bay->sm_light_queue, &item, 0) != pdTRUE)
+                ESP_LOGW(TAG, "Bay %d: %s: light lane full, dropping op %d", bay->index, tr->name, light);
+            queued |= SM_OP_BIT(light);
+            light = next_on_lane(tr, light + 1, SM_LANE_LIGHT);
+        }
+        if (mech >= SM_MAX_OPS)
+            break; // Whatever is left on the light lane has been queued
+
+        const struct sm_op *op = &tr->ops[mech];
+        uint32_t after = op_after(tr, mech);
+        if (after & ~done)
+        {
+            if (!join_light(bay, seq, after, &done))
+                ESP_LOGW(TAG, "Bay %d: %s: light lane did not finish in time", bay->index, tr->name);
+            done |= after;
+        }
+        switch (op->type)
+        {
+        case SM_OP_ACT:
+            op->action(bay);
+            break;
+        case SM_OP_WAIT:
+        {
+            int timeout_ms = req->step_deadline_ms ? req->step_deadline_ms : op->ms;
+            int64_t w = wait_for_switch_level(bay, op->sw, op->level, timeout_ms);
+            if (w == -2)
+            {
+                ESP_LOGE(TAG, "Bay %d: %s: motor fault while waiting for GPIO %d", bay->index, tr->name, bay->cfg->lim_gpio[op->sw]);
+                abort_transition(bay, tr);
+                TRACE_BAY(bay->index, TR_SM_DONE, req->t, -SM_ERR_FAULT);
+                return SM_ERR_FAULT;
+            }
+            if (w < 0)
+            {
+                ESP_LOGE(TAG, "Bay %d: %s: GPIO %d did not read %d within %d ms", bay->index, tr->name, bay->cfg->lim_gpio[op->sw], op->level, timeout_ms);
+                abort_transition(bay, tr);
+                TRACE_BAY(bay->index, TR_SM_DONE, req->t, -SM_ERR_TIMEOUT);
+                return SM_ERR_TIMEOUT;
+            }
+            waited += w;
+            if (op->sw == LIM4)
+                stats_record(bay, op->level == PRESSED ? STAT_DOOR_CLOSE : STAT_DOOR_OPEN, w);
+            break;
+        }
+        case SM_OP_DELAY:
+            vTaskDelay(pdMS_TO_TICKS(op->ms));
+            waited += op->ms * 1000LL;
+            break;
+        default:
+            break;
+        }
+        done |= SM_OP_BIT(mech);
+        mech = next_on_lane(tr, mech + 1, SM_LANE_MECH);
     }
+    if (!join_light(bay, seq, joined, &done))
+        ESP_LOGW(TAG, "Bay %d: %s: light lane did not finish in time", bay->index, tr->name);
+    int64_t total = esp_timer_get_time() - start;
+    stats_record(bay, req->t, total);
 
     // Set new state
-    printf("CLOSED_state\n");
-    curr_state = Closed;
-    return 0;
+    bay->state = tr->to;
+    bay_journal_commit(bay);
+    sm_print_banner(bay, tr->banner); // Parsed by the BBB, must stay on the console
+    TRACE_BAY(bay->index, TR_SM_DONE, req->t, total);
+    ESP_LOGD(TAG, "Bay %d: %s: %lld us total, %lld us waiting, %lld us active", bay->index, tr->name, total, waited, total - waited);
+    return SM_OK;
 }
 
-int to_compvision(void)
-{
-    // Turn off heartbeat from loading
-    heartbeat_stop();
-    vTaskDelay(pdMS_TO_TICKS(100)); // give the ring light some time to settle
+static const char *state_banner(int state)
+{ // Banner of the transition that enters state, NULL for Vacant
+    for (int t = 0; t < NUM_TRANSITIONS; t++)
+    {
+        if (transition_table[t].to == state)
+            return transition_table[t].banner;
+    }
+    return NULL;
+}
 
-    // Turn LEDs on white for CV
-    white_leds();
+static void resume_state(struct bay *bay)
+{ // Put the actuators back the way the journaled state had them, the journal only holds completed transitions
+    const struct sm_state_info *si = &state_info[bay->state];
+    int64_t start = esp_timer_get_time();
+    uint32_t levels = get_lim_switch_levels(bay);
+    int end = si->sled == SLED_OUT ? LIM1 : LIM3;
 
-    // Set new state
-    printf("COMPVISION_state\n");
-    curr_state = CompVision;
-    return 0;
+    stop_sled(bay);
+    if (levels & BIT(end))
+    {
+        if (si->sled == SLED_IN && !(levels & LIM4_BIT))
+        { // Reset mid move with the door shut, nobody can be in the way of the sled going in
+            ESP_LOGW(TAG, "Bay %d: sled off its end switch in state %d, re-seating", bay->index, bay->state);
+            sled_in(bay);
+            int ret = wait_for_switch(bay, LIM3_BIT, PRESSED, SM_SLED_TIMEOUT_MS);
+            stop_sled(bay);
+            if (ret)
+                ESP_LOGE(TAG, "Bay %d: sled did not reach GPIO %d, check the bay", bay->index, bay->cfg->lim_gpio[LIM3]);
+        }
+        else // The door may be open with the owner at it, nothing moves until a tap or an operator command
+            ESP_LOGE(TAG, "Bay %d: sled off GPIO %d in state %d with the door %s, left stopped", bay->index,
+                     bay->cfg->lim_gpio[end], bay->state, (levels & LIM4_BIT) ? "open" : "shut");
+    }
+    if (si->door_shut && (levels & LIM4_BIT))
+        ESP_LOGW(TAG, "Bay %d: door open in state %d", bay->index, bay->state);
+    if (si->light)
+        si->light(bay);
+
+    const char *banner = state_banner(bay->state);
+    if (banner)
+        sm_print_banner(bay, banner); // BBB picks the state back up from the banner
+    ESP_LOGI(TAG, "Bay %d: resumed state %d in %lld us", bay->index, bay->state, esp_timer_get_time() - start);
 }
 
-int to_charging(void)
-{
-    // Turn on rainbow chase for charging
-    rainbow_chase_start();
+static void sm_light_worker(void *params)
+{ // One per bay, runs light lane ops in the order the engine queued them
+    struct bay *bay = params;
+    struct sm_light_item item;
+    while (true)
+    {
+        if (!xQueueReceive(bay->sm_light_queue, &item, portMAX_DELAY))
+            continue;
+        TRACE_BAY(bay->index, TR_SM_LIGHT, item.t, item.index);
+        if (item.op->type == SM_OP_ACT)
+            item.op->action(bay);
+        else if (item.op->type == SM_OP_DELAY)
+            vTaskDelay(pdMS_TO_TICKS(item.op->ms));
+        if (item.notify)
+            xQueueSend(bay->sm_light_done, &item, 0); // Only full after an abort nobody joins on
+    }
+}
 
-    // Set new state
-    printf("CHARGING_state\n");
-    curr_state = Charging;
-    return 0;
+void state_machine(void *params)
+{ // One engine task per bay, bays only share the limit switch reader and the console
+    struct bay *bay = params;
+    struct sm_request req;
+    if (resume_pending[bay->index])
+        resume_state(bay);
+    while (true)
+    {
+        if (xQueueReceive(bay->sm_queue, &req, portMAX_DELAY))
+        {
+            int64_t start = esp_timer_get_time();
+            int ret = run_transition(bay, &req);
+            if (sm_observer)
+                sm_observer(bay, req.t, ret, esp_timer_get_time() - start);
+            if (req.cb)
+                req.cb(bay, req.t, ret, req.arg);
+        }
+    }
 }
 
-int to_unlocked(void)
+void init_state_machine(void)
 {
-    // Stop rainbow chase
-    rainbow_chase_stop();
-
-    // Turn LEDs off
-    leds_off();
-
-    // Start a heartbeat on the ring light for unloading
-    heartbeat_start();
+    for (int i = 0; i < NUM_BAYS; i++)
+    {
+        struct bay *bay = &bays[i];
+        // Restored here rather than in the task so the NFC reader never sees the pre-journal state
+        resume_pending[i] = bay_journal_restore(bay, Vacant + 1, NFC_NUM_STATES);
+        if (!resume_pending[i])
+        { // Nothing to resume, the NFC sequence starts over with no owner too
+            bay->state = Vacant;
+            bay->nfc_next_state = 0; // Vacant in nfc_module.c
+            delete_tag(bay);
+        }
+        bay->sm_queue = xQueueCreate(SM_REQUEST_QUEUE_LEN, sizeof(struct sm_request));
+        bay->sm_light_queue = xQueueCreate(SM_LIGHT_QUEUE_LEN, sizeof(struct sm_light_item));
+        bay->sm_light_done = xQueueCreate(SM_MAX_OPS, sizeof(struct sm_light_item));
+        xTaskCreate(sm_light_worker, "sm_light", 3072, bay, 9, NULL);
+        xTaskCreate(state_machine, "state_machine", 4096, bay, 10, NULL);
+    }
+}
 
-    // Unlock door
-    unlock_solenoid();
+void sm_print_banner(struct bay *bay, const char *banner)
+{ // Bay 0 keeps the bare banner the single bay BBB script matches on
+    if (bay->index)
+        printf("%s %d\n", banner, bay->index);
+    else
+        printf("%s\n", banner);
+}
 
-    // Poll until limit switch is de-pressed for DOOR is OPEN (LIM4)
-    LIM4_state = get_lim_switch_curr_value(LIM4_GPIO);
-    while (!LIM4_state)
+int sm_request(struct bay *bay, enum transitions t, int step_deadline_ms, sm_done_cb_t cb, void *arg)
+{ // Queue a transition for the bay's engine task and return immediately
+    if (t < 0 || t >= NUM_TRANSITIONS)
+        return SM_ERR_STATE;
+    struct sm_request req = {
+        .t = t,
+        .step_deadline_ms = step_deadline_ms,
+        .cb = cb,
+        .arg = arg,
+    };
+    if (xQueueSend(bay->sm_queue, &req, 0) != pdTRUE)
     {
-        LIM4_state = get_lim_switch_curr_value(LIM4_GPIO);
-        vTaskDelay(pdMS_TO_TICKS(100));
+        ESP_LOGE(TAG, "Bay %d: %s rejected, engine busy", bay->index, transition_table[t].name);
+        return SM_ERR_BUSY;
     }
+    return SM_OK;
+}
 
-    // Lock solenoid to prevent overheating
-    lock_solenoid();
-
-    // Set new state
-    printf("UNLOCKED_state\n");
-    curr_state = Unlocked;
-    return 0;
+bool sm_transition_allowed(struct bay *bay, enum transitions t)
+{
+    if (t < 0 || t >= NUM_TRANSITIONS)
+        return false;
+    return transition_table[t].from & SM_BIT(bay->state);
 }
 
-int to_unloading(void)
+void sm_set_observer(sm_observer_t cb)
 {
-    // Move sled out
-    sled_out();
+    sm_observer = cb;
+}
 
-    // Poll until limit switch is hit for SLED OUT, then stop the sled (LIM1)
-    LIM1_state = get_lim_switch_curr_value(LIM1_GPIO);
-    while (LIM1_state)
-    {
-        LIM1_state = get_lim_switch_curr_value(LIM1_GPIO);
-        vTaskDelay(pdMS_TO_TICKS(100));
-    }
+const char *sm_transition_name(enum transitions t)
+{
+    if (t < 0 || t >= NUM_TRANSITIONS)
+        return "unknown";
+    return transition_table[t].name;
+}
 
-    // Stop sled
-    stop_sled();
+int to_unlockedem(struct bay *bay)
+{
+    return sm_request(bay, T_UNLOCKEDEM, 0, NULL, NULL);
+}
 
-    // Set new state
-    printf("UNLOADING_state\n");
-    curr_state = Unloading;
-    return 0;
+int to_loading(struct bay *bay)
+{
+    return sm_request(bay, T_LOADING, 0, NULL, NULL);
 }
 
-int to_empty(void)
+int to_closed(struct bay *bay)
 {
-    // Move sled in
-    sled_in();
+    return sm_request(bay, T_CLOSED, 0, NULL, NULL);
+}
 
-    // Poll until limit switch is hit for SLED IN, then stop the sled (LIM3)
-    LIM3_state = get_lim_switch_curr_value(LIM3_GPIO);
-    while (LIM3_state)
-    {
-        LIM3_state = get_lim_switch_curr_value(LIM3_GPIO);
-        vTaskDelay(pdMS_TO_TICKS(100));
-    }
+int to_compvision(struct bay *bay)
+{
+    return sm_request(bay, T_COMPVISION, 0, NULL, NULL);
+}
 
-    // Stop the sled
-    stop_sled();
+int to_charging(struct bay *bay)
+{
+    return sm_request(bay, T_CHARGING, 0, NULL, NULL);
+}
 
-    // Poll until limit switch is pressed for DOOR is CLOSED (LIM4)
-    LIM4_state = get_lim_switch_curr_value(LIM4_GPIO);
-    while (LIM4_state)
-    {
-        LIM4_state = get_lim_switch_curr_value(LIM4_GPIO);
-        vTaskDelay(pdMS_TO_TICKS(100));
-    }
+int to_unlocked(struct bay *bay)
+{
+    return sm_request(bay, T_UNLOCKED, 0, NULL, NULL);
+}
 
-    // Turn off heartbeat from unloading
-    heartbeat_stop();
+int to_unloading(struct bay *bay)
+{
+    return sm_request(bay, T_UNLOADING, 0, NULL, NULL);
+}
 
-    // Set new state
-    printf("EMPTY_state\n");
-    curr_state = Empty;
-    return 0;
-}
\ No newline at end of file
+int to_empty(struct bay *bay)
+{
+    return sm_request(bay, T_EMPTY, 0, NULL, NULL);
+}
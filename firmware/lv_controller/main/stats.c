@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "nvs.h"
+
+#include "bay.h"
+#include "stats.h"
+
+struct bay_stats
+{
+    portMUX_TYPE lock;
+    bool dirty; // Recorded since the last NVS snapshot
+    struct stats_hist hist[NUM_STATS];
+};
+
+/* GLOBALS */
+static const char *TAG = "stats";
+static struct bay_stats stats_ctx[NUM_BAYS];
+static TaskHandle_t stats_task_handle = NULL;
+
+static const char *stat_names[NUM_STATS - NUM_TRANSITIONS] = {
+    [STAT_SLED_OUT - NUM_TRANSITIONS] = "sled_out",
+    [STAT_SLED_IN - NUM_TRANSITIONS] = "sled_in",
+    [STAT_NFC - NUM_TRANSITIONS] = "nfc_to_action",
+    [STAT_DOOR_OPEN - NUM_TRANSITIONS] = "door_open",
+    [STAT_DOOR_CLOSE - NUM_TRANSITIONS] = "door_close",
+};
+
+static int bucket_of(uint32_t us)
+{
+    if (us < (1U << STATS_MIN_SHIFT))
+        return 0;
+    int msb = 31 - __builtin_clz(us);
+    int octave = msb - STATS_MIN_SHIFT;
+    if (octave >= STATS_OCTAVES)
+        return STATS_NUM_BUCKETS - 1;
+    int half = (us >> (msb - 1)) & 1; // Upper or lower half of the octave
+    return 1 + octave * 2 + half;
+}
+
+static uint32_t bucket_top(int b)
+{ // Largest value that lands in bucket b
+    if (b == 0)
+        return (1U << STATS_MIN_SHIFT) - 1;
+    if (b >= STATS_NUM_BUCKETS - 1)
+        return UINT32_MAX;
+    uint32_t base = 1U << ((b - 1) / 2 + STATS_MIN_SHIFT);
+    return ((b - 1) % 2 ? 2 * base : base + base / 2) - 1;
+}
+
+static uint32_t percentile(const struct stats_hist *h, int p)
+{ // Top of the bucket holding the p-th percentile, never above the recorded max
+    uint32_t rank = (h->count * p + 99) / 100;
+    uint32_t seen = 0;
+    for (int b = 0; b < STATS_NUM_BUCKETS; b++)
+    {
+        seen += h->buckets[b];
+        if (seen >= rank)
+            return bucket_top(b) < h->max_us ? bucket_top(b) : h->max_us;
+    }
+    return h->max_us;
+}
+
+static void nvs_key(int bay, char *key, size_t len)
+{
+    snprintf(key, len, "%s%d", STATS_NVS_KEY, bay);
+}
+
+static void save_stats(int bay)
+{
+    struct bay_stats *st = &stats_ctx[bay];
+    static struct stats_hist snap[NUM_STATS]; // Only the stats task saves, too big for its stack
+    nvs_handle_t h;
+    char key[16];
+
+    portENTER_CRITICAL(&st->lock);
+    memcpy(snap, st->hist, sizeof(snap));
+    st->dirty = false;
+    portEXIT_CRITICAL(&st->lock);
+
+    nvs_key(bay, key, sizeof(key));
+    if (nvs_open(STATS_NVS_NAMESPACE, NVS_READWRITE, &h) != ESP_OK)
+        return;
+    if (nvs_set_blob(h, key, snap, sizeof(snap)) == ESP_OK)
+        nvs_commit(h);
+    nvs_close(h);
+}
+
+static void load_stats(int bay)
+{
+    struct bay_stats *st = &stats_ctx[bay];
+    nvs_handle_t h;
+    char key[16];
+    nvs_key(bay, key, sizeof(key));
+    if (nvs_open(STATS_NVS_NAMESPACE, NVS_READONLY, &h) != ESP_OK)
+        return;
+    size_t len = sizeof(st->hist);
+    if (nvs_get_blob(h, key, st->hist, &len) != ESP_OK || len != sizeof(st->hist))
+        memset(st->hist, 0, sizeof(st->hist)); // Missing or from an older layout
+    else
+        ESP_LOGI(TAG, "Bay %d: stats restored", bay);
+    nvs_close(h);
+}
+
+static void stats_task(void *params)
+{ // Periodic snapshots, so a reboot loses at most one period of samples. A reset is saved straight away
+    while (true)
+    {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(STATS_SAVE_PERIOD_MS));
+        for (int i = 0; i < NUM_BAYS; i++)
+        {
+            if (stats_ctx[i].dirty)
+                save_stats(i);
+        }
+    }
+}
+
+void init_stats(void)
+{
+    for (int i = 0; i < NUM_BAYS; i++)
+    {
+        struct bay_stats *st = &stats_ctx[i];
+        portMUX_INITIALIZE(&st->lock);
+        memset(st->hist, 0, sizeof(st->hist));
+        st->dirty = false;
+        load_stats(i);
+    }
+    xTaskCreate(stats_task, "stats", 3072, NULL, 2, &stats_task_handle);
+}
+
+void stats_record(struct bay *bay, int id, int64_t us)
+{ // Cheap enough for any task, no NVS here
+    if (id < 0 || id >= NUM_STATS || us < 0)
+        return;
+    struct bay_stats *st = &stats_ctx[bay->index];
+    uint32_t v = us > UINT32_MAX ? UINT32_MAX : (uint32_t)us;
+    struct stats_hist *h = &st->hist[id];
+    portENTER_CRITICAL(&st->lock);
+    h->count++;
+    h->sum_us += v;
+    if (v > h->max_us)
+        h->max_us = v;
+    h->buckets[bucket_of(v)]++;
+    st->dirty = true;
+    portEXIT_CRITICAL(&st->lock);
+}
+
+static const char *stat_name(int id)
+{
+    return id < NUM_TRANSITIONS ? sm_transition_name(id) : stat_names[id - NUM_TRANSITIONS];
+}
+
+static void print_stats(int bay)
+{
+    struct bay_stats *st = &stats_ctx[bay];
+    printf("Bay %d\n%-15s %8s %10s %10s %10s %10s %10s\n", bay, "", "count", "mean ms", "p50 ms", "p90 ms", "p99 ms", "max ms");
+    for (int id = 0; id < NUM_STATS; id++)
+    {
+        struct stats_hist h;
+        portENTER_CRITICAL(&st->lock);
+        h.count = st->hist[id].count;
+        h.max_us = st->hist[id].max_us;
+        h.sum_us = st->hist[id].sum_us;
+        memcpy(h.buckets, st->hist[id].buckets, sizeof(h.buckets));
+        portEXIT_CRITICAL(&st->lock);
+        if (!h.count)
+            continue;
+        printf("%-15s %8u %10.1f %10.1f %10.1f %10.1f %10.1f\n", stat_name(id), (unsigned)h.count,
+               h.sum_us / 1000.0 / h.count, percentile(&h, 50) / 1000.0, percentile(&h, 90) / 1000.0,
+               percentile(&h, 99) / 1000.0, h.max_us / 1000.0);
+    }
+}
+
+int stats_comm(int argc, char **argv)
+{
+    bool reset = argc >= 2 && !strcmp(argv[1], "reset");
+    int bay_arg = reset ? 2 : 1;
+    struct bay *bay = NULL; // All bays unless one is named
+    if (argc > bay_arg && (bay = bay_from_arg(argc, argv, bay_arg)) == NULL)
+        return 0;
+    if (reset)
+    {
+        for (int i = 0; i < NUM_BAYS; i++)
+        {
+            if (bay && bay->index != i)
+                continue;
+            struct bay_stats *st = &stats_ctx[i];
+            portENTER_CRITICAL(&st->lock);
+            memset(st->hist, 0, sizeof(st->hist));
+            st->dirty = true;
+            portEXIT_CRITICAL(&st->lock);
+            printf("Bay %d stats cleared\n", i);
+        }
+        xTaskNotifyGive(stats_task_handle);
+        return 0;
+    }
+    for (int i = 0; i < NUM_BAYS; i++)
+    {
+        if (bay == NULL || bay->index == i)
+            print_stats(i);
+    }
+    return 0;
+}
@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+#include "trace.h"
+
+/* GLOBALS */
+static const char *TAG = "trace";
+
+// Multi producer (any task or ISR) flight recorder, oldest records are overwritten
+static struct trace_record trace_ring[TRACE_RING_LEN];
+static atomic_uint trace_head = 0;
+static unsigned drain_tail = 0; // Only used by the drain task
+static atomic_uint trace_clear = 0; // Head at the last 'trace clear', dump and drain start here
+static volatile bool trace_stream = false;
+static uint32_t trace_lost = 0;         // Only written by the drain task
+static uint32_t trace_lost_cleared = 0; // trace_lost at the last 'trace clear'
+
+static unsigned trace_first(unsigned head)
+{ // Oldest record still worth reading, the ring holds at most TRACE_RING_LEN
+    unsigned n = head - atomic_load_explicit(&trace_clear, memory_order_relaxed);
+    return head - (n > TRACE_RING_LEN ? TRACE_RING_LEN : n);
+}
+
+void IRAM_ATTR trace_emit(uint16_t id, int32_t a0, int32_t a1)
+{ // Lock free and non-blocking, safe from ISRs
+    unsigned idx = atomic_fetch_add_explicit(&trace_head, 1, memory_order_relaxed);
+    struct trace_record *r = &trace_ring[idx & (TRACE_RING_LEN - 1)];
+    r->seq = 0; // Mark in progress
+    atomic_thread_fence(memory_order_release);
+    r->time_us = (uint32_t)esp_timer_get_time();
+    r->id = id;
+    r->a0 = a0;
+    r->a1 = a1;
+    atomic_thread_fence(memory_order_release);
+    r->seq = (uint16_t)(idx + 1);
+}
+
+static bool read_record(unsigned idx, struct trace_record *out)
+{ // false if the slot is being written or has already been reused
+    const struct trace_record *r = &trace_ring[idx & (TRACE_RING_LEN - 1)];
+    *out = *r;
+    atomic_thread_fence(memory_order_acquire);
+    return out->seq == (uint16_t)(idx + 1) && r->seq == out->seq;
+}
+
+static void print_record(const struct trace_record *r)
+{ // One record per line so it survives being mixed in with log output
+    const uint8_t *b = (const uint8_t *)r;
+    printf("TR ");
+    for (int i = 0; i < sizeof(*r); i++)
+        printf("%02x", b[i]);
+    printf("\n");
+}
+
+void trace_drain(void *params)
+{ // Low priority, formatting only ever happens here or in the console task
+    struct trace_record r;
+    while (true)
+    {
+        vTaskDelay(pdMS_TO_TICKS(TRACE_DRAIN_MS));
+        unsigned head = atomic_load_explicit(&trace_head, memory_order_acquire);
+        unsigned clear = atomic_load_explicit(&trace_clear, memory_order_relaxed);
+        if ((int)(clear - drain_tail) > 0)
+            drain_tail = clear; // Cleared, not lost
+        if (head - drain_tail > TRACE_RING_LEN)
+        {
+            trace_lost += head - drain_tail - TRACE_RING_LEN;
+            drain_tail = head - TRACE_RING_LEN;
+        }
+        for (; drain_tail != head; drain_tail++)
+        {
+            if (!read_record(drain_tail, &r))
+            {
+                if (trace_stream)
+                    trace_lost++;
+                continue;
+            }
+            if (trace_stream)
+                print_record(&r);
+        }
+    }
+}
+
+void init_trace(void)
+{
+    xTaskCreate(trace_drain, "trace_drain", 2048, NULL, 1, NULL);
+}
+
+static void trace_dump(void)
+{
+    struct trace_record r;
+    unsigned head = atomic_load_explicit(&trace_head, memory_order_acquire);
+    unsigned start = trace_first(head);
+    printf("TRACE BEGIN %u\n", head - start);
+    for (unsigned i = start; i != head; i++)
+    {
+        if (read_record(i, &r))
+            print_record(&r);
+    }
+    printf("TRACE END\n");
+}
+
+int trace_comm(int argc, char **argv)
+{
+    if (argc == 2 && !strcmp(argv[1], "dump"))
+    {
+        trace_dump();
+    }
+    else if (argc == 2 && !strcmp(argv[1], "clear"))
+    {
+        // Only the read side moves, producers keep writing into the ring
+        trace_lost_cleared = trace_lost;
+        atomic_store(&trace_clear, atomic_load(&trace_head));
+        printf("Trace cleared\n");
+    }
+    else if (argc == 3 && !strcmp(argv[1], "stream"))
+    {
+        trace_stream = !strcmp(argv[2], "on");
+        printf("Trace streaming %s\n", trace_stream ? "on" : "off");
+    }
+    else if (argc == 1)
+    {
+        printf("Trace: %u records written, %u lost while streaming, streaming %s\n",
+               atomic_load(&trace_head) - atomic_load(&trace_clear), trace_lost - trace_lost_cleared,
+               trace_stream ? "on" : "off");
+    }
+    else
+    {
+        printf("Usage: trace [dump | clear | stream on|off]\n");
+        ESP_LOGE(TAG, "Invalid trace arguments");
+        return 1;
+    }
+    return 0;
+}
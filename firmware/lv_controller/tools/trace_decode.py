@@ -0,0 +1,87 @@
+"""
+Decode LV controller trace records into a timeline.
+
+The firmware prints each 16 byte record as a "TR <32 hex chars>" line, either
+from 'trace dump' or while 'trace stream on' is set. Everything else on the
+console is ignored, so a raw serial capture can be fed straight in.
+
+Usage:
+    python trace_decode.py capture.log
+    python trace_decode.py --port /dev/ttyACM1 --dump
+"""
+import argparse
+import os
+import re
+import struct
+import sys
+
+RECORD = struct.Struct("<IHHii")  # time_us, id, seq, a0, a1
+TRACE_H = os.path.join(os.path.dirname(__file__), "..", "include", "trace.h")
+
+
+def load_events(path):
+    # Event names and argument labels come from the enum in trace.h
+    events = {}
+    pattern = re.compile(r"\s*(TR_\w+)\s*=\s*(0x[0-9a-fA-F]+|\d+),?\s*(?://\s*(.*))?")
+    with open(path) as f:
+        for line in f:
+            m = pattern.match(line)
+            if m:
+                events[int(m.group(2), 0)] = (m.group(1)[3:], m.group(3) or "")
+    return events
+
+
+def parse_records(lines):
+    for line in lines:
+        m = re.search(r"TR ([0-9a-fA-F]{32})", line)
+        if m:
+            yield RECORD.unpack(bytes.fromhex(m.group(1)))
+
+
+def decode(records, events):
+    last = None
+    base = None
+    wrap = 0
+    for time_us, ev, seq, a0, a1 in records:
+        # Timestamps are the low 32 bits of esp_timer, unwrap them
+        if last is not None and time_us < last and last - time_us > 1 << 31:
+            wrap += 1 << 32
+        last = time_us
+        t = time_us + wrap
+        if base is None:
+            base = prev = t
+        bay, ev = ev >> 8, ev & 0xFF
+        name, labels = events.get(ev, ("0x%02x" % ev, ""))
+        print("%12.3f ms %+10.3f ms  bay %d  %-14s a0=%-8d a1=%-8d %s"
+              % ((t - base) / 1000, (t - prev) / 1000, bay, name, a0, a1, labels))
+        prev = t
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("capture", nargs="?", help="console capture file, stdin if omitted")
+    parser.add_argument("--port", help="read from a serial port instead")
+    parser.add_argument("--dump", action="store_true", help="send 'trace dump' and decode the reply")
+    parser.add_argument("--trace-h", default=TRACE_H, help="trace.h to take event names from")
+    args = parser.parse_args()
+
+    events = load_events(args.trace_h)
+    if args.port:
+        import serial
+        ser = serial.Serial(args.port, 115200, timeout=2)
+        if args.dump:
+            ser.write(b"trace dump\n")
+        lines = []
+        while True:
+            line = ser.readline().decode(errors="replace")
+            if not line or "TRACE END" in line:
+                break
+            lines.append(line)
+        decode(parse_records(lines), events)
+    else:
+        f = open(args.capture) if args.capture else sys.stdin
+        decode(parse_records(f), events)
+
+
+if __name__ == "__main__":
+    main()